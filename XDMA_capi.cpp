@@ -0,0 +1,359 @@
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include <errno.h>
+
+#include "XDMA_capture.hpp"
+#include "XDMA_sched.hpp"
+#include "XDMA_udrv.hpp"
+#include "xdma_udrv.h"
+
+using namespace std;
+using namespace XDMA_udrv;
+
+/*
+The C++ objects behind the C handles. Everything a view can point into is
+held by a shared_ptr, a view's xdma_ref is one more reference to it, so
+closing a handle never pulls memory out from under a consumer.
+*/
+
+struct xdma_dev {
+  shared_ptr<XDMA> xdma;
+};
+
+struct xdma_buf {
+  shared_ptr<HugePageWrapper> page;
+};
+
+struct xdma_ref {
+  shared_ptr<const void> keep;
+};
+
+struct xdma_queue {
+  struct pending {
+    uint64_t id;
+    // A freed buffer must not be reused while the card still writes to it
+    shared_ptr<HugePageWrapper> page;
+  };
+
+  shared_ptr<XDMA> xdma;
+  // Scheduler request id to the caller's. Before engines and sched, so the
+  // pages outlive the engines being stopped.
+  unordered_map<uint64_t, pending> inflight;
+  // Before sched, which stops them on destruction
+  vector<unique_ptr<XDMAEngine>> engines;
+  unique_ptr<XScheduler> sched;
+  uint32_t n_channels;
+  uint64_t next_id;
+  vector<xfer_done> done;
+  deque<xdma_cpl> backlog;
+};
+
+namespace {
+
+struct ring_state {
+  ring_state(uint32_t n_desc, uint32_t desc_size) : ring(n_desc, desc_size) {}
+  ~ring_state() { this->ring.stop(); }
+
+  shared_ptr<XDMA> xdma;
+  unique_ptr<XDMAEngine> engine;
+  XPacketRing ring;
+  vector<c2h_packet> pkts;
+  // Views handed out and not released yet, dropped from any thread
+  atomic<uint64_t> outstanding{0};
+  // Received descriptors not given back to the engine
+  bool unreleased = false;
+};
+
+thread_local string last_error;
+
+int fail(int err, const char *what) {
+  last_error = what;
+  return err;
+}
+
+// Run fn, turning exceptions into -errno
+template <typename F> int guard(F &&fn) {
+  try {
+    return fn();
+  } catch (const system_error &e) {
+    // The driver throws with either sign
+    int v = e.code().value();
+    last_error = e.what();
+    return v < 0 ? v : (v ? -v : -EIO);
+  } catch (const bad_alloc &) {
+    return fail(-ENOMEM, "Out of memory");
+  } catch (const exception &e) {
+    // range_error and logic_error: the arguments don't fit the device
+    last_error = e.what();
+    return -EINVAL;
+  } catch (...) {
+    return fail(-EIO, "Unknown error");
+  }
+}
+
+void set_view(xdma_view *view, const void *data, uint64_t len,
+              uint32_t flags, uint32_t status, shared_ptr<const void> keep) {
+  view->data = data;
+  view->len = len;
+  view->flags = flags;
+  view->status = status;
+  view->ref = new xdma_ref{move(keep)};
+}
+
+// Engines are numbered from 0 without gaps
+uint32_t count_channels(XDMA &xdma, XDMA_ADDR_TARGET target,
+                        uint32_t &stream) {
+  uint32_t n = 0;
+  stream = 0;
+  while (n < 4) {
+    uint32_t id = xdma.ctrl_reg_read(target, n, XDMA_CH_IDENTIFIER);
+    if ((id >> 20) != XDMA_CH_ID_SUBSYSTEM)
+      break;
+    if (id & XDMA_CH_ID_STREAM)
+      stream |= 1 << n;
+    n++;
+  }
+  return n;
+}
+
+} // namespace
+
+struct xdma_ring {
+  shared_ptr<ring_state> state;
+};
+
+struct xdma_cap {
+  shared_ptr<XCaptureReader> reader;
+};
+
+extern "C" {
+
+int xdma_abi_version(void) { return XDMA_UDRV_ABI_VERSION; }
+
+const char *xdma_last_error(void) { return last_error.c_str(); }
+
+int xdma_enumerate(int32_t *uio_index, int max) {
+  return guard([&] {
+    vector<int32_t> found = XDMA::enumerate();
+    for (int i = 0; i < max && i < (int)found.size(); i++)
+      uio_index[i] = found[i];
+    return (int)found.size();
+  });
+}
+
+int xdma_open(int32_t uio_index, xdma_dev **dev) {
+  return guard([&] {
+    XDMA_factory_opt opt;
+    opt.uio_index = uio_index;
+    unique_ptr<xdma_dev> d = make_unique<xdma_dev>();
+    d->xdma = XDMA::XDMA_factory(opt);
+    *dev = d.release();
+    return 0;
+  });
+}
+
+void xdma_close(xdma_dev *dev) { delete dev; }
+
+int xdma_get_info(xdma_dev *dev, xdma_dev_info *info) {
+  return guard([&] {
+    memset(info, 0, sizeof(*info));
+    info->uio_index = dev->xdma->get_uio_index();
+    info->n_bars = dev->xdma->get_num_of_bars();
+    info->xdma_bar = dev->xdma->get_xdma_bar_index();
+    info->n_h2c = count_channels(*dev->xdma, H2C_CHANNEL, info->h2c_stream);
+    info->n_c2h = count_channels(*dev->xdma, C2H_CHANNEL, info->c2h_stream);
+    return 0;
+  });
+}
+
+int xdma_buf_alloc(uint64_t len, xdma_buf **buf) {
+  if (len == 0 || len > (1UL << 30))
+    return fail(-EINVAL, "Buffer length must be 1 byte to 1 GiB");
+  return guard([&] {
+    unique_ptr<xdma_buf> b = make_unique<xdma_buf>();
+    b->page = make_shared<HugePageWrapper>(len > (2UL << 20) ? HUGE_1GiB
+                                                             : HUGE_2MiB);
+    *buf = b.release();
+    return 0;
+  });
+}
+
+void xdma_buf_free(xdma_buf *buf) { delete buf; }
+
+void *xdma_buf_addr(xdma_buf *buf) { return buf->page->getVAddr(); }
+
+uint64_t xdma_buf_len(xdma_buf *buf) { return buf->page->getLen(); }
+
+int xdma_buf_view(xdma_buf *buf, uint64_t offset, uint64_t len,
+                  xdma_view *view) {
+  uint64_t buf_len = buf->page->getLen();
+  if (offset > buf_len || len > buf_len - offset)
+    return fail(-EINVAL, "View outside the buffer");
+  return guard([&] {
+    const uint8_t *data = (const uint8_t *)buf->page->getVAddr() + offset;
+    set_view(view, data, len, XDMA_VIEW_EOP, 0,
+             shared_ptr<const void>(buf->page, data));
+    return 0;
+  });
+}
+
+int xdma_queue_open(xdma_dev *dev, uint32_t n_channels, xdma_queue **queue) {
+  if (n_channels == 0 || n_channels > 4)
+    return fail(-EINVAL, "1 to 4 channels please");
+  return guard([&] {
+    unique_ptr<xdma_queue> q = make_unique<xdma_queue>();
+    q->xdma = dev->xdma;
+    q->sched = make_unique<XScheduler>(true);
+    for (uint32_t c = 0; c < n_channels; c++) {
+      for (XDMA_DIR dir : {DIR_H2C, DIR_C2H}) {
+        q->engines.push_back(make_unique<XDMAEngine>(*q->xdma, dir, c));
+        q->sched->add_engine(*q->engines.back());
+      }
+    }
+    q->n_channels = n_channels;
+    q->next_id = 0;
+    *queue = q.release();
+    return 0;
+  });
+}
+
+void xdma_queue_close(xdma_queue *queue) { delete queue; }
+
+int xdma_submit(xdma_queue *queue, const xdma_xfer *xfer) {
+  if ((xfer->dir != XDMA_H2C && xfer->dir != XDMA_C2H) || !xfer->buf)
+    return fail(-EINVAL, "Invalid direction or buffer");
+  if (xfer->channel < -1 || (xfer->channel != -1 &&
+                             (uint32_t)xfer->channel >= queue->n_channels))
+    return fail(-EINVAL, "Channel not opened on the queue");
+  uint64_t buf_len = xfer->buf->page->getLen();
+  if (xfer->len == 0 || xfer->offset > buf_len ||
+      xfer->len > buf_len - xfer->offset)
+    return fail(-EINVAL, "Transfer outside the buffer");
+  return guard([&] {
+    xfer_request req = {};
+    req.id = queue->next_id;
+    req.dir = (XDMA_DIR)xfer->dir;
+    req.channel = xfer->channel;
+    req.host_paddr = xfer->buf->page->getPAddr() + xfer->offset;
+    req.card_addr = xfer->card_addr;
+    req.len = xfer->len;
+    req.priority = xfer->priority;
+    req.deadline_ns = xfer->deadline_ns;
+    queue->sched->submit(req);
+    queue->inflight[req.id] = {xfer->id, xfer->buf->page};
+    queue->next_id++;
+    return 0;
+  });
+}
+
+int xdma_poll(xdma_queue *queue, xdma_cpl *cpl, int max) {
+  return guard([&] {
+    queue->done.clear();
+    queue->sched->poll(queue->done);
+    for (auto &d : queue->done) {
+      auto it = queue->inflight.find(d.id);
+      if (it == queue->inflight.end())
+        continue;
+      queue->backlog.push_back({it->second.id, d.len, 0, d.late});
+      queue->inflight.erase(it);
+    }
+    int n = 0;
+    for (; n < max && !queue->backlog.empty(); n++) {
+      cpl[n] = queue->backlog.front();
+      queue->backlog.pop_front();
+    }
+    return n;
+  });
+}
+
+int xdma_ring_open(xdma_dev *dev, uint32_t channel, uint32_t n_desc,
+                   uint32_t desc_size, xdma_ring **ring) {
+  return guard([&] {
+    shared_ptr<ring_state> st = make_shared<ring_state>(n_desc, desc_size);
+    st->xdma = dev->xdma;
+    st->engine = make_unique<XDMAEngine>(*st->xdma, DIR_C2H, channel);
+    st->ring.initialize();
+    st->ring.start(*st->engine);
+    unique_ptr<xdma_ring> r = make_unique<xdma_ring>();
+    r->state = move(st);
+    *ring = r.release();
+    return 0;
+  });
+}
+
+void xdma_ring_close(xdma_ring *ring) {
+  if (!ring)
+    return;
+  // The ring memory itself goes with the last view
+  ring->state->ring.stop();
+  delete ring;
+}
+
+int xdma_ring_recv(xdma_ring *ring, xdma_view *views, int max) {
+  if (max <= 0)
+    return 0;
+  return guard([&] {
+    shared_ptr<ring_state> &st = ring->state;
+    if (st->unreleased && st->outstanding.load(memory_order_acquire) == 0) {
+      st->ring.release();
+      st->unreleased = false;
+    }
+    st->pkts.resize(max);
+    size_t n = st->ring.recv(st->pkts.data(), max);
+    for (size_t i = 0; i < n; i++) {
+      const c2h_packet &p = st->pkts[i];
+      st->outstanding.fetch_add(1, memory_order_relaxed);
+      set_view(&views[i], p.data, p.length, p.eop ? XDMA_VIEW_EOP : 0, 0,
+               shared_ptr<const void>(p.data, [st](const void *) {
+                 st->outstanding.fetch_sub(1, memory_order_release);
+               }));
+    }
+    if (n)
+      st->unreleased = true;
+    return (int)n;
+  });
+}
+
+int xdma_cap_open(const char *path, xdma_cap **cap) {
+  return guard([&] {
+    unique_ptr<xdma_cap> c = make_unique<xdma_cap>();
+    c->reader = make_shared<XCaptureReader>(path);
+    *cap = c.release();
+    return 0;
+  });
+}
+
+void xdma_cap_close(xdma_cap *cap) { delete cap; }
+
+uint64_t xdma_cap_nr_chunks(xdma_cap *cap) {
+  return cap->reader->getNrChunks();
+}
+
+int xdma_cap_chunk(xdma_cap *cap, uint64_t idx, xdma_view *view) {
+  return guard([&] {
+    const xcap_index &e = cap->reader->getIndex(idx);
+    const void *data = cap->reader->getChunk(idx);
+    set_view(view, data, e.length, XDMA_VIEW_EOP, e.status,
+             shared_ptr<const void>(cap->reader, data));
+    return 0;
+  });
+}
+
+void xdma_view_release(xdma_view *view) {
+  delete view->ref;
+  view->ref = nullptr;
+  view->data = nullptr;
+  view->len = 0;
+}
+
+} // extern "C"
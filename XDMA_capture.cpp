@@ -0,0 +1,220 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "XDMA_capture.hpp"
+#include "XDMA_crc.hpp"
+#include "XDMA_timing.hpp"
+#include "XDMA_trace.hpp"
+
+using namespace std;
+
+namespace {
+
+uint64_t align_up(uint64_t n) {
+  return (n + XCAP_ALIGN - 1) & ~(XCAP_ALIGN - 1ULL);
+}
+
+void *alloc_aligned(uint64_t len) {
+  void *p = aligned_alloc(XCAP_ALIGN, len);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  memset(p, 0, len);
+  return p;
+}
+
+} // namespace
+
+namespace XDMA_udrv {
+
+static_assert(sizeof(xcap_header) == XCAP_ALIGN, "xcap_header size");
+static_assert(XCAP_ALIGN % sizeof(xcap_index) == 0, "xcap_index size");
+
+XCaptureWriter::XCaptureWriter(const string &path, uint64_t n_chunks,
+                               uint32_t chunk_size, bool direct)
+    : path(path), direct(direct), n_written(0) {
+  if (n_chunks == 0 || chunk_size == 0 || chunk_size % XCAP_ALIGN) {
+    throw std::range_error("Invalid capture geometry");
+  }
+  int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  this->fd = open(path.c_str(), flags | (direct ? O_DIRECT : 0), 0664);
+  // tmpfs and friends don't do O_DIRECT
+  if (this->fd < 0 && direct && errno == EINVAL) {
+    this->direct = false;
+    this->fd = open(path.c_str(), flags, 0664);
+  }
+  if (this->fd < 0) {
+    throw system_error(error_code(errno, generic_category()),
+                       "open() " + path);
+  }
+
+  this->index_len = align_up(n_chunks * sizeof(xcap_index));
+  this->hdr = (xcap_header *)alloc_aligned(sizeof(xcap_header));
+  this->index = (xcap_index *)alloc_aligned(this->index_len);
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  memcpy(this->hdr->magic, XCAP_MAGIC, sizeof(XCAP_MAGIC));
+  this->hdr->version = XCAP_VERSION;
+  this->hdr->header_size = sizeof(xcap_header);
+  this->hdr->n_chunks = n_chunks;
+  this->hdr->index_offset = sizeof(xcap_header);
+  this->hdr->data_offset = sizeof(xcap_header) + this->index_len;
+  this->hdr->chunk_size = chunk_size;
+  this->hdr->tsc_per_ns = tsc_per_ns();
+  this->hdr->created_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+  this->data_end = this->hdr->data_offset;
+}
+
+XCaptureWriter::~XCaptureWriter() {
+  if (this->fd >= 0)
+    ::close(this->fd);
+  free(this->hdr);
+  free(this->index);
+}
+
+void XCaptureWriter::pwrite_all(const void *buf, uint64_t len,
+                                uint64_t offset) {
+  const uint8_t *p = (const uint8_t *)buf;
+  while (len) {
+    ssize_t rv = pwrite(this->fd, p, len, offset);
+    if (rv < 0 && errno == EINTR)
+      continue;
+    if (rv <= 0) {
+      throw system_error(error_code(rv ? errno : EIO, generic_category()),
+                         "pwrite() " + this->path);
+    }
+    p += rv;
+    len -= rv;
+    offset += rv;
+  }
+}
+
+void XCaptureWriter::set_crc(bool enable) {
+  if (this->n_written) {
+    throw std::logic_error("Capture already started");
+  }
+  if (enable)
+    this->hdr->flags |= XCAP_FLAG_CRC32C;
+  else
+    this->hdr->flags &= ~XCAP_FLAG_CRC32C;
+}
+
+void XCaptureWriter::write(const void *data, uint32_t length, uint32_t status,
+                           uint64_t tsc, uint32_t segment, uint32_t crc) {
+  XDMA_TRACE_SCOPE("capture_write");
+  if (this->fd < 0 || this->n_written == this->hdr->n_chunks) {
+    throw std::range_error("Capture full or closed");
+  }
+  if (length > this->hdr->chunk_size) {
+    throw std::range_error("Chunk longer than chunk size");
+  }
+  // O_DIRECT needs an aligned source, drop it rather than bounce
+  if (this->direct && ((uintptr_t)data % XCAP_ALIGN)) {
+    fcntl(this->fd, F_SETFL, fcntl(this->fd, F_GETFL) & ~O_DIRECT);
+    this->direct = false;
+  }
+  uint64_t len = align_up(length);
+  this->pwrite_all(data, len, this->data_end);
+
+  xcap_index &e = this->index[this->n_written++];
+  e.offset = this->data_end;
+  e.length = length;
+  e.status = status;
+  e.tsc = tsc;
+  e.segment = segment;
+  e.crc32c = crc;
+  this->data_end += len;
+  if (segment >= this->hdr->n_segments)
+    this->hdr->n_segments = segment + 1;
+}
+
+void XCaptureWriter::close() {
+  if (this->fd < 0)
+    return;
+  this->hdr->n_chunks = this->n_written;
+  // Header last, a capture cut short has no valid magic
+  this->pwrite_all(this->index, this->index_len, this->hdr->index_offset);
+  this->pwrite_all(this->hdr, sizeof(xcap_header), 0);
+  int rv = ::close(this->fd);
+  this->fd = -1;
+  if (rv) {
+    throw system_error(error_code(errno, generic_category()),
+                       "close() " + this->path);
+  }
+}
+
+XCaptureReader::XCaptureReader(const string &path) {
+  struct stat st;
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw system_error(error_code(errno, generic_category()),
+                       "open() " + path);
+  }
+  if (fstat(fd, &st) || (uint64_t)st.st_size < sizeof(xcap_header)) {
+    ::close(fd);
+    throw system_error(error_code(-EINVAL, generic_category()),
+                       "not a capture: " + path);
+  }
+  this->len = st.st_size;
+  void *p = mmap(nullptr, this->len, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    throw system_error(error_code(errno, generic_category()),
+                       "mmap() " + path);
+  }
+  this->base = (const uint8_t *)p;
+  this->hdr = (const xcap_header *)p;
+
+  if (memcmp(this->hdr->magic, XCAP_MAGIC, sizeof(XCAP_MAGIC)) ||
+      this->hdr->version != XCAP_VERSION ||
+      this->hdr->index_offset +
+              this->hdr->n_chunks * sizeof(xcap_index) >
+          this->len) {
+    munmap((void *)this->base, this->len);
+    throw system_error(error_code(-EINVAL, generic_category()),
+                       "not a capture or truncated: " + path);
+  }
+}
+
+XCaptureReader::~XCaptureReader() { munmap((void *)this->base, this->len); }
+
+const xcap_index &XCaptureReader::getIndex(uint64_t idx) {
+  if (idx >= this->hdr->n_chunks) {
+    throw std::range_error("Chunk index out of range");
+  }
+  return ((const xcap_index *)(this->base + this->hdr->index_offset))[idx];
+}
+
+const void *XCaptureReader::getChunk(uint64_t idx) {
+  const xcap_index &e = this->getIndex(idx);
+  if (e.offset + e.length > this->len) {
+    throw std::range_error("Chunk past end of file");
+  }
+  return this->base + e.offset;
+}
+
+double XCaptureReader::getChunkNs(uint64_t idx) {
+  const xcap_index &e = this->getIndex(idx);
+  return e.tsc ? (e.tsc - this->hdr->t0_tsc) / this->hdr->tsc_per_ns : 0;
+}
+
+bool XCaptureReader::verify(uint64_t idx) {
+  if (!this->hasCrc())
+    return true;
+  return crc32c(this->getChunk(idx), this->getIndex(idx).length) ==
+         this->getIndex(idx).crc32c;
+}
+
+} // namespace XDMA_udrv
@@ -0,0 +1,109 @@
+#ifndef _XDMA_CAPTURE_HPP_
+#define _XDMA_CAPTURE_HPP_
+
+#include <cstdint>
+#include <string>
+
+namespace XDMA_udrv {
+
+/*
+Indexed capture container, little endian:
+  [0, 4 KiB)            xcap_header
+  [index_offset, ...)   n_chunks x xcap_index, padded to 4 KiB
+  [data_offset, ...)    chunk data, every chunk starts 4 KiB aligned
+Chunk i's index entry sits at index_offset + i * sizeof(xcap_index), so a
+reader that mmap()s the file gets to any chunk in O(1). Everything is
+written in 4 KiB aligned blocks straight from the DMA buffer, which is what
+O_DIRECT wants.
+*/
+#define XCAP_MAGIC "XDMACAP"
+#define XCAP_VERSION 1
+#define XCAP_ALIGN 4096
+// xcap_index.crc32c is filled in
+#define XCAP_FLAG_CRC32C (1 << 0)
+
+struct xcap_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t n_chunks;
+  uint64_t index_offset;
+  uint64_t data_offset;
+  // Bytes per descriptor at capture time, chunks are at most this long
+  uint32_t chunk_size;
+  uint32_t n_segments;
+  // TSC rate and the TSC right before the doorbell, for xcap_index.tsc
+  double tsc_per_ns;
+  uint64_t t0_tsc;
+  uint64_t created_ns; // CLOCK_REALTIME
+  uint32_t flags;
+  uint8_t reserved[4020];
+} __attribute__((packed));
+
+struct xcap_index {
+  uint64_t offset;  // from the start of the file
+  uint32_t length;  // bytes received, c2h_wb.length
+  uint32_t status;  // c2h_wb.status
+  uint64_t tsc;     // completion timestamp, 0 if unknown
+  uint32_t segment; // --size index the chunk belongs to
+  uint32_t crc32c;  // of the length bytes, with XCAP_FLAG_CRC32C
+} __attribute__((packed));
+
+class XCaptureWriter {
+public:
+  // n_chunks is fixed up front so data can follow the index directly.
+  // direct: O_DIRECT, quietly buffered if the filesystem refuses it.
+  XCaptureWriter(const std::string &path, uint64_t n_chunks,
+                 uint32_t chunk_size, bool direct = true);
+  ~XCaptureWriter();
+
+  void set_t0(uint64_t t0_tsc) { this->hdr->t0_tsc = t0_tsc; }
+  // Chunks carry a CRC32C, set before the first write()
+  void set_crc(bool enable);
+  // Chunks go in order. Up to the next 4 KiB of data is written, the
+  // caller's buffer must be that long (DMA chunks are).
+  void write(const void *data, uint32_t length, uint32_t status, uint64_t tsc,
+             uint32_t segment, uint32_t crc = 0);
+  // Write index and header, the file is only valid afterwards
+  void close();
+
+  uint64_t getNrWritten() { return this->n_written; }
+  bool isDirect() { return this->direct; }
+
+private:
+  void pwrite_all(const void *buf, uint64_t len, uint64_t offset);
+
+  std::string path;
+  int fd;
+  bool direct;
+  xcap_header *hdr;
+  xcap_index *index;
+  uint64_t index_len;
+  uint64_t n_written;
+  uint64_t data_end;
+};
+
+class XCaptureReader {
+public:
+  XCaptureReader(const std::string &path);
+  ~XCaptureReader();
+
+  const xcap_header &getHeader() { return *this->hdr; }
+  uint64_t getNrChunks() { return this->hdr->n_chunks; }
+  const xcap_index &getIndex(uint64_t idx);
+  const void *getChunk(uint64_t idx);
+  // Completion time since the doorbell
+  double getChunkNs(uint64_t idx);
+  bool hasCrc() { return this->hdr->flags & XCAP_FLAG_CRC32C; }
+  // Recompute the chunk's CRC32C, true if it matches (or there is none)
+  bool verify(uint64_t idx);
+
+private:
+  const uint8_t *base;
+  uint64_t len;
+  const xcap_header *hdr;
+};
+
+} // namespace XDMA_udrv
+
+#endif
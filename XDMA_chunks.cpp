@@ -0,0 +1,78 @@
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "XDMA_chunks.hpp"
+#include "XDMA_timing.hpp"
+#include "XDMA_trace.hpp"
+
+using namespace std;
+
+namespace XDMA_udrv {
+
+XChunkReader::XChunkReader(XSGBuffer &buffer, XDMAEngine &engine,
+                           XDMA_COMPLETION_MODE mode)
+    : buffer(buffer), engine(engine), mode(mode), consumed(0), completed(0),
+      t_update(0) {}
+
+bool XChunkReader::update() {
+  uint32_t n_desc = this->buffer.getNrDesc();
+  uint32_t before = this->completed;
+
+  if (this->mode == CPL_WRITEBACK) {
+    volatile c2h_wb *wb = this->buffer.getWBVaddr();
+    while (this->completed < n_desc &&
+           (wb[this->completed].status >> 16) == XDMA_C2H_WB_MAGIC)
+      this->completed++;
+  } else {
+    uint32_t cnt = this->engine.completed_count();
+    // All ones: the device stopped answering, check_status() tells
+    if (cnt != 0xFFFFFFFF && cnt > this->completed)
+      this->completed = (cnt > n_desc) ? n_desc : cnt;
+  }
+  if (this->completed == before)
+    return false;
+  this->t_update = tsc_read();
+  XDMA_TRACE_INSTANT("desc_completed");
+  xdma_chan_stats *st = this->engine.stats();
+  uint64_t bytes = 0;
+  for (uint32_t i = before; i < this->completed; i++)
+    bytes += this->buffer.getChunk(i).length;
+  stat_add(st->desc_completed, this->completed - before);
+  stat_add(st->bytes, bytes);
+  stat_set(st->ring_occupancy, n_desc - this->completed);
+  return true;
+}
+
+size_t XChunkReader::poll(sg_chunk *chunks, size_t max) {
+  if (this->consumed == this->completed)
+    this->update();
+  size_t n = 0;
+  for (; n < max && this->consumed < this->completed; n++) {
+    chunks[n] = this->buffer.getChunk(this->consumed++);
+    chunks[n].tsc = this->t_update;
+  }
+  return n;
+}
+
+bool XChunkReader::next(sg_chunk &chunk, uint64_t timeout_ns) {
+  if (this->done())
+    return false;
+  uint64_t t_last = tsc_read(), t_checked = t_last;
+  while (!this->poll(&chunk, 1))
+    check_stall(&this->engine, t_last, tsc_read(), timeout_ns, t_checked);
+  return true;
+}
+
+uint64_t XChunkReader::for_each(const function<void(const sg_chunk &)> &fn,
+                                uint64_t timeout_ns) {
+  uint64_t bytes = 0;
+  sg_chunk c;
+  while (this->next(c, timeout_ns)) {
+    fn(c);
+    bytes += c.length;
+  }
+  return bytes;
+}
+
+} // namespace XDMA_udrv
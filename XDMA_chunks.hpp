@@ -0,0 +1,57 @@
+#ifndef _XDMA_CHUNKS_HPP_
+#define _XDMA_CHUNKS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "XDMA_udrv.hpp"
+
+namespace XDMA_udrv {
+
+/*
+Consumes a one-shot XSGBuffer transfer while it is still running. Chunks
+are handed out in order as soon as the engine reports them, either through
+the completed descriptor count register (CPL_COUNT) or the writeback magic
+in host memory (CPL_WRITEBACK, no MMIO while data flows), so the first
+chunk is available one chunk time after the doorbell rather than at the
+end. Start the engine after constructing the reader. The data stays in the
+buffer, chunks remain valid until it is initialize()d again.
+*/
+class XChunkReader {
+public:
+  XChunkReader(XSGBuffer &buffer, XDMAEngine &engine,
+               XDMA_COMPLETION_MODE mode = CPL_COUNT);
+
+  // Chunks completed since the last call, up to max, without waiting
+  size_t poll(sg_chunk *chunks, size_t max);
+  // Wait for the next chunk, false once every chunk has been handed out.
+  // Throws the engine's system_error on a channel error and ETIMEDOUT
+  // after timeout_ns without progress (0, the default, waits forever), as
+  // XCompletionTimeline does.
+  bool next(sg_chunk &chunk, uint64_t timeout_ns = 0);
+  // Every remaining chunk through fn as it completes, returns their bytes
+  uint64_t for_each(const std::function<void(const sg_chunk &)> &fn,
+                    uint64_t timeout_ns = 0);
+
+  bool done() { return this->consumed == this->buffer.getNrDesc(); }
+  // Chunks handed out so far
+  uint32_t getConsumed() { return this->consumed; }
+  // Chunks the engine reported complete so far
+  uint32_t getCompleted() { return this->completed; }
+
+private:
+  // Refresh completed from the engine, returns true if it moved
+  bool update();
+
+  XSGBuffer &buffer;
+  XDMAEngine &engine;
+  XDMA_COMPLETION_MODE mode;
+  uint32_t consumed;
+  uint32_t completed;
+  uint64_t t_update;
+};
+
+} // namespace XDMA_udrv
+
+#endif
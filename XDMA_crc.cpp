@@ -0,0 +1,135 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include <immintrin.h>
+
+#include "XDMA_crc.hpp"
+#include "XDMA_trace.hpp"
+
+using namespace std;
+
+namespace {
+
+// Reflected Castagnoli polynomial
+const uint32_t POLY = 0x82F63B78;
+// Bytes per stream and round in the 3-way loop
+const size_t BLOCK = 4096;
+
+struct sw_table {
+  uint32_t t[256];
+  sw_table() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++)
+        c = (c & 1) ? (c >> 1) ^ POLY : c >> 1;
+      t[i] = c;
+    }
+  }
+};
+
+uint32_t sw_update(uint32_t crc, const uint8_t *p, size_t len) {
+  static const sw_table tbl;
+  for (; len; len--, p++)
+    crc = tbl.t[(crc ^ *p) & 0xFF] ^ (crc >> 8);
+  return crc;
+}
+
+// x^n mod P, reflected
+uint32_t xpow_mod(uint64_t n) {
+  uint32_t r = 0x80000000;
+  for (; n; n--)
+    r = (r & 1) ? (r >> 1) ^ POLY : r >> 1;
+  return r;
+}
+
+__attribute__((target("sse4.2"))) uint32_t
+sse42_update(uint32_t crc, const uint8_t *p, size_t len) {
+  uint64_t c = crc;
+  for (; len >= 8; len -= 8, p += 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    c = _mm_crc32_u64(c, v);
+  }
+  crc = c;
+  for (; len; len--, p++)
+    crc = _mm_crc32_u8(crc, *p);
+  return crc;
+}
+
+/*
+crc32 has 3 cycles latency and 1 cycle throughput, so three independent
+streams over consecutive blocks A B C keep the unit busy. They are merged
+with crc(A B C) = A * x^(16 BLOCK) + B * x^(8 BLOCK) + C. Carry-less
+multiplying two reflected 32-bit values gives the product times x, and
+crc32 of that 64-bit value over a zero crc multiplies by x^32 and reduces,
+so shifting by n bytes takes the constant x^(8n - 33).
+*/
+__attribute__((target("sse4.2,pclmul"))) uint32_t
+pclmul_update(uint32_t crc, const uint8_t *p, size_t len) {
+  static const uint64_t k1 = xpow_mod(16 * BLOCK - 33);
+  static const uint64_t k2 = xpow_mod(8 * BLOCK - 33);
+
+  while (len >= 3 * BLOCK) {
+    uint64_t a = crc, b = 0, c = 0;
+    for (size_t i = 0; i < BLOCK; i += 8) {
+      uint64_t va, vb, vc;
+      memcpy(&va, p + i, 8);
+      memcpy(&vb, p + BLOCK + i, 8);
+      memcpy(&vc, p + 2 * BLOCK + i, 8);
+      a = _mm_crc32_u64(a, va);
+      b = _mm_crc32_u64(b, vb);
+      c = _mm_crc32_u64(c, vc);
+    }
+    __m128i ka = _mm_clmulepi64_si128(_mm_cvtsi64_si128(a),
+                                      _mm_cvtsi64_si128(k1), 0x00);
+    __m128i kb = _mm_clmulepi64_si128(_mm_cvtsi64_si128(b),
+                                      _mm_cvtsi64_si128(k2), 0x00);
+    uint64_t t = _mm_cvtsi128_si64(_mm_xor_si128(ka, kb));
+    crc = _mm_crc32_u64(0, t) ^ c;
+    p += 3 * BLOCK;
+    len -= 3 * BLOCK;
+  }
+  return sse42_update(crc, p, len);
+}
+
+using update_fn = uint32_t (*)(uint32_t, const uint8_t *, size_t);
+
+update_fn select_update_fn() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul"))
+    return pclmul_update;
+  if (__builtin_cpu_supports("sse4.2"))
+    return sse42_update;
+  return sw_update;
+}
+
+} // namespace
+
+namespace XDMA_udrv {
+
+uint32_t crc32c(const void *data, size_t len, uint32_t crc) {
+  static const update_fn update = select_update_fn();
+  return ~update(~crc, (const uint8_t *)data, len);
+}
+
+uint32_t crc32c_sw(const void *data, size_t len, uint32_t crc) {
+  return ~sw_update(~crc, (const uint8_t *)data, len);
+}
+
+XCrcPool::XCrcPool(uint32_t n_chunks, unsigned n_threads)
+    : crcs(n_chunks, 0), pool(n_threads) {}
+
+void XCrcPool::submit(uint32_t idx, const void *data, size_t len) {
+  if (idx >= this->crcs.size()) {
+    throw std::range_error("CRC chunk index out of range");
+  }
+  // Each job owns its slot, wait() orders the stores before get()
+  this->pool.submit([this, idx, data, len](unsigned) {
+    XDMA_TRACE_SCOPE("crc32c");
+    this->crcs[idx] = crc32c(data, len);
+  });
+}
+
+} // namespace XDMA_udrv
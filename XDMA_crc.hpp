@@ -0,0 +1,45 @@
+#ifndef _XDMA_CRC_HPP_
+#define _XDMA_CRC_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "XDMA_jobs.hpp"
+
+namespace XDMA_udrv {
+
+/*
+CRC32C (Castagnoli, iSCSI/ext4 flavour: ~0 in, ~0 out).
+crc32c() picks SSE4.2 crc32 over three interleaved streams merged with
+PCLMULQDQ when the CPU has both, plain SSE4.2 or a table otherwise.
+Pass the previous return value as crc to continue a running checksum.
+*/
+uint32_t crc32c(const void *data, size_t len, uint32_t crc = 0);
+// Table driven reference
+uint32_t crc32c_sw(const void *data, size_t len, uint32_t crc = 0);
+
+/*
+Checksums chunks on worker threads as they are submitted, meant to be fed
+from the completion path so each chunk is read while still in cache.
+Chunk memory has to stay valid until wait().
+*/
+class XCrcPool {
+public:
+  XCrcPool(uint32_t n_chunks, unsigned n_threads);
+
+  void submit(uint32_t idx, const void *data, size_t len);
+  // Block until every submitted chunk is done
+  void wait() { this->pool.wait(); }
+  uint32_t get(uint32_t idx) { return this->crcs[idx]; }
+  unsigned getNrThreads() { return this->pool.getNrThreads(); }
+
+private:
+  std::vector<uint32_t> crcs;
+  // Last, its workers write crcs
+  XJobPool pool;
+};
+
+} // namespace XDMA_udrv
+
+#endif
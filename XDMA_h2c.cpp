@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "XDMA_h2c.hpp"
+#include "XDMA_sched.hpp"
+#include "XDMA_timing.hpp"
+#include "XDMA_trace.hpp"
+
+using namespace std;
+
+namespace {
+
+double ns_since(uint64_t tsc) {
+  return (XDMA_udrv::tsc_read() - tsc) / XDMA_udrv::tsc_per_ns();
+}
+
+} // namespace
+
+namespace XDMA_udrv {
+
+XH2CStream::XH2CStream(XDMAEngine &h2c, uint32_t slot_size)
+    : h2c(h2c), slot_size(slot_size), page(HUGE_1GiB), fill_ns(0),
+      gen_wait_ns(0), slot_wait_ns(0) {
+  if (h2c.get_dir() != DIR_H2C) {
+    throw std::logic_error("H2C stream needs an H2C engine");
+  }
+  if (slot_size < XDMA_MIN_CHUNK_SIZE || slot_size % XDMA_MIN_CHUNK_SIZE ||
+      this->page.getLen() / slot_size < 2) {
+    throw std::range_error("Invalid H2C slot size");
+  }
+  this->n_slots = this->page.getLen() / slot_size;
+  this->slot_len.resize(this->n_slots);
+}
+
+uint64_t XH2CStream::run(const fill_fn &fill, const pace_fn &pace,
+                         uint64_t card_addr) {
+  XDMA_TRACE_SCOPE("h2c_stream");
+  atomic<uint64_t> filled(0);
+  // Set once fill returned 0, filled is final then
+  atomic<bool> ended(false);
+  atomic<bool> stop(false);
+  uint64_t freed = 0, n_byte = 0;
+  exception_ptr gen_error;
+  mutex lock;
+  condition_variable slot_freed;
+  this->fill_ns = this->gen_wait_ns = this->slot_wait_ns = 0;
+
+  // Producer: slot k is free once message k - n_slots was sent
+  thread gen([&]() {
+    try {
+      for (uint64_t k = 0;; k++) {
+        uint64_t t = tsc_read();
+        {
+          unique_lock<mutex> lk(lock);
+          slot_freed.wait(
+              lk, [&]() { return stop || k - freed < this->n_slots; });
+        }
+        if (stop)
+          return;
+        this->slot_wait_ns += ns_since(t);
+        t = tsc_read();
+        uint32_t len = fill(k, (uint8_t *)this->page.getVAddr() +
+                                   (k % this->n_slots) * this->slot_size);
+        this->fill_ns += ns_since(t);
+        if (len > this->slot_size) {
+          throw std::range_error("Message longer than the H2C slot");
+        }
+        if (!len)
+          break;
+        this->slot_len[k % this->n_slots] = len;
+        filled.store(k + 1, memory_order_release);
+      }
+    } catch (...) {
+      gen_error = current_exception();
+      stop = true;
+    }
+    ended = true;
+  });
+
+  try {
+    XScheduler sched(true, 4096, 1024);
+    vector<xfer_done> done;
+    uint64_t submitted = 0, completed = 0;
+    uint64_t t_idle = 0, t_checked = tsc_read();
+    uint64_t check_tsc = 1000000 * tsc_per_ns();
+    // No more in flight than the ring has credits for, the rest would pile
+    // up in the scheduler's pending list and slow down every poll
+    uint64_t slot_desc = (this->slot_size + MEM_CHUNK_SIZE - 1) / MEM_CHUNK_SIZE;
+    uint64_t max_inflight = XDMA_MAX_DESC_CREDITS / slot_desc;
+
+    sched.add_engine(this->h2c);
+    while (!stop) {
+      bool last = ended;
+      uint64_t f = filled.load(memory_order_acquire);
+      if (last && completed == f)
+        break;
+      for (; submitted < f && submitted - completed < max_inflight;
+           submitted++) {
+        uint64_t slot = submitted % this->n_slots;
+        uint32_t len = this->slot_len[slot];
+        if (pace && tsc_read() < pace(submitted, len))
+          break;
+        xfer_request req = {};
+        req.id = submitted;
+        req.dir = DIR_H2C;
+        req.channel = -1;
+        req.host_paddr = this->page.getPAddr() + slot * this->slot_size;
+        req.card_addr = card_addr + slot * this->slot_size;
+        req.len = len;
+        sched.submit(req);
+      }
+      // Nothing in flight and nothing ready: waiting for the producer
+      if (submitted == completed && submitted == f && !t_idle)
+        t_idle = tsc_read();
+      if (submitted > completed && t_idle) {
+        this->gen_wait_ns += ns_since(t_idle);
+        t_idle = 0;
+      }
+
+      done.clear();
+      if (sched.poll(done)) {
+        completed += done.size();
+        for (auto &d : done)
+          n_byte += d.len;
+        t_checked = tsc_read();
+        {
+          lock_guard<mutex> lk(lock);
+          freed = completed;
+        }
+        slot_freed.notify_one();
+      } else if (tsc_read() - t_checked > check_tsc) {
+        t_checked = tsc_read();
+        this->h2c.check_status();
+      }
+    }
+  } catch (...) {
+    {
+      lock_guard<mutex> lk(lock);
+      stop = true;
+    }
+    slot_freed.notify_one();
+    gen.join();
+    throw;
+  }
+  gen.join();
+  if (gen_error)
+    rethrow_exception(gen_error);
+  return n_byte;
+}
+
+} // namespace XDMA_udrv
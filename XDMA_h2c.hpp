@@ -0,0 +1,55 @@
+#ifndef _XDMA_H2C_HPP_
+#define _XDMA_H2C_HPP_
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "XDMA_udrv.hpp"
+
+namespace XDMA_udrv {
+
+/*
+Continuous H2C out of a 1 GiB page cut into slots. A producer thread fills
+slot k + 1 and onwards while the engine is still sending slot k, slots go
+out through an XScheduler in descriptor credit mode so the engine never
+stops in between. Every slot is one request, stream engines see it as one
+packet.
+*/
+class XH2CStream {
+public:
+  // Put message k into slot, return its length (up to the slot size, 0
+  // ends the stream)
+  using fill_fn = std::function<uint32_t(uint64_t k, void *slot)>;
+  // TSC to hold message k back until, 0 to send right away
+  using pace_fn = std::function<uint64_t(uint64_t k, uint32_t len)>;
+
+  XH2CStream(XDMAEngine &h2c, uint32_t slot_size = 64 << 20);
+
+  // Send until fill returns 0, returns the bytes sent. MM engines get slot
+  // s at card_addr + s * slot_size.
+  uint64_t run(const fill_fn &fill, const pace_fn &pace = nullptr,
+               uint64_t card_addr = 0);
+
+  uint32_t getNrSlots() { return this->n_slots; }
+  uint32_t getSlotSize() { return this->slot_size; }
+  // Time spent in fill, summed over slots
+  double getFillNs() { return this->fill_ns; }
+  // Engine idle waiting for the producer, producer waiting for a slot
+  double getGenWaitNs() { return this->gen_wait_ns; }
+  double getSlotWaitNs() { return this->slot_wait_ns; }
+
+private:
+  XDMAEngine &h2c;
+  uint32_t slot_size;
+  uint32_t n_slots;
+  HugePageWrapper page;
+  std::vector<uint32_t> slot_len;
+  double fill_ns;
+  double gen_wait_ns;
+  double slot_wait_ns;
+};
+
+} // namespace XDMA_udrv
+
+#endif
@@ -0,0 +1,304 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "XDMA_hugeplan.hpp"
+
+using namespace std;
+
+namespace {
+
+using namespace XDMA_udrv;
+
+const uint64_t HUGE_1GiB_LEN = 1UL << 30;
+const uint64_t HUGE_2MiB_LEN = 1UL << 21;
+// Descriptors fit in the lower 1 MiB of the descriptor page
+const uint64_t MAX_N_DESC = (1 << 20) / sizeof(xdma_desc);
+
+uint64_t page_len(HugePageSizeType type) {
+  return (type == HUGE_1GiB) ? HUGE_1GiB_LEN : HUGE_2MiB_LEN;
+}
+
+// Directory holding the counters of one pool
+string pool_dir(HugePageSizeType type, int32_t node) {
+  char path[128];
+  uint64_t kib = page_len(type) >> 10;
+  if (node < 0)
+    snprintf(path, sizeof(path), "/sys/kernel/mm/hugepages/hugepages-%lukB/",
+             kib);
+  else
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/node/node%d/hugepages/hugepages-%lukB/",
+             node, kib);
+  return path;
+}
+
+bool read_long(const string &path, long &value) {
+  char buf[32], *end;
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  ssize_t rv = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (rv <= 0)
+    return false;
+  buf[rv] = '\0';
+  value = strtol(buf, &end, 10);
+  return end != buf;
+}
+
+bool read_pool(HugePageSizeType type, int32_t node, hugepage_pool &p) {
+  string dir = pool_dir(type, node);
+  long total, free, resv = 0;
+  if (!read_long(dir + "nr_hugepages", total) ||
+      !read_long(dir + "free_hugepages", free))
+    return false;
+  if (node < 0)
+    read_long(dir + "resv_hugepages", resv);
+  p.type = type;
+  p.page_len = page_len(type);
+  p.node = node;
+  p.total = total;
+  p.avail = (free > resv) ? free - resv : 0;
+  return true;
+}
+
+string size_str(uint64_t bytes) {
+  char buf[32];
+  if (bytes && bytes % HUGE_1GiB_LEN == 0)
+    snprintf(buf, sizeof(buf), "%lu GiB", bytes >> 30);
+  else if (bytes && bytes % (1UL << 20) == 0)
+    snprintf(buf, sizeof(buf), "%lu MiB", bytes >> 20);
+  else if (bytes && bytes % (1UL << 10) == 0)
+    snprintf(buf, sizeof(buf), "%lu KiB", bytes >> 10);
+  else
+    snprintf(buf, sizeof(buf), "%lu B", bytes);
+  return buf;
+}
+
+// Largest buffer of type pages that the available counts back, next to the
+// 2 MiB descriptor page
+uint64_t capacity(HugePageSizeType type, uint64_t avail_1g, uint64_t avail_2m) {
+  if (avail_2m == 0)
+    return 0;
+  uint64_t n = (type == HUGE_1GiB) ? avail_1g : avail_2m - 1;
+  uint64_t cap = n * page_len(type);
+  if (cap > XSGB_MAX_SIZE)
+    cap = XSGB_MAX_SIZE / page_len(type) * page_len(type);
+  return cap;
+}
+
+// Set a pool's nr_hugepages, returns what the kernel made of it
+long write_nr(const string &path, long value) {
+  int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw system_error(error_code(errno, generic_category()), path);
+  string s = to_string(value);
+  // The kernel allocates what it can and keeps quiet about the rest
+  ssize_t rv = write(fd, s.c_str(), s.size());
+  int err = errno;
+  close(fd);
+  if (rv < 0)
+    throw system_error(error_code(err, generic_category()), path);
+  if (!read_long(path, value))
+    throw system_error(error_code(ENOENT, generic_category()), path);
+  return value;
+}
+
+uint32_t clamp_chunk(uint32_t chunk_size, HugePageSizeType type) {
+  return (chunk_size > page_len(type)) ? page_len(type) : chunk_size;
+}
+
+// chunk_size, doubled until MAX_N_DESC descriptors cover size or a chunk
+// would outgrow a page or a descriptor
+uint32_t fit_chunk(uint32_t chunk_size, HugePageSizeType type, uint64_t size) {
+  uint64_t chunk = clamp_chunk(chunk_size, type);
+  uint64_t max = min<uint64_t>(MEM_CHUNK_SIZE, page_len(type));
+  while (chunk && size > MAX_N_DESC * chunk && chunk * 2 <= max)
+    chunk *= 2;
+  return chunk;
+}
+
+} // namespace
+
+namespace XDMA_udrv {
+
+vector<hugepage_pool> hugepage_pools(int32_t node) {
+  vector<hugepage_pool> pools;
+  hugepage_pool p;
+  for (auto type : {HUGE_1GiB, HUGE_2MiB}) {
+    if (read_pool(type, node, p)) {
+      // Pages promised to mappings can come from any node
+      hugepage_pool sys;
+      if (node >= 0 && read_pool(type, -1, sys) && sys.avail < p.avail)
+        p.avail = sys.avail;
+      pools.push_back(p);
+    } else if (node >= 0 && read_pool(type, -1, p)) {
+      pools.push_back(p);
+    }
+  }
+  return pools;
+}
+
+int32_t uio_numa_node(int32_t uio_index) {
+  char path[64];
+  long node;
+  snprintf(path, sizeof(path), "/sys/class/uio/uio%d/device/numa_node",
+           uio_index);
+  if (uio_index < 0 || !read_long(path, node))
+    return -1;
+  return (node < 0) ? -1 : node;
+}
+
+uint64_t hugepage_reserve(HugePageSizeType type, uint64_t n, int32_t node) {
+  string path = pool_dir(type, node) + "nr_hugepages";
+  long before;
+  if (!read_long(path, before))
+    throw system_error(error_code(ENOENT, generic_category()), path);
+  long after = write_nr(path, before + n);
+  return (after > before) ? after - before : 0;
+}
+
+hugepage_plan plan_hugepages(const hugeplan_opt &opt) {
+  hugepage_plan plan;
+  uint64_t want = opt.size;
+  uint64_t min_size = opt.min_size ? opt.min_size : want;
+  char line[256];
+
+  if (want > XSGB_MAX_SIZE || min_size > XSGB_MAX_SIZE)
+    throw std::range_error("Can't plan more than 3 GiB (soft constraint)");
+  if (min_size > want && want)
+    throw std::range_error("Minimum size above the wanted size");
+  if (opt.chunk_size < XDMA_MIN_CHUNK_SIZE)
+    throw std::range_error("Invalid chunk size");
+  plan.node = opt.node;
+  plan.reserved = 0;
+
+  uint64_t avail[2];
+  auto survey = [&]() {
+    avail[HUGE_1GiB] = avail[HUGE_2MiB] = 0;
+    for (auto &p : hugepage_pools(opt.node)) {
+      avail[p.type] = p.avail;
+      plan.node = p.node;
+      string where = (p.node < 0) ? "system" : "node " + to_string(p.node);
+      snprintf(line, sizeof(line), "%s %s pages: %lu of %lu available\n",
+               where.c_str(), size_str(p.page_len).c_str(), p.avail, p.total);
+      plan.report += line;
+    }
+  };
+  // Best layout for the current counts, false if none reaches min_size
+  auto choose = [&]() {
+    uint64_t cap[2];
+    uint32_t chunk[2];
+    for (auto type : {HUGE_1GiB, HUGE_2MiB}) {
+      cap[type] = capacity(type, avail[HUGE_1GiB], avail[HUGE_2MiB]);
+      // Small chunks run out of descriptors before pages, take larger ones
+      chunk[type] = fit_chunk(opt.chunk_size, type,
+                              (want && want < cap[type]) ? want : cap[type]);
+      uint64_t desc_cap =
+          MAX_N_DESC * chunk[type] / page_len(type) * page_len(type);
+      if (cap[type] > desc_cap)
+        cap[type] = desc_cap;
+    }
+    HugePageSizeType type;
+    if (want && cap[HUGE_1GiB] >= want)
+      type = HUGE_1GiB;
+    else if (want && cap[HUGE_2MiB] >= want)
+      type = HUGE_2MiB;
+    else
+      type = (cap[HUGE_1GiB] >= cap[HUGE_2MiB]) ? HUGE_1GiB : HUGE_2MiB;
+    uint64_t size = (want && cap[type] >= want) ? want : cap[type];
+    if (size == 0 || size < min_size) {
+      snprintf(line, sizeof(line),
+               "1 GiB pages back at most %s, 2 MiB pages %s\n",
+               size_str(cap[HUGE_1GiB]).c_str(),
+               size_str(cap[HUGE_2MiB]).c_str());
+      plan.report += line;
+      return false;
+    }
+    plan.page_type = type;
+    plan.size = size;
+    plan.chunk_size = chunk[type];
+    if (chunk[type] != clamp_chunk(opt.chunk_size, type)) {
+      snprintf(line, sizeof(line),
+               "chunk size raised from %s, %lu descriptors cover at most "
+               "%s\n",
+               size_str(clamp_chunk(opt.chunk_size, type)).c_str(),
+               MAX_N_DESC,
+               size_str(MAX_N_DESC * clamp_chunk(opt.chunk_size, type))
+                   .c_str());
+      plan.report += line;
+    }
+    plan.n_pages = (size + page_len(type) - 1) / page_len(type);
+    return true;
+  };
+
+  survey();
+  bool ok = choose();
+  if (!ok && opt.reserve && want) {
+    auto reserve = [&](HugePageSizeType type, uint64_t n) {
+      uint64_t got = hugepage_reserve(type, n, plan.node);
+      snprintf(line, sizeof(line), "reserved %lu of %lu %s page(s)\n", got,
+               n, size_str(page_len(type)).c_str());
+      plan.report += line;
+      plan.reserved += got;
+      return got;
+    };
+    // 1 GiB pages first, the kernel rarely finds many once memory is
+    // fragmented; 2 MiB pages for the rest
+    try {
+      for (auto type : {HUGE_1GiB, HUGE_2MiB}) {
+        // The descriptor page comes out of the 2 MiB pool either way
+        uint64_t need = (want + page_len(type) - 1) / page_len(type);
+        if (type == HUGE_2MiB)
+          need++;
+        else if (avail[HUGE_2MiB] == 0)
+          reserve(HUGE_2MiB, 1);
+        uint64_t got = 0;
+        if (need > avail[type])
+          got = reserve(type, need - avail[type]);
+        survey();
+        if ((ok = choose()))
+          break;
+        // Too few to matter, hand them back before trying 2 MiB pages
+        if (got) {
+          string path = pool_dir(type, plan.node) + "nr_hugepages";
+          long total;
+          if (read_long(path, total))
+            write_nr(path, total - got);
+          plan.reserved -= got;
+          snprintf(line, sizeof(line), "returned %lu %s page(s)\n", got,
+                   size_str(page_len(type)).c_str());
+          plan.report += line;
+        }
+      }
+    } catch (const system_error &e) {
+      plan.report += string("reserve: ") + e.what() + "\n";
+    }
+  }
+  if (!ok) {
+    snprintf(line, sizeof(line),
+             "need %s, raise %snr_hugepages or let the job reserve",
+             min_size ? size_str(min_size).c_str() : "a data page",
+             pool_dir(HUGE_1GiB, plan.node).c_str());
+    plan.report += line;
+    throw system_error(error_code(ENOMEM, generic_category()), plan.report);
+  }
+  snprintf(line, sizeof(line), "plan: %s in %u x %s page(s), %s chunks\n",
+           size_str(plan.size).c_str(), plan.n_pages,
+           size_str(page_len(plan.page_type)).c_str(),
+           size_str(plan.chunk_size).c_str());
+  plan.report += line;
+  return plan;
+}
+
+} // namespace XDMA_udrv
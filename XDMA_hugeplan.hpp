@@ -0,0 +1,73 @@
+#ifndef _XDMA_HUGEPLAN_HPP_
+#define _XDMA_HUGEPLAN_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "XDMA_udrv.hpp"
+
+namespace XDMA_udrv {
+
+// Hugepages of one size, on one NUMA node or system wide (node -1)
+struct hugepage_pool {
+  HugePageSizeType type;
+  uint64_t page_len;
+  int32_t node;
+  // nr_hugepages
+  uint64_t total;
+  // free_hugepages less the ones promised to existing mappings
+  uint64_t avail;
+};
+
+// Both page sizes of node, system wide for -1 or when the kernel has no
+// per-node pools. Sizes the kernel doesn't support are left out.
+std::vector<hugepage_pool> hugepage_pools(int32_t node = -1);
+// NUMA node of the device behind /dev/uioN, -1 if unknown or not NUMA
+int32_t uio_numa_node(int32_t uio_index);
+// Grow the pool of type on node (-1: system wide) by n pages, needs root.
+// Returns the # of pages the kernel actually added, throws if it can't be
+// asked.
+uint64_t hugepage_reserve(HugePageSizeType type, uint64_t n, int32_t node);
+
+struct hugeplan_opt {
+  // Bytes wanted, 0 for the largest buffer the pools can back
+  uint64_t size = 0;
+  // Settle for less than size down to this, 0 means size itself
+  uint64_t min_size = 0;
+  // Preferred bytes per descriptor, clamped to the data page size and
+  // raised when the descriptors wouldn't cover the buffer otherwise
+  uint32_t chunk_size = MEM_CHUNK_SIZE;
+  // Node to take pages from, -1 for any
+  int32_t node = -1;
+  // Grow the pools for an explicit size that doesn't fit
+  bool reserve = false;
+};
+
+// Buffer layout for an XSGBuffer: data pages plus its 2 MiB descriptor page
+struct hugepage_plan {
+  HugePageSizeType page_type;
+  uint32_t n_pages;
+  uint32_t chunk_size;
+  // Bytes the data pages hold, at most XSGB_MAX_SIZE
+  uint64_t size;
+  int32_t node;
+  // Pages hugepage_reserve() added for this plan
+  uint64_t reserved;
+  // Pools seen and the decision taken, one line each
+  std::string report;
+};
+
+/*
+Decide from the sysfs hugepage counters, before anything is mapped, which
+page size backs a capture buffer: 1 GiB pages when enough are free, 2 MiB
+pages otherwise (chunk size capped at 2 MiB). With opt.reserve missing pages
+are requested from the kernel first. Throws ENOMEM with the report as
+message when no layout reaches the minimum size, so a job fails before it
+maps anything rather than in the middle of building its buffer.
+*/
+hugepage_plan plan_hugepages(const hugeplan_opt &opt);
+
+} // namespace XDMA_udrv
+
+#endif
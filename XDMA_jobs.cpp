@@ -0,0 +1,80 @@
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include "XDMA_jobs.hpp"
+
+using namespace std;
+
+namespace XDMA_udrv {
+
+XJobPool::XJobPool(unsigned n_threads)
+    : n_threads(n_threads), busy(0), stopping(false) {
+  if (n_threads == 0) {
+    throw std::range_error("Invalid # of worker threads");
+  }
+  for (unsigned i = 0; i < n_threads; i++)
+    this->threads.emplace_back([this, i]() { this->worker(i); });
+}
+
+XJobPool::~XJobPool() { this->stop(); }
+
+void XJobPool::stop() {
+  {
+    lock_guard<mutex> lk(this->lock);
+    this->stopping = true;
+  }
+  this->wake.notify_all();
+  for (auto &th : this->threads)
+    th.join();
+  this->threads.clear();
+}
+
+void XJobPool::worker(unsigned idx) {
+  unique_lock<mutex> lk(this->lock);
+  while (1) {
+    this->wake.wait(lk,
+                    [this]() { return this->stopping || !this->jobs.empty(); });
+    if (this->jobs.empty())
+      break;
+    job_fn job = move(this->jobs.front());
+    this->jobs.pop_front();
+    this->busy++;
+    lk.unlock();
+
+    exception_ptr err;
+    try {
+      job(idx);
+    } catch (...) {
+      err = current_exception();
+    }
+
+    lk.lock();
+    if (err && !this->error)
+      this->error = err;
+    this->busy--;
+    if (this->jobs.empty() && !this->busy)
+      this->drained.notify_all();
+  }
+}
+
+void XJobPool::submit(job_fn job) {
+  {
+    lock_guard<mutex> lk(this->lock);
+    this->jobs.push_back(move(job));
+  }
+  this->wake.notify_one();
+}
+
+void XJobPool::wait() {
+  unique_lock<mutex> lk(this->lock);
+  this->drained.wait(lk,
+                     [this]() { return this->jobs.empty() && !this->busy; });
+  if (this->error)
+    rethrow_exception(exchange(this->error, nullptr));
+}
+
+} // namespace XDMA_udrv
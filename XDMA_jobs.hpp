@@ -0,0 +1,51 @@
+#ifndef _XDMA_JOBS_HPP_
+#define _XDMA_JOBS_HPP_
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace XDMA_udrv {
+
+/*
+Worker threads taking jobs off a FIFO, what XCrcPool and XUnpackPool run
+their chunks on. A job gets the index of the worker running it, for
+per-worker scratch. The first exception a job throws is kept and rethrown
+by wait(), the remaining jobs still run.
+*/
+class XJobPool {
+public:
+  using job_fn = std::function<void(unsigned worker)>;
+
+  XJobPool(unsigned n_threads);
+  ~XJobPool();
+
+  void submit(job_fn job);
+  // Block until every submitted job is done
+  void wait();
+  // Run what is queued and join the workers, before tearing down anything
+  // the jobs use
+  void stop();
+  unsigned getNrThreads() { return this->n_threads; }
+
+private:
+  void worker(unsigned idx);
+
+  unsigned n_threads;
+  std::vector<std::thread> threads;
+  std::mutex lock;
+  std::condition_variable wake;
+  std::condition_variable drained;
+  std::deque<job_fn> jobs;
+  unsigned busy;
+  bool stopping;
+  std::exception_ptr error;
+};
+
+} // namespace XDMA_udrv
+
+#endif
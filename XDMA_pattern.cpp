@@ -0,0 +1,304 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <immintrin.h>
+
+#include "XDMA_pattern.hpp"
+#include "XDMA_trace.hpp"
+
+using namespace std;
+
+namespace {
+
+typedef unsigned __int128 u128;
+
+const u128 ALL_ONES = ~(u128)0;
+
+// M v over GF(2), M as 128 columns
+u128 gf2_apply(const u128 *m, u128 v) {
+  u128 r = 0;
+  for (int j = 0; v; j++, v >>= 1)
+    if (v & 1)
+      r ^= m[j];
+  return r;
+}
+
+/*
+LFSR128 as the checker sees it: every 16-byte word is the next state,
+w' = (w << 1) | xnor(w[127], w[125], w[100], w[98]).
+The smallest tap distance is 99, so the 64 bits shifted in over the next
+64 states only depend on the current one:
+  n = ~((w >> 64) ^ (w >> 62) ^ (w >> 37) ^ (w >> 35))
+and state s in [0, 64) of the block is the funnel shift (w:n) << s.
+*/
+inline uint64_t lfsr_next64(uint64_t lo, uint64_t hi) {
+  u128 w = ((u128)hi << 64) | lo;
+  return ~(uint64_t)((w >> 64) ^ (w >> 62) ^ (w >> 37) ^ (w >> 35));
+}
+
+void lfsr_gen_scalar(u128 w, uint8_t *dst, size_t n_words) {
+  uint64_t lo = w, hi = w >> 64;
+  while (n_words) {
+    uint64_t n = lfsr_next64(lo, hi);
+    for (unsigned s = 0; s < 64 && n_words; s++, n_words--, dst += 16) {
+      uint64_t v[2];
+      v[0] = s ? (lo << s) | (n >> (64 - s)) : lo;
+      v[1] = s ? (hi << s) | (lo >> (64 - s)) : hi;
+      memcpy(dst, v, 16);
+    }
+    hi = lo;
+    lo = n;
+  }
+}
+
+// Two states per 256-bit store, variable shifts by 64 give 0 on AVX2
+__attribute__((target("avx2"))) void lfsr_gen_avx2(u128 w, uint8_t *dst,
+                                                   size_t n_words) {
+  uint64_t lo = w, hi = w >> 64;
+  const __m256i c64 = _mm256_set1_epi64x(64);
+  const __m256i c2 = _mm256_set1_epi64x(2);
+  for (; n_words >= 64; n_words -= 64) {
+    uint64_t n = lfsr_next64(lo, hi);
+    __m256i a = _mm256_setr_epi64x(lo, hi, lo, hi);
+    __m256i b = _mm256_setr_epi64x(n, lo, n, lo);
+    __m256i l = _mm256_setr_epi64x(0, 0, 1, 1);
+    for (unsigned s = 0; s < 64; s += 2, dst += 32) {
+      __m256i r = _mm256_sub_epi64(c64, l);
+      _mm256_storeu_si256(
+          (__m256i *)dst,
+          _mm256_or_si256(_mm256_sllv_epi64(a, l), _mm256_srlv_epi64(b, r)));
+      l = _mm256_add_epi64(l, c2);
+    }
+    hi = lo;
+    lo = n;
+  }
+  lfsr_gen_scalar(((u128)hi << 64) | lo, dst, n_words);
+}
+
+void counter_gen_scalar(uint64_t start, uint8_t *dst, size_t n_qwords) {
+  for (size_t i = 0; i < n_qwords; i++, dst += 8) {
+    uint64_t v = start + i;
+    memcpy(dst, &v, 8);
+  }
+}
+
+__attribute__((target("avx2"))) void
+counter_gen_avx2(uint64_t start, uint8_t *dst, size_t n_qwords) {
+  __m256i v = _mm256_add_epi64(_mm256_set1_epi64x(start),
+                               _mm256_setr_epi64x(0, 1, 2, 3));
+  const __m256i c4 = _mm256_set1_epi64x(4);
+  size_t i = 0;
+  for (; i + 4 <= n_qwords; i += 4, dst += 32) {
+    _mm256_storeu_si256((__m256i *)dst, v);
+    v = _mm256_add_epi64(v, c4);
+  }
+  counter_gen_scalar(start + i, dst, n_qwords - i);
+}
+
+/*
+PRBS31 bit stream b[n] = b[n - 31] ^ b[n - 28]. Squaring the polynomial
+twice gives b[n] = b[n - 124] ^ b[n - 112], so each 64-bit word follows
+from the two before it; four times gives b[n] = b[n - 496] ^ b[n - 448],
+four words at once from the eight before them.
+state: the 31 bits starting at the first one to generate.
+*/
+void prbs_head(uint32_t state, uint64_t *w, unsigned n_words) {
+  for (unsigned i = 0; i < n_words; i++) {
+    uint64_t v = 0;
+    for (unsigned j = 0; j < 64; j++) {
+      v |= (uint64_t)(state & 1) << j;
+      uint32_t fb = (state ^ (state >> 3)) & 1;
+      state = (state >> 1) | (fb << 30);
+    }
+    w[i] = v;
+  }
+}
+
+void prbs_gen_scalar(uint32_t state, uint8_t *dst, size_t n_qwords) {
+  uint64_t w[2];
+  prbs_head(state, w, 2);
+  for (size_t i = 0; i < n_qwords; i++, dst += 8) {
+    uint64_t v = w[i & 1];
+    memcpy(dst, &v, 8);
+    w[i & 1] = ((w[i & 1] >> 4) | (w[(i + 1) & 1] << 60)) ^
+               ((w[i & 1] >> 16) | (w[(i + 1) & 1] << 48));
+  }
+}
+
+__attribute__((target("avx2"))) void
+prbs_gen_avx2(uint32_t state, uint8_t *dst, size_t n_qwords) {
+  if (n_qwords < 16) {
+    prbs_gen_scalar(state, dst, n_qwords);
+    return;
+  }
+  prbs_gen_scalar(state, dst, 8);
+  size_t i = 8;
+  for (; i + 4 <= n_qwords; i += 4) {
+    __m256i w7 = _mm256_loadu_si256((const __m256i *)(dst + (i - 7) * 8));
+    __m256i w8 = _mm256_loadu_si256((const __m256i *)(dst + (i - 8) * 8));
+    __m256i v = _mm256_xor_si256(
+        _mm256_xor_si256(w7, _mm256_slli_epi64(w7, 48)),
+        _mm256_srli_epi64(w8, 16));
+    _mm256_storeu_si256((__m256i *)(dst + i * 8), v);
+  }
+  for (; i < n_qwords; i++) {
+    uint64_t w7, w8, v;
+    memcpy(&w7, dst + (i - 7) * 8, 8);
+    memcpy(&w8, dst + (i - 8) * 8, 8);
+    v = w7 ^ (w7 << 48) ^ (w8 >> 16);
+    memcpy(dst + i * 8, &v, 8);
+  }
+}
+
+struct gen_fns {
+  void (*lfsr)(u128, uint8_t *, size_t);
+  void (*counter)(uint64_t, uint8_t *, size_t);
+  void (*prbs)(uint32_t, uint8_t *, size_t);
+};
+
+gen_fns select_gen_fns() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return {lfsr_gen_avx2, counter_gen_avx2, prbs_gen_avx2};
+  return {lfsr_gen_scalar, counter_gen_scalar, prbs_gen_scalar};
+}
+
+const gen_fns &gen() {
+  static const gen_fns fns = select_gen_fns();
+  return fns;
+}
+
+
+} // namespace
+
+namespace XDMA_udrv {
+
+XPattern::XPattern(XDMA_PATTERN type, uint64_t seed_lo, uint64_t seed_hi)
+    : type(type) {
+  u128 step[128] = {};
+
+  this->seed = ((u128)seed_hi << 64) | seed_lo;
+  switch (type) {
+  case PAT_LFSR128:
+    // All ones is the XNOR LFSR's lock-up state
+    if (this->seed == ALL_ONES) {
+      throw std::range_error("LFSR128 seed must not be all ones");
+    }
+    // Complemented, the XNOR LFSR is the linear XOR one
+    for (int j = 0; j < 128; j++) {
+      step[j] = (j < 127) ? (u128)1 << (j + 1) : 0;
+      if (j == 127 || j == 125 || j == 100 || j == 98)
+        step[j] |= 1;
+    }
+    break;
+  case PAT_PRBS31:
+    this->seed &= 0x7FFFFFFF;
+    if (!this->seed) {
+      throw std::range_error("PRBS31 seed must not be zero");
+    }
+    // Bit i is b[n + i], b[n + 31] = b[n] ^ b[n + 3]
+    for (int j = 1; j < 31; j++)
+      step[j] = (u128)1 << (j - 1);
+    step[0] = (u128)1 << 30;
+    step[3] |= (u128)1 << 30;
+    break;
+  case PAT_COUNTER:
+    return;
+  default:
+    throw std::range_error("Unknown pattern");
+  }
+
+  this->jump.resize(64 * 128);
+  memcpy(this->jump.data(), step, sizeof(step));
+  for (int k = 1; k < 64; k++) {
+    const u128 *prev = &this->jump[(k - 1) * 128];
+    for (int j = 0; j < 128; j++)
+      this->jump[k * 128 + j] = gf2_apply(prev, prev[j]);
+  }
+}
+
+XPattern::u128 XPattern::jump_ahead(u128 state, uint64_t n) const {
+  for (int k = 0; n; k++, n >>= 1)
+    if (n & 1)
+      state = gf2_apply(&this->jump[k * 128], state);
+  return state;
+}
+
+void XPattern::fill(void *dst, uint64_t offset, size_t len) const {
+  if (offset % 16 || len % 16) {
+    throw std::range_error("Pattern offset and length must be 16 aligned");
+  }
+  uint8_t *p = (uint8_t *)dst;
+  switch (this->type) {
+  case PAT_LFSR128:
+    gen().lfsr(~this->jump_ahead(~this->seed, offset / 16), p, len / 16);
+    break;
+  case PAT_COUNTER:
+    gen().counter((uint64_t)this->seed + offset / 8, p, len / 8);
+    break;
+  case PAT_PRBS31:
+    gen().prbs(this->jump_ahead(this->seed, offset * 8), p, len / 8);
+    break;
+  }
+}
+
+size_t XPattern::check(const void *src, uint64_t offset, size_t len) const {
+  const size_t block = 64 << 10;
+  vector<uint8_t> ref(block);
+  const uint8_t *p = (const uint8_t *)src;
+
+  for (size_t done = 0; done < len; done += block) {
+    size_t n = min(block, len - done);
+    this->fill(ref.data(), offset + done, n);
+    if (!memcmp(ref.data(), p + done, n))
+      continue;
+    for (size_t i = 0; i < n; i++)
+      if (ref[i] != p[done + i])
+        return done + i;
+  }
+  return len;
+}
+
+void pattern_fill_mt(const XPattern &pattern, void *dst, uint64_t offset,
+                     size_t len, unsigned n_threads) {
+  XDMA_TRACE_SCOPE("pattern_fill");
+  size_t part = (len / (n_threads ? n_threads : 1) + 4095) & ~4095UL;
+  if (n_threads <= 1 || part >= len) {
+    pattern.fill(dst, offset, len);
+    return;
+  }
+  vector<thread> threads;
+  for (size_t start = part; start < len; start += part) {
+    size_t n = min(part, len - start);
+    threads.emplace_back([&pattern, dst, offset, start, n]() {
+      pattern.fill((uint8_t *)dst + start, offset + start, n);
+    });
+  }
+  pattern.fill(dst, offset, part);
+  for (auto &th : threads)
+    th.join();
+}
+
+XPatternStream::XPatternStream(XDMAEngine &h2c, const XPattern &pattern,
+                               uint32_t slot_size, unsigned n_threads)
+    : pattern(pattern), n_threads(n_threads), stream(h2c, slot_size) {}
+
+void XPatternStream::run(uint64_t len, uint64_t card_addr) {
+  uint64_t slot_size = this->stream.getSlotSize();
+  this->stream.run(
+      [&](uint64_t k, void *slot) -> uint32_t {
+        uint64_t off = k * slot_size;
+        if (off >= len)
+          return 0;
+        uint32_t n = min(slot_size, len - off);
+        pattern_fill_mt(this->pattern, slot, off, n, this->n_threads);
+        return n;
+      },
+      nullptr, card_addr);
+}
+
+} // namespace XDMA_udrv
@@ -0,0 +1,78 @@
+#ifndef _XDMA_PATTERN_HPP_
+#define _XDMA_PATTERN_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "XDMA_h2c.hpp"
+#include "XDMA_udrv.hpp"
+
+namespace XDMA_udrv {
+
+enum XDMA_PATTERN : int {
+  // 128-bit XNOR LFSR (taps 127, 125, 100, 98), one state per 16 bytes,
+  // the sequence lfsr128() in pcicat and st_huge_pg checks
+  PAT_LFSR128 = 0,
+  // 64-bit little endian counter per 8 bytes
+  PAT_COUNTER,
+  // PRBS31 (x^31 + x^28 + 1) bit stream, LSB first
+  PAT_PRBS31,
+};
+
+/*
+Deterministic test pattern, addressed by byte offset into the stream.
+Any offset can be generated directly: the LFSRs jump ahead with
+precomputed powers of their transition matrix over GF(2), so threads and
+pages fill their part without generating what comes before it. Bulk fills
+use AVX2 when the CPU has it.
+*/
+class XPattern {
+public:
+  // seed_lo/hi: LFSR128 state of the first word (not all ones), counter
+  // start, or PRBS31 state (low 31 bits, not zero)
+  XPattern(XDMA_PATTERN type, uint64_t seed_lo = 1, uint64_t seed_hi = 0);
+
+  // Pattern bytes [offset, offset + len) to dst, both multiples of 16
+  void fill(void *dst, uint64_t offset, size_t len) const;
+  // First byte of src that differs from the pattern at offset, len if none
+  size_t check(const void *src, uint64_t offset, size_t len) const;
+  XDMA_PATTERN getType() const { return this->type; }
+
+private:
+  typedef unsigned __int128 u128;
+  u128 jump_ahead(u128 state, uint64_t n) const;
+
+  XDMA_PATTERN type;
+  u128 seed;
+  // jump[k * 128 + j]: column j of the transition matrix to the 2^k
+  std::vector<u128> jump;
+};
+
+// fill() split over n_threads, each one on its own 4 KiB aligned range
+void pattern_fill_mt(const XPattern &pattern, void *dst, uint64_t offset,
+                     size_t len, unsigned n_threads);
+
+// A pattern over an H2C engine, generated while it is being sent
+class XPatternStream {
+public:
+  XPatternStream(XDMAEngine &h2c, const XPattern &pattern,
+                 uint32_t slot_size = 64 << 20, unsigned n_threads = 2);
+
+  // Send pattern bytes [0, len), len a multiple of 16
+  void run(uint64_t len, uint64_t card_addr = 0);
+
+  uint32_t getNrSlots() { return this->stream.getNrSlots(); }
+  double getFillNs() { return this->stream.getFillNs(); }
+  double getGenWaitNs() { return this->stream.getGenWaitNs(); }
+  double getSlotWaitNs() { return this->stream.getSlotWaitNs(); }
+
+private:
+  const XPattern &pattern;
+  unsigned n_threads;
+  XH2CStream stream;
+};
+
+} // namespace XDMA_udrv
+
+#endif
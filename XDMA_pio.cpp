@@ -0,0 +1,85 @@
+#include <cstddef>
+#include <cstdint>
+
+#include <immintrin.h>
+
+#include "XDMA_pio.hpp"
+
+namespace {
+
+// Unaligned head/tail, 4 bytes per movnti
+inline void stream_dwords(uint8_t *&dst, const uint8_t *&src, size_t n) {
+  for (; n; n--, dst += 4, src += 4) {
+    _mm_stream_si32((int *)dst, *(const int *)src);
+  }
+}
+
+__attribute__((target("avx512f"))) void
+stream_avx512(uint8_t *dst, const uint8_t *src, size_t len) {
+  size_t head = ((64 - ((uintptr_t)dst & 63)) & 63);
+  head = (head > len) ? len : head;
+  stream_dwords(dst, src, head / 4);
+  len -= head;
+  for (; len >= 64; len -= 64, dst += 64, src += 64) {
+    _mm512_stream_si512((__m512i *)dst,
+                        _mm512_loadu_si512((const __m512i *)src));
+  }
+  stream_dwords(dst, src, len / 4);
+}
+
+__attribute__((target("avx2"))) void
+stream_avx2(uint8_t *dst, const uint8_t *src, size_t len) {
+  size_t head = ((32 - ((uintptr_t)dst & 31)) & 31);
+  head = (head > len) ? len : head;
+  stream_dwords(dst, src, head / 4);
+  len -= head;
+  for (; len >= 32; len -= 32, dst += 32, src += 32) {
+    _mm256_stream_si256((__m256i *)dst,
+                        _mm256_loadu_si256((const __m256i *)src));
+  }
+  stream_dwords(dst, src, len / 4);
+}
+
+void stream_sse2(uint8_t *dst, const uint8_t *src, size_t len) {
+  size_t head = ((16 - ((uintptr_t)dst & 15)) & 15);
+  head = (head > len) ? len : head;
+  stream_dwords(dst, src, head / 4);
+  len -= head;
+  for (; len >= 16; len -= 16, dst += 16, src += 16) {
+    _mm_stream_si128((__m128i *)dst, _mm_loadu_si128((const __m128i *)src));
+  }
+  stream_dwords(dst, src, len / 4);
+}
+
+using stream_fn = void (*)(uint8_t *, const uint8_t *, size_t);
+
+stream_fn select_stream_fn() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return stream_avx512;
+  if (__builtin_cpu_supports("avx2"))
+    return stream_avx2;
+  return stream_sse2;
+}
+
+const stream_fn stream_impl = select_stream_fn();
+
+} // namespace
+
+namespace XDMA_udrv {
+
+void pio_copy_uc(volatile void *dst, const void *src, size_t len) {
+  volatile uint32_t *pdst = (volatile uint32_t *)dst;
+  const uint32_t *psrc = (const uint32_t *)src;
+  for (size_t i = 0; i < len / 4; i++) {
+    pdst[i] = psrc[i];
+  }
+}
+
+void pio_copy_wc(void *dst, const void *src, size_t len) {
+  stream_impl((uint8_t *)dst, (const uint8_t *)src, len);
+}
+
+void pio_flush() { _mm_sfence(); }
+
+} // namespace XDMA_udrv
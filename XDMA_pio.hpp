@@ -0,0 +1,27 @@
+#ifndef _XDMA_PIO_HPP_
+#define _XDMA_PIO_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace XDMA_udrv {
+
+/*
+Programmed I/O copy routines for user BARs.
+dst and len must be 4-byte aligned, AXI-Lite slaves generally can't take
+narrower writes anyway. Neither routine checks: a misaligned dst faults in
+the streaming stores and the last len % 4 bytes are not written.
+*/
+
+// One 32-bit store at a time, suitable for UC mappings
+void pio_copy_uc(volatile void *dst, const void *src, size_t len);
+// Non-temporal 64/32/16-byte stores (AVX-512/AVX2/SSE2 picked at runtime)
+// into a WC mapping, dst and len 4-byte aligned. Not ordered until
+// pio_flush().
+void pio_copy_wc(void *dst, const void *src, size_t len);
+// Drain write-combining buffers (sfence)
+void pio_flush();
+
+} // namespace XDMA_udrv
+
+#endif
@@ -0,0 +1,146 @@
+#include <cstdint>
+#include <functional>
+#include <system_error>
+#include <thread>
+
+#include <cpuid.h>
+#include <immintrin.h>
+#include <pthread.h>
+#include <sched.h>
+#include <x86intrin.h>
+
+#include "XDMA_poll.hpp"
+#include "XDMA_timing.hpp"
+
+using namespace std;
+
+namespace {
+
+// umwait is capped by IA32_UMWAIT_CONTROL (100 us by default), the caller
+// loops anyway
+__attribute__((target("waitpkg"))) void umwait_until(volatile void *addr,
+                                                     uint64_t deadline) {
+  _umonitor((void *)addr);
+  // 0: C0.2, deeper but still sub-microsecond wakeup
+  _umwait(0, deadline);
+}
+
+} // namespace
+
+namespace XDMA_udrv {
+
+void pin_current_thread(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  int rv = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (rv) {
+    throw system_error(error_code(rv, generic_category()),
+                       "pthread_setaffinity_np()");
+  }
+}
+
+bool cpu_has_waitpkg() {
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+    return false;
+  return ecx & (1 << 5);
+}
+
+XPoller::XPoller(const poll_config &cfg)
+    : cfg(cfg), bytes_per_ns(cfg.bytes_per_ns), busy_tsc(0), slept_tsc(0),
+      bytes(0), polls(0) {
+  this->has_waitpkg = cfg.umwait && cpu_has_waitpkg();
+  tsc_per_ns();
+}
+
+uint64_t XPoller::expected_tsc(uint64_t bytes) {
+  return bytes / this->bytes_per_ns * tsc_per_ns();
+}
+
+void XPoller::backoff(uint64_t t_start, uint64_t expected_tsc,
+                      volatile void *monitor) {
+  uint64_t now = tsc_read();
+  uint64_t target = t_start + expected_tsc * this->cfg.backoff_fraction;
+
+  this->polls++;
+  // Late phase or too close to bother, poll as fast as the target allows
+  if (now + 4096 >= target) {
+    _mm_pause();
+    return;
+  }
+  // Cover half the remaining time per step, so a mispredicted rate costs
+  // at most a few extra steps
+  uint64_t step = (target - now) / 2;
+  if (monitor && this->has_waitpkg) {
+    umwait_until(monitor, now + step);
+    this->slept_tsc += tsc_read() - now;
+  } else {
+    // ~140 cycles per pause on Skylake and later, less on older parts
+    for (uint64_t end = now + step; tsc_read() < end;)
+      _mm_pause();
+  }
+}
+
+void XPoller::account(uint64_t bytes, uint64_t t_start) {
+  uint64_t elapsed = tsc_read() - t_start;
+  double ns = elapsed / tsc_per_ns();
+  this->bytes += bytes;
+  this->busy_tsc += elapsed;
+  // EWMA of the observed rate, ignore tiny transfers dominated by latency
+  if (ns > 1000 && bytes)
+    this->bytes_per_ns = 0.75 * this->bytes_per_ns + 0.25 * (bytes / ns);
+}
+
+void XPoller::wait_writeback(volatile c2h_wb *wb, uint64_t bytes) {
+  uint64_t t_start = tsc_read();
+  uint64_t slept = this->slept_tsc;
+  uint64_t expected = this->expected_tsc(bytes);
+  while ((wb->status >> 16) != XDMA_C2H_WB_MAGIC)
+    this->backoff(t_start, expected, wb);
+  this->account(bytes, t_start);
+  this->busy_tsc -= this->slept_tsc - slept;
+}
+
+void XPoller::wait_count(XDMAEngine &engine, uint32_t target,
+                         uint64_t bytes) {
+  uint64_t t_start = tsc_read();
+  uint64_t expected = this->expected_tsc(bytes);
+  while (1) {
+    uint32_t cnt = engine.completed_count();
+    if (cnt != 0xFFFFFFFF && cnt >= target)
+      break;
+    this->backoff(t_start, expected);
+  }
+  this->account(bytes, t_start);
+}
+
+double XPoller::getCyclesPerGiB() {
+  return this->bytes ? (double)this->busy_tsc / this->bytes * (1UL << 30)
+                     : 0.0;
+}
+
+XPollThread::XPollThread(const poll_config &cfg,
+                         function<bool(XPoller &)> body)
+    : p(cfg), stopping(false) {
+  this->th = thread([this, cfg, body]() {
+    if (cfg.cpu != -1)
+      pin_current_thread(cfg.cpu);
+    while (!this->stopping.load(memory_order_relaxed) && body(this->p))
+      ;
+  });
+}
+
+XPollThread::~XPollThread() {
+  this->stop();
+  this->join();
+}
+
+void XPollThread::stop() { this->stopping.store(true); }
+
+void XPollThread::join() {
+  if (this->th.joinable())
+    this->th.join();
+}
+
+} // namespace XDMA_udrv
@@ -0,0 +1,83 @@
+#ifndef _XDMA_POLL_HPP_
+#define _XDMA_POLL_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+#include "XDMA_udrv.hpp"
+
+namespace XDMA_udrv {
+
+struct poll_config {
+  // Core to pin the polling thread to (ideally an isolcpus core), -1 leaves
+  // affinity alone
+  int cpu = -1;
+  // umonitor/umwait on writeback lines when the CPU has WAITPKG
+  bool umwait = true;
+  // Initial guess of the link rate, refined after every completion
+  double bytes_per_ns = 3.0;
+  // Back off until this fraction of the expected time, then poll tightly
+  double backoff_fraction = 0.9;
+};
+
+void pin_current_thread(int cpu);
+bool cpu_has_waitpkg();
+
+/*
+Completion waits that back off according to the time a transfer is
+expected to take (size / learned link rate).
+Writeback waits sleep in umwait on the writeback line (woken by the DMA
+write) or pause; MMIO waits can only pause between reads.
+Busy cycles (everything but umwait) are accounted per byte moved.
+*/
+class XPoller {
+public:
+  XPoller(const poll_config &cfg = poll_config());
+
+  void wait_writeback(volatile c2h_wb *wb, uint64_t bytes);
+  void wait_count(XDMAEngine &engine, uint32_t target, uint64_t bytes);
+  // For poll loops owned by the caller: wait after an unsuccessful poll
+  void backoff(uint64_t t_start, uint64_t expected_tsc,
+               volatile void *monitor = nullptr);
+  // Feed a completed transfer into the rate estimate and cycle accounting
+  void account(uint64_t bytes, uint64_t t_start);
+  uint64_t expected_tsc(uint64_t bytes);
+
+  uint64_t getBusyCycles() { return this->busy_tsc; }
+  uint64_t getSleptCycles() { return this->slept_tsc; }
+  uint64_t getBytes() { return this->bytes; }
+  uint64_t getPolls() { return this->polls; }
+  double getBytesPerNs() { return this->bytes_per_ns; }
+  // TSC cycles the polling core was busy per GiB moved
+  double getCyclesPerGiB();
+
+private:
+  poll_config cfg;
+  bool has_waitpkg;
+  double bytes_per_ns;
+  uint64_t busy_tsc;
+  uint64_t slept_tsc;
+  uint64_t bytes;
+  uint64_t polls;
+};
+
+// Thread pinned to cfg.cpu calling body until it returns false or stop()
+class XPollThread {
+public:
+  XPollThread(const poll_config &cfg, std::function<bool(XPoller &)> body);
+  ~XPollThread();
+  void stop();
+  void join();
+  XPoller &poller() { return this->p; }
+
+private:
+  XPoller p;
+  std::atomic<bool> stopping;
+  std::thread th;
+};
+
+} // namespace XDMA_udrv
+
+#endif
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <time.h>
+
+#include "XDMA_sched.hpp"
+#include "XDMA_trace.hpp"
+
+using namespace std;
+
+namespace XDMA_udrv {
+
+XScheduler::XScheduler(bool link_tail, uint32_t ring_desc, uint32_t max_batch)
+    : link_tail(link_tail), ring_desc(ring_desc), max_batch(max_batch),
+      pending_dirty(false), n_dispatched(0), n_doorbell(0), n_late(0) {
+  // Descriptors share a 2 MiB page with the C2H writeback, lower 1 MiB
+  if (ring_desc < 2 || ring_desc > (1 << 20) / sizeof(xdma_desc)) {
+    throw std::range_error("Invalid scheduler ring size");
+  }
+  if (max_batch == 0) {
+    throw std::range_error("Invalid scheduler batch size");
+  }
+}
+
+XScheduler::~XScheduler() {
+  for (auto &r : this->rings) {
+    r->engine->stop();
+    if (this->link_tail)
+      r->engine->set_credit_mode(false);
+  }
+}
+
+void XScheduler::add_engine(XDMAEngine &engine) {
+  if (engine.get_desc_mode() != DESC_HOST_MEMORY) {
+    throw std::logic_error("Scheduler needs a host-memory descriptor engine");
+  }
+  unique_ptr<chan_ring> r = make_unique<chan_ring>();
+  r->engine = &engine;
+  r->desc_wb_buf = make_unique<HugePageWrapper>(HUGE_2MiB);
+  r->tail = r->completed = r->batch_start = 0;
+  r->hw_count = 0;
+  r->inflight_bytes = 0;
+  r->accepting = false;
+  r->round_reqs = 0;
+  r->queue_head = 0;
+
+  memset(r->desc_wb_buf->getVAddr(), 0, r->desc_wb_buf->getLen());
+  xdma_desc *pdesc = (xdma_desc *)r->desc_wb_buf->getVAddr();
+  // Links are fixed, only payload fields change per request. No adjacency,
+  // the engine must not prefetch past what has been written.
+  for (uint32_t i = 0; i < this->ring_desc; i++) {
+    uint64_t next = r->desc_wb_buf->getPAddr() +
+                    ((i + 1) % this->ring_desc) * sizeof(xdma_desc);
+    pdesc[i].control = __MASK_SHIFT__(16, 16, XDMA_DESC_MAGIC);
+    pdesc[i].next_lo = next;
+    pdesc[i].next_hi = next >> 32;
+  }
+
+  if (this->link_tail) {
+    // Running from the start with zero credits, woken by add_credits()
+    engine.stop();
+    engine.set_credit_mode(true);
+    engine.start(r->desc_wb_buf->getPAddr());
+  }
+  this->rings.push_back(move(r));
+}
+
+void XScheduler::submit(const xfer_request &req) {
+  if (req.len == 0) {
+    throw std::range_error("Empty transfer request");
+  }
+  uint32_t cap = this->link_tail ? XDMA_MAX_DESC_CREDITS : this->ring_desc;
+  if (this->desc_needed(req) > min(cap, this->ring_desc)) {
+    throw std::range_error("Transfer request larger than a descriptor ring");
+  }
+  // A request no engine can take would wait in pending forever
+  bool routable = false;
+  for (auto &r : this->rings) {
+    XDMAEngine *e = r->engine;
+    if (e->get_dir() == req.dir &&
+        (req.channel == -1 || (uint32_t)req.channel == e->get_channel()))
+      routable = true;
+  }
+  if (!routable) {
+    throw std::range_error("No engine for the request's direction/channel");
+  }
+  this->pending.push_back(req);
+  this->pending_dirty = true;
+}
+
+uint32_t XScheduler::desc_needed(const xfer_request &req) {
+  return req.len / MEM_CHUNK_SIZE + ((req.len % MEM_CHUNK_SIZE) ? 1 : 0);
+}
+
+void XScheduler::append(chan_ring &r, const xfer_request &req) {
+  xdma_desc *pdesc = (xdma_desc *)r.desc_wb_buf->getVAddr();
+  uint64_t wb_base = r.desc_wb_buf->getPAddr() + r.desc_wb_buf->getLen() / 2;
+  uint32_t n = this->desc_needed(req);
+
+  for (uint32_t i = 0; i < n; i++) {
+    uint32_t slot = r.tail % this->ring_desc;
+    uint64_t off = (uint64_t)i * MEM_CHUNK_SIZE;
+    uint64_t len = min<uint64_t>(req.len - off, MEM_CHUNK_SIZE);
+    uint64_t host = req.host_paddr + off, card = req.card_addr + off;
+    uint64_t src, dst;
+
+    if (r.engine->get_dir() == DIR_H2C) {
+      src = host;
+      dst = card;
+    } else {
+      // C2H stream takes the writeback address in place of the source
+      src = r.engine->is_stream() ? wb_base + slot * sizeof(c2h_wb) : card;
+      dst = host;
+    }
+    pdesc[slot].control = __MASK_SHIFT__(16, 16, XDMA_DESC_MAGIC) |
+                          ((i == n - 1) ? XDMA_DESC_EOP : 0);
+    pdesc[slot].bytes = len;
+    pdesc[slot].src_addr_lo = src;
+    pdesc[slot].src_addr_hi = src >> 32;
+    pdesc[slot].dst_addr_lo = dst;
+    pdesc[slot].dst_addr_hi = dst >> 32;
+    r.tail++;
+  }
+  r.queue.push_back({req, r.tail - 1});
+  r.inflight_bytes += req.len;
+  r.round_reqs++;
+  this->n_dispatched++;
+}
+
+void XScheduler::ring_doorbell(chan_ring &r) {
+  uint32_t n_new = r.tail - r.batch_start;
+  if (n_new == 0)
+    return;
+  XDMA_TRACE_SCOPE("sched_doorbell");
+  if (this->link_tail) {
+    // Descriptor stores must land before the credit write
+    atomic_thread_fence(memory_order_release);
+    r.engine->add_credits(n_new);
+    r.batch_start = r.tail;
+  } else {
+    xdma_desc *pdesc = (xdma_desc *)r.desc_wb_buf->getVAddr();
+    pdesc[(r.tail - 1) % this->ring_desc].control |= XDMA_DESC_STOP;
+    atomic_thread_fence(memory_order_release);
+    r.engine->start(r.desc_wb_buf->getPAddr() +
+                    (r.batch_start % this->ring_desc) * sizeof(xdma_desc));
+    r.hw_count = 0;
+  }
+  this->n_doorbell++;
+}
+
+void XScheduler::reap(chan_ring &r, vector<xfer_done> &done) {
+  if (r.completed == r.tail)
+    return;
+  uint32_t cnt = r.engine->completed_count();
+  if (cnt == 0xFFFFFFFF)
+    return;
+  uint64_t completed_before = r.completed;
+  if (this->link_tail) {
+    r.completed += (uint32_t)(cnt - r.hw_count);
+    r.hw_count = cnt;
+  } else {
+    // Count restarts from 0 with every engine start
+    r.completed = min(r.batch_start + cnt, r.tail);
+  }
+  if (r.completed == completed_before)
+    return;
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t now_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+  uint64_t bytes = 0;
+  while (r.queue_head < r.queue.size() &&
+         r.queue[r.queue_head].last_desc < r.completed) {
+    const xfer_request &req = r.queue[r.queue_head].req;
+    bool late = req.deadline_ns && now_ns > req.deadline_ns;
+    done.push_back({req.id, req.len, late});
+    this->n_late += late ? 1 : 0;
+    bytes += req.len;
+    r.queue_head++;
+  }
+  r.inflight_bytes -= bytes;
+  if (r.queue_head == r.queue.size()) {
+    r.queue.clear();
+    r.queue_head = 0;
+  }
+
+  xdma_chan_stats *st = r.engine->stats();
+  stat_add(st->bytes, bytes);
+  stat_add(st->desc_completed, r.completed - completed_before);
+  stat_set(st->ring_occupancy, r.tail - r.completed);
+}
+
+size_t XScheduler::poll(vector<xfer_done> &done) {
+  size_t n_done = done.size();
+
+  for (auto &r : this->rings)
+    this->reap(*r, done);
+
+  if (this->pending.empty())
+    return done.size() - n_done;
+
+  if (this->pending_dirty) {
+    // Stable so equal requests keep submission order
+    stable_sort(this->pending.begin(), this->pending.end(),
+                [](const xfer_request &a, const xfer_request &b) {
+                  if (a.priority != b.priority)
+                    return a.priority > b.priority;
+                  uint64_t da = a.deadline_ns ? a.deadline_ns : UINT64_MAX;
+                  uint64_t db = b.deadline_ns ? b.deadline_ns : UINT64_MAX;
+                  return da < db;
+                });
+    this->pending_dirty = false;
+  }
+
+  // Batch mode only starts an idle channel, a fresh batch begins at the tail
+  for (auto &r : this->rings) {
+    r->round_reqs = 0;
+    r->accepting = this->link_tail || r->completed == r->tail;
+    if (!this->link_tail && r->accepting)
+      r->batch_start = r->tail;
+  }
+
+  vector<xfer_request> left;
+  for (const auto &req : this->pending) {
+    chan_ring *best = nullptr;
+    uint32_t need = this->desc_needed(req);
+    for (auto &r : this->rings) {
+      XDMAEngine *e = r->engine;
+      if (e->get_dir() != req.dir ||
+          (req.channel != -1 && (uint32_t)req.channel != e->get_channel()))
+        continue;
+      uint64_t used = r->tail - r->completed;
+      uint64_t cap = this->ring_desc;
+      if (this->link_tail)
+        cap = min<uint64_t>(cap, XDMA_MAX_DESC_CREDITS);
+      if (!r->accepting || used + need > cap ||
+          r->round_reqs >= this->max_batch)
+        continue;
+      if (!best || r->inflight_bytes < best->inflight_bytes)
+        best = r.get();
+    }
+    if (best)
+      this->append(*best, req);
+    else
+      left.push_back(req);
+  }
+  this->pending.swap(left);
+
+  // Only rings that took requests this round, restarting a batch still in
+  // flight would replay it
+  for (auto &r : this->rings) {
+    if (r->round_reqs)
+      this->ring_doorbell(*r);
+  }
+
+  return done.size() - n_done;
+}
+
+bool XScheduler::idle() {
+  if (!this->pending.empty())
+    return false;
+  for (auto &r : this->rings) {
+    if (r->completed != r->tail)
+      return false;
+  }
+  return true;
+}
+
+} // namespace XDMA_udrv
@@ -0,0 +1,105 @@
+#ifndef _XDMA_SCHED_HPP_
+#define _XDMA_SCHED_HPP_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "XDMA_udrv.hpp"
+
+namespace XDMA_udrv {
+
+struct xfer_request {
+  uint64_t id;
+  XDMA_DIR dir;
+  // -1 lets the scheduler pick the least loaded channel of that direction
+  int32_t channel;
+  uint64_t host_paddr;
+  // AXI-MM address on the card, ignored by stream engines
+  uint64_t card_addr;
+  uint64_t len;
+  // Higher goes first, deadline breaks ties (earliest first)
+  int32_t priority;
+  // CLOCK_MONOTONIC ns, 0 for none
+  uint64_t deadline_ns;
+};
+
+struct xfer_done {
+  uint64_t id;
+  uint64_t len;
+  bool late;
+};
+
+/*
+Submission queue coalescing pending requests into shared descriptor chains.
+link_tail: each channel runs one circular chain in descriptor credit mode,
+new requests are written behind the tail and made visible with a single
+credit write, the engine never stops.
+Otherwise every batch is one stop-terminated chain and one engine start,
+issued once the previous batch on that channel completed.
+Completion is taken from the completed descriptor count register.
+*/
+class XScheduler {
+public:
+  XScheduler(bool link_tail = true, uint32_t ring_desc = 4096,
+             uint32_t max_batch = 1024);
+  ~XScheduler();
+
+  // Engines must outlive the scheduler
+  void add_engine(XDMAEngine &engine);
+  // std::range_error for requests no added engine can take
+  void submit(const xfer_request &req);
+  // Dispatch pending requests and reap completions into done
+  size_t poll(std::vector<xfer_done> &done);
+  bool idle();
+
+  uint64_t getSubmitted() { return this->n_dispatched; }
+  uint64_t getDoorbells() { return this->n_doorbell; }
+  uint64_t getDeadlineMisses() { return this->n_late; }
+  // Requests per engine start/credit write
+  double getBatchingFactor() {
+    return this->n_doorbell ? (double)this->n_dispatched / this->n_doorbell
+                            : 0.0;
+  }
+
+private:
+  struct inflight {
+    xfer_request req;
+    // Free running index of the request's last descriptor
+    uint64_t last_desc;
+  };
+  struct chan_ring {
+    XDMAEngine *engine;
+    unique_ptr<HugePageWrapper> desc_wb_buf;
+    // Free running descriptor counters
+    uint64_t tail;
+    uint64_t completed;
+    uint64_t batch_start;
+    uint32_t hw_count;
+    uint64_t inflight_bytes;
+    // Dispatch round state
+    bool accepting;
+    uint32_t round_reqs;
+    std::vector<inflight> queue;
+    size_t queue_head;
+  };
+
+  uint32_t desc_needed(const xfer_request &req);
+  void append(chan_ring &r, const xfer_request &req);
+  void ring_doorbell(chan_ring &r);
+  void reap(chan_ring &r, std::vector<xfer_done> &done);
+
+  bool link_tail;
+  uint32_t ring_desc;
+  uint32_t max_batch;
+  std::vector<unique_ptr<chan_ring>> rings;
+  std::vector<xfer_request> pending;
+  bool pending_dirty;
+  uint64_t n_dispatched;
+  uint64_t n_doorbell;
+  uint64_t n_late;
+};
+
+} // namespace XDMA_udrv
+
+#endif
@@ -0,0 +1,220 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "XDMA_sink.hpp"
+#include "XDMA_trace.hpp"
+
+using namespace std;
+
+namespace XDMA_udrv {
+
+XStripedWriter::XStripedWriter(const vector<string> &dirs, const string &name)
+    : closed(false) {
+  if (dirs.empty()) {
+    throw std::range_error("No stripe target");
+  }
+  for (size_t i = 0; i < dirs.size(); i++) {
+    auto t = make_unique<target>();
+    string dir = dirs[i];
+    if (!dir.empty() && dir.back() != '/')
+      dir += '/';
+    if (i == 0)
+      this->manifest_path = dir + name + ".manifest";
+    t->path = dir + name + ".s" + to_string(i);
+    t->fd = open(t->path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                 0664);
+    if (t->fd < 0) {
+      int err = errno;
+      this->stop_writers();
+      throw system_error(error_code(err, generic_category()),
+                         "open() " + t->path);
+    }
+    t->queued = 0;
+    t->busy = t->stopping = false;
+    t->error = 0;
+    target *pt = t.get();
+    t->th = thread([this, pt]() { this->writer(*pt); });
+    this->targets.push_back(move(t));
+  }
+}
+
+XStripedWriter::~XStripedWriter() {
+  // Without close() there is no manifest, the stripes are left as they are
+  this->stop_writers();
+}
+
+void XStripedWriter::writer(target &t) {
+  unique_lock<mutex> lk(t.lock);
+  while (1) {
+    t.wake.wait(lk, [&t]() { return t.stopping || !t.jobs.empty(); });
+    if (t.jobs.empty())
+      break;
+    job j = t.jobs.front();
+    t.jobs.pop_front();
+    t.busy = true;
+    lk.unlock();
+
+    XDMA_TRACE_SCOPE("stripe_write");
+    const uint8_t *p = (const uint8_t *)j.data;
+    int err = 0;
+    while (j.len) {
+      ssize_t rv = ::write(t.fd, p, j.len);
+      if (rv < 0 && errno == EINTR)
+        continue;
+      if (rv <= 0) {
+        err = rv ? errno : EIO;
+        break;
+      }
+      p += rv;
+      j.len -= rv;
+    }
+
+    lk.lock();
+    t.busy = false;
+    if (err && !t.error)
+      t.error = err;
+    if (t.jobs.empty())
+      t.drained.notify_all();
+  }
+}
+
+void XStripedWriter::write(uint32_t segment, const void *data, uint64_t len) {
+  if (this->closed) {
+    throw std::logic_error("Striped writer closed");
+  }
+  uint32_t k = this->chunks.size() % this->targets.size();
+  target &t = *this->targets[k];
+
+  this->chunks.push_back({segment, k, t.queued, len});
+  t.queued += len;
+  {
+    lock_guard<mutex> lk(t.lock);
+    t.jobs.push_back({data, len});
+  }
+  t.wake.notify_one();
+}
+
+void XStripedWriter::flush() {
+  int err = 0;
+  string path;
+  for (auto &t : this->targets) {
+    unique_lock<mutex> lk(t->lock);
+    t->drained.wait(lk, [&t]() { return t->jobs.empty() && !t->busy; });
+    if (t->error && !err) {
+      err = t->error;
+      path = t->path;
+    }
+  }
+  if (err) {
+    throw system_error(error_code(err, generic_category()),
+                       "write() " + path);
+  }
+}
+
+void XStripedWriter::stop_writers() {
+  for (auto &t : this->targets) {
+    {
+      lock_guard<mutex> lk(t->lock);
+      t->stopping = true;
+    }
+    t->wake.notify_one();
+    if (t->th.joinable())
+      t->th.join();
+    if (t->fd >= 0) {
+      ::close(t->fd);
+      t->fd = -1;
+    }
+  }
+}
+
+/*
+Manifest, plain text:
+xdma_stripe 1
+targets <N>
+<path of stripe 0>
+...
+chunks <M>
+<segment> <target> <offset> <length>
+...
+*/
+void XStripedWriter::close() {
+  if (this->closed)
+    return;
+  this->flush();
+  this->stop_writers();
+  this->closed = true;
+
+  string tmp = this->manifest_path + ".tmp";
+  FILE *fp = fopen(tmp.c_str(), "w");
+  if (!fp) {
+    throw system_error(error_code(errno, generic_category()),
+                       "fopen() " + tmp);
+  }
+  fprintf(fp, XDMA_STRIPE_MAGIC " %d\ntargets %zu\n", XDMA_STRIPE_VERSION,
+          this->targets.size());
+  for (auto &t : this->targets)
+    fprintf(fp, "%s\n", t->path.c_str());
+  fprintf(fp, "chunks %zu\n", this->chunks.size());
+  for (auto &c : this->chunks) {
+    fprintf(fp, "%" PRIu32 " %" PRIu32 " %" PRIu64 " %" PRIu64 "\n",
+            c.segment, c.target, c.offset, c.length);
+  }
+  if (fclose(fp) != 0 || rename(tmp.c_str(), this->manifest_path.c_str())) {
+    int err = errno;
+    unlink(tmp.c_str());
+    throw system_error(error_code(err, generic_category()),
+                       "write manifest " + this->manifest_path);
+  }
+}
+
+bool stripe_manifest_load(const char *path, vector<string> &targets,
+                          vector<stripe_chunk> &chunks) {
+  FILE *fp = fopen(path, "r");
+  char line[4096];
+  int version;
+  size_t n_target, n_chunk;
+  bool ok = false;
+
+  if (!fp)
+    return false;
+  targets.clear();
+  chunks.clear();
+  if (fscanf(fp, XDMA_STRIPE_MAGIC " %d targets %zu ", &version,
+             &n_target) != 2 ||
+      version != XDMA_STRIPE_VERSION) {
+    goto out;
+  }
+  for (size_t i = 0; i < n_target; i++) {
+    if (!fgets(line, sizeof(line), fp))
+      goto out;
+    line[strcspn(line, "\n")] = '\0';
+    targets.push_back(line);
+  }
+  if (fscanf(fp, "chunks %zu", &n_chunk) != 1)
+    goto out;
+  for (size_t i = 0; i < n_chunk; i++) {
+    stripe_chunk c;
+    if (fscanf(fp, "%" SCNu32 " %" SCNu32 " %" SCNu64 " %" SCNu64, &c.segment,
+               &c.target, &c.offset, &c.length) != 4 ||
+        c.target >= n_target) {
+      goto out;
+    }
+    chunks.push_back(c);
+  }
+  ok = true;
+out:
+  fclose(fp);
+  return ok;
+}
+
+} // namespace XDMA_udrv
@@ -0,0 +1,82 @@
+#ifndef _XDMA_SINK_HPP_
+#define _XDMA_SINK_HPP_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace XDMA_udrv {
+
+#define XDMA_STRIPE_MAGIC "xdma_stripe"
+#define XDMA_STRIPE_VERSION 1
+
+// Where one chunk of a striped capture went
+struct stripe_chunk {
+  uint32_t segment;
+  uint32_t target;
+  uint64_t offset;
+  uint64_t length;
+};
+
+/*
+Striped capture sink. Chunks are dealt round-robin over the targets (one
+directory per disk), each target has its own writer thread appending to
+<dir>/<name>.s<k>. close() writes <first dir>/<name>.manifest with the
+place of every chunk so the capture can be read back in order (pcistitch).
+*/
+class XStripedWriter {
+public:
+  XStripedWriter(const std::vector<std::string> &dirs, const std::string &name);
+  ~XStripedWriter();
+
+  // Queue one chunk, data has to stay valid until flush()
+  void write(uint32_t segment, const void *data, uint64_t len);
+  // Wait until every queued chunk is written, throws the first write error
+  void flush();
+  // flush(), close the stripes and write the manifest
+  void close();
+
+  uint32_t getNrTargets() { return this->targets.size(); }
+  uint64_t getNrChunks() { return this->chunks.size(); }
+  std::string getManifestPath() { return this->manifest_path; }
+
+private:
+  struct job {
+    const void *data;
+    uint64_t len;
+  };
+  struct target {
+    std::string path;
+    int fd;
+    // Bytes queued so far, offset of the next chunk
+    uint64_t queued;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable drained;
+    std::deque<job> jobs;
+    bool busy;
+    bool stopping;
+    int error;
+    std::thread th;
+  };
+  void writer(target &t);
+  void stop_writers();
+
+  std::string manifest_path;
+  std::vector<std::unique_ptr<target>> targets;
+  std::vector<stripe_chunk> chunks;
+  bool closed;
+};
+
+// Read a manifest written by XStripedWriter::close(), target paths in order
+bool stripe_manifest_load(const char *path, std::vector<std::string> &targets,
+                          std::vector<stripe_chunk> &chunks);
+
+} // namespace XDMA_udrv
+
+#endif
@@ -0,0 +1,69 @@
+#include <cstring>
+#include <string>
+#include <system_error>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "XDMA_stats.hpp"
+
+using namespace std;
+
+namespace XDMA_udrv {
+
+string XStats::shm_name(int uio_index) {
+  return XDMA_STATS_SHM_PREFIX + to_string(uio_index);
+}
+
+XStats::XStats(int uio_index, bool writer)
+    : writer(writer), uio_index(uio_index) {
+  string name = shm_name(uio_index);
+  int fd = shm_open(name.c_str(), writer ? (O_RDWR | O_CREAT) : O_RDONLY,
+                    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd == -1) {
+    throw system_error(error_code(errno, generic_category()), "shm_open()");
+  }
+  if (writer && ftruncate(fd, sizeof(xdma_stats_shm)) == -1) {
+    close(fd);
+    throw system_error(error_code(errno, generic_category()), "ftruncate()");
+  }
+  void *p = mmap((void *)0, sizeof(xdma_stats_shm),
+                 writer ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd,
+                 0);
+  close(fd);
+  if (p == (void *)-1) {
+    throw system_error(error_code(errno, generic_category()), "mmap()");
+  }
+  this->shm = (xdma_stats_shm *)p;
+
+  if (writer) {
+    // Magic last so readers never pick up a half reset segment
+    this->shm->magic = 0;
+    memset((void *)this->shm->ch, 0, sizeof(this->shm->ch));
+    this->shm->version = XDMA_STATS_VERSION;
+    this->shm->uio_index = uio_index;
+    this->shm->pid = getpid();
+    atomic_thread_fence(memory_order_release);
+    this->shm->magic = XDMA_STATS_MAGIC;
+  } else if (this->shm->magic != XDMA_STATS_MAGIC ||
+             this->shm->version != XDMA_STATS_VERSION) {
+    munmap(p, sizeof(xdma_stats_shm));
+    throw system_error(error_code(-EINVAL, generic_category()),
+                       "stats segment version mismatch");
+  }
+}
+
+XStats::~XStats() {
+  // The segment is left in place so a viewer keeps the last values
+  munmap(this->shm, sizeof(xdma_stats_shm));
+}
+
+xdma_chan_stats *XStats::chan(int dir, uint32_t channel) {
+  if (dir < 0 || dir > 1 || channel >= XDMA_STATS_MAX_CH)
+    return nullptr;
+  return &this->shm->ch[dir][channel];
+}
+
+} // namespace XDMA_udrv
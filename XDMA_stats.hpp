@@ -0,0 +1,71 @@
+#ifndef _XDMA_STATS_HPP_
+#define _XDMA_STATS_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#define XDMA_STATS_SHM_PREFIX "/xdma_udrv.stats.uio"
+#define XDMA_STATS_MAGIC 0x58444D41
+#define XDMA_STATS_VERSION 1
+#define XDMA_STATS_MAX_CH 4
+
+namespace XDMA_udrv {
+
+/*
+Live counters of one channel. Each channel has a single writer (the thread
+driving it) which bumps counters with plain relaxed load/store, no locked
+instructions. Readers may see a counter one update behind.
+*/
+struct alignas(64) xdma_chan_stats {
+  std::atomic<uint64_t> bytes;
+  std::atomic<uint64_t> desc_completed;
+  std::atomic<uint64_t> polls;
+  // Descriptors handed to the engine and not yet consumed
+  std::atomic<uint64_t> ring_occupancy;
+  // Bytes completed but not yet written out by the sink
+  std::atomic<uint64_t> sink_backlog;
+  std::atomic<uint64_t> errors;
+  std::atomic<uint32_t> active;
+};
+
+struct xdma_stats_shm {
+  uint32_t magic;
+  uint32_t version;
+  int32_t uio_index;
+  int32_t pid;
+  // [dir][channel], dir as XDMA_DIR
+  xdma_chan_stats ch[2][XDMA_STATS_MAX_CH];
+};
+
+inline void stat_add(std::atomic<uint64_t> &counter, uint64_t n) {
+  counter.store(counter.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+}
+
+inline void stat_set(std::atomic<uint64_t> &counter, uint64_t n) {
+  counter.store(n, std::memory_order_relaxed);
+}
+
+// POSIX shared memory segment /xdma_udrv.stats.uioN
+class XStats {
+public:
+  XStats() = delete;
+  // writer creates and resets the segment, readers map it read-only
+  XStats(int uio_index, bool writer);
+  ~XStats();
+
+  xdma_stats_shm *get() { return this->shm; }
+  // nullptr for a channel past XDMA_STATS_MAX_CH
+  xdma_chan_stats *chan(int dir, uint32_t channel);
+  static std::string shm_name(int uio_index);
+
+private:
+  xdma_stats_shm *shm;
+  bool writer;
+  int uio_index;
+};
+
+} // namespace XDMA_udrv
+
+#endif
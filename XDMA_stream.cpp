@@ -0,0 +1,174 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+#include <immintrin.h>
+
+#include "XDMA_stream.hpp"
+
+namespace {
+
+using namespace XDMA_udrv;
+
+// 64-byte lines, dst 64-byte aligned, len a multiple of 64
+__attribute__((target("avx512f"))) void
+copy_avx512(uint8_t *dst, const uint8_t *src, size_t len, size_t distance) {
+  for (size_t i = 0; i < len; i += 64) {
+    if (distance)
+      _mm_prefetch((const char *)src + i + distance, _MM_HINT_T2);
+    _mm512_stream_si512((__m512i *)(dst + i),
+                        _mm512_loadu_si512((const __m512i *)(src + i)));
+  }
+}
+
+__attribute__((target("avx2"))) void
+copy_avx2(uint8_t *dst, const uint8_t *src, size_t len, size_t distance) {
+  for (size_t i = 0; i < len; i += 64) {
+    if (distance)
+      _mm_prefetch((const char *)src + i + distance, _MM_HINT_T2);
+    __m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(src + i + 32));
+    _mm256_stream_si256((__m256i *)(dst + i), a);
+    _mm256_stream_si256((__m256i *)(dst + i + 32), b);
+  }
+}
+
+void copy_sse2(uint8_t *dst, const uint8_t *src, size_t len, size_t distance) {
+  for (size_t i = 0; i < len; i += 64) {
+    if (distance)
+      _mm_prefetch((const char *)src + i + distance, _MM_HINT_T2);
+    for (size_t j = 0; j < 64; j += 16)
+      _mm_stream_si128((__m128i *)(dst + i + j),
+                       _mm_loadu_si128((const __m128i *)(src + i + j)));
+  }
+}
+
+using copy_fn = void (*)(uint8_t *, const uint8_t *, size_t, size_t);
+
+copy_fn select_copy_fn() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return copy_avx512;
+  if (__builtin_cpu_supports("avx2"))
+    return copy_avx2;
+  return copy_sse2;
+}
+
+const copy_fn copy_impl = select_copy_fn();
+
+// Chunk idx of buffer, an empty one past the last
+void load_chunk(XSGBuffer &buffer, uint32_t idx, sg_chunk &c) {
+  if (idx < buffer.getNrDesc()) {
+    c = buffer.getChunk(idx);
+  } else {
+    c.idx = buffer.getNrDesc();
+    c.data = nullptr;
+    c.length = 0;
+  }
+}
+
+} // namespace
+
+namespace XDMA_udrv {
+
+void stream_copy(void *dst, const void *src, size_t len, size_t distance) {
+  uint8_t *d = (uint8_t *)dst;
+  const uint8_t *s = (const uint8_t *)src;
+  size_t head = (64 - ((uintptr_t)d & 63)) & 63;
+  head = (head > len) ? len : head;
+  memcpy(d, s, head);
+  d += head;
+  s += head;
+  len -= head;
+  size_t body = len & ~(size_t)63;
+  copy_impl(d, s, body, distance);
+  memcpy(d + body, s + body, len - body);
+  _mm_sfence();
+}
+
+void prefetch_range(const void *p, size_t len) {
+  const char *c = (const char *)((uintptr_t)p & ~(uintptr_t)63);
+  for (; c < (const char *)p + len; c += 64)
+    _mm_prefetch(c, _MM_HINT_T2);
+}
+
+XStreamReader::XStreamReader(XSGBuffer &buffer, size_t distance, size_t block)
+    : buffer(buffer), distance(distance), block(block ? block : 4096), off(0),
+      pos(0), pf_off(0), pf_pos(0) {
+  load_chunk(buffer, 0, this->cur);
+  load_chunk(buffer, 0, this->pf);
+}
+
+void XStreamReader::prefetch() {
+  uint32_t n_desc = this->buffer.getNrDesc();
+  // Fell behind the reader (or first call), restart at the read cursor
+  if (this->pf_pos < this->pos) {
+    this->pf = this->cur;
+    this->pf_off = this->off;
+    this->pf_pos = this->pos;
+  }
+  while (this->pf_pos < this->pos + this->distance && this->pf.idx < n_desc) {
+    if (this->pf_off >= this->pf.length) {
+      load_chunk(this->buffer, this->pf.idx + 1, this->pf);
+      this->pf_off = 0;
+      continue;
+    }
+    _mm_prefetch((const char *)this->pf.data + this->pf_off, _MM_HINT_T2);
+    uint64_t step = 64 - (this->pf_off & 63);
+    if (step > this->pf.length - this->pf_off)
+      step = this->pf.length - this->pf_off;
+    this->pf_off += step;
+    this->pf_pos += step;
+  }
+}
+
+bool XStreamReader::advance(const uint8_t *&data, size_t &len, size_t max) {
+  uint32_t n_desc = this->buffer.getNrDesc();
+  while (this->cur.idx < n_desc && this->off >= this->cur.length) {
+    load_chunk(this->buffer, this->cur.idx + 1, this->cur);
+    this->off = 0;
+  }
+  if (this->cur.idx >= n_desc || max == 0)
+    return false;
+  len = this->cur.length - this->off;
+  len = (len > max) ? max : len;
+  data = (const uint8_t *)this->cur.data + this->off;
+  this->off += len;
+  this->pos += len;
+  if (this->distance)
+    this->prefetch();
+  return true;
+}
+
+bool XStreamReader::next(const uint8_t *&data, size_t &len) {
+  return this->advance(data, len, this->block);
+}
+
+uint64_t
+XStreamReader::for_each(const std::function<void(const uint8_t *, size_t)> &fn) {
+  uint64_t bytes = 0;
+  const uint8_t *data;
+  size_t len;
+  while (this->next(data, len)) {
+    fn(data, len);
+    bytes += len;
+  }
+  return bytes;
+}
+
+size_t XStreamReader::read(void *dst, size_t len) {
+  size_t copied = 0;
+  const uint8_t *data;
+  size_t n;
+  while (copied < len &&
+         this->advance(data, n, (len - copied < this->block) ? len - copied
+                                                              : this->block)) {
+    // Prefetch is already ahead, the copy only streams the stores
+    stream_copy((uint8_t *)dst + copied, data, n, 0);
+    copied += n;
+  }
+  return copied;
+}
+
+} // namespace XDMA_udrv
@@ -0,0 +1,75 @@
+#ifndef _XDMA_STREAM_HPP_
+#define _XDMA_STREAM_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "XDMA_udrv.hpp"
+
+namespace XDMA_udrv {
+
+// Bytes software prefetch runs ahead of the consumer, see bench_stream
+const size_t XDMA_PREFETCH_DISTANCE = 4096;
+
+/*
+Consumer side access to data the engine just wrote. DMA lands in memory, not
+in cache, so every line of a capture is a miss. These keep software prefetch
+(prefetcht2, into L2) a tuned distance ahead of the consumer, across the
+page breaks where the hardware prefetchers stop, and when copying out write
+with non-temporal stores so the destination doesn't displace the
+application's working set. prefetchnta measured slower than no prefetch
+at all, see bench_stream.
+*/
+
+// Copy len bytes out of a DMA buffer, prefetching src distance bytes ahead
+// (0: none). Non-temporal 64/32/16-byte stores (AVX-512/AVX2/SSE2 picked at
+// runtime), ordered by an sfence before returning.
+void stream_copy(void *dst, const void *src, size_t len,
+                 size_t distance = XDMA_PREFETCH_DISTANCE);
+// Prefetch [p, p + len) for a single read
+void prefetch_range(const void *p, size_t len);
+
+/*
+Walks the chunks of a completed XSGBuffer transfer in order, block by
+block, with prefetch kept distance bytes past the end of the last block
+handed out, across chunk and page boundaries. Chunk lengths come from the
+writebacks, so construct it once the engine is done.
+*/
+class XStreamReader {
+public:
+  XStreamReader(XSGBuffer &buffer, size_t distance = XDMA_PREFETCH_DISTANCE,
+                size_t block = 4096);
+
+  // Next block, at most block bytes and within one chunk, false at the end
+  bool next(const uint8_t *&data, size_t &len);
+  // Every remaining block through fn, returns their bytes
+  uint64_t for_each(const std::function<void(const uint8_t *, size_t)> &fn);
+  // Copy up to len of the remaining bytes to dst with non-temporal stores,
+  // returns the # copied
+  size_t read(void *dst, size_t len);
+
+  // Bytes handed out so far
+  uint64_t getOffset() { return this->pos; }
+
+private:
+  // Block of at most max bytes at the read cursor
+  bool advance(const uint8_t *&data, size_t &len, size_t max);
+  void prefetch();
+
+  XSGBuffer &buffer;
+  size_t distance;
+  size_t block;
+  // Read cursor
+  sg_chunk cur;
+  uint64_t off;
+  uint64_t pos;
+  // Prefetch cursor
+  sg_chunk pf;
+  uint64_t pf_off;
+  uint64_t pf_pos;
+};
+
+} // namespace XDMA_udrv
+
+#endif
@@ -0,0 +1,540 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "XDMA_svc.hpp"
+#include "XDMA_timing.hpp"
+#include "XDMA_trace.hpp"
+
+using namespace std;
+
+namespace {
+
+const uint64_t PAGE_LEN = 1UL << 30;
+
+size_t ctrl_size(uint32_t sq_entries, uint32_t cq_entries) {
+  size_t len = sizeof(XDMA_udrv::xsvc_ctrl) +
+               sq_entries * sizeof(XDMA_udrv::xsvc_sqe) +
+               cq_entries * sizeof(XDMA_udrv::xsvc_cqe);
+  return (len + 4095) & ~4095UL;
+}
+
+void send_fds(int sock, const void *msg, size_t len, const vector<int> &fds) {
+  struct iovec iov = {(void *)msg, len};
+  struct msghdr mh = {};
+  vector<char> cbuf(CMSG_SPACE(fds.size() * sizeof(int)));
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  if (!fds.empty()) {
+    mh.msg_control = cbuf.data();
+    mh.msg_controllen = cbuf.size();
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(fds.size() * sizeof(int));
+    memcpy(CMSG_DATA(cm), fds.data(), fds.size() * sizeof(int));
+  }
+  if (sendmsg(sock, &mh, MSG_NOSIGNAL) != (ssize_t)len) {
+    throw system_error(error_code(errno, generic_category()), "sendmsg()");
+  }
+}
+
+ssize_t recv_fds(int sock, void *msg, size_t len, vector<int> &fds) {
+  struct iovec iov = {msg, len};
+  struct msghdr mh = {};
+  char cbuf[CMSG_SPACE((XDMA_SVC_MAX_PAGES + 1) * sizeof(int))];
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = cbuf;
+  mh.msg_controllen = sizeof(cbuf);
+  ssize_t rv = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+  if (rv < 0)
+    return rv;
+  for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm;
+       cm = CMSG_NXTHDR(&mh, cm)) {
+    if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+      continue;
+    size_t n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    fds.resize(n);
+    memcpy(fds.data(), CMSG_DATA(cm), n * sizeof(int));
+  }
+  return rv;
+}
+
+struct sockaddr_un sock_addr(const string &path) {
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    throw std::range_error("Socket path too long");
+  }
+  strcpy(addr.sun_path, path.c_str());
+  return addr;
+}
+
+uint64_t now_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+} // namespace
+
+namespace XDMA_udrv {
+
+static_assert(sizeof(xsvc_sqe) == 56, "xsvc_sqe size");
+static_assert(sizeof(xsvc_cqe) == 24, "xsvc_cqe size");
+
+string svc_sock_path(int uio_index) {
+  const char *env = getenv(XDMA_SVC_SOCK_ENV);
+  if (env && *env)
+    return env;
+  return XDMA_SVC_SOCK_PREFIX + to_string(uio_index) + ".sock";
+}
+
+XSchedBackend::XSchedBackend(XDMA &xdma, uint32_t n_channels) {
+  this->sched = make_unique<XScheduler>(true);
+  for (uint32_t c = 0; c < n_channels; c++) {
+    for (XDMA_DIR dir : {DIR_H2C, DIR_C2H}) {
+      this->engines.push_back(make_unique<XDMAEngine>(xdma, dir, c));
+      this->sched->add_engine(*this->engines.back());
+    }
+  }
+}
+
+void XSchedBackend::submit(const xfer_request &req, void *) {
+  this->sched->submit(req);
+}
+
+size_t XSchedBackend::poll(vector<xfer_done> &done) {
+  return this->sched->poll(done);
+}
+
+XSoftDevice::XSoftDevice(uint64_t card_len, double mibps)
+    : card(card_len), busy_until(0) {
+  this->tsc_per_byte = mibps ? tsc_per_ns() * 1e9 / (mibps * (1 << 20)) : 0;
+}
+
+void XSoftDevice::submit(const xfer_request &req, void *host) {
+  if (req.card_addr > this->card.size() ||
+      req.len > this->card.size() - req.card_addr) {
+    throw std::range_error("Transfer outside the software card memory");
+  }
+  this->jobs.push_back({req, host});
+}
+
+size_t XSoftDevice::poll(vector<xfer_done> &done) {
+  size_t n_done = done.size();
+  uint64_t now = tsc_read();
+
+  while (!this->jobs.empty()) {
+    job &j = this->jobs.front();
+    uint64_t cost = j.req.len * this->tsc_per_byte;
+    // An idle device starts on the next job now
+    if (!this->busy_until)
+      this->busy_until = now;
+    if (this->busy_until + cost > now)
+      break;
+    if (j.req.dir == DIR_H2C)
+      memcpy(this->card.data() + j.req.card_addr, j.host, j.req.len);
+    else
+      memcpy(j.host, this->card.data() + j.req.card_addr, j.req.len);
+    this->busy_until += cost;
+    bool late = j.req.deadline_ns && now_ns() > j.req.deadline_ns;
+    done.push_back({j.req.id, j.req.len, late});
+    this->jobs.pop_front();
+  }
+  if (this->jobs.empty())
+    this->busy_until = 0;
+  return done.size() - n_done;
+}
+
+XSvcDaemon::XSvcDaemon(XSvcBackend &backend, const string &sock_path,
+                       uint32_t n_pages, bool soft)
+    : backend(backend), sock_path(sock_path), next_id(0) {
+  for (uint32_t i = 0; i < n_pages; i++) {
+    page p = {-1, nullptr, 0, nullptr};
+    if (soft) {
+      // Sparse, only what clients touch is ever allocated
+      p.fd = memfd_create("xdma_svc", MFD_CLOEXEC);
+      if (p.fd < 0 || ftruncate(p.fd, PAGE_LEN)) {
+        throw system_error(error_code(errno, generic_category()),
+                           "memfd_create()");
+      }
+      p.vaddr = mmap(nullptr, PAGE_LEN, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     p.fd, 0);
+      if (p.vaddr == MAP_FAILED) {
+        throw system_error(error_code(errno, generic_category()), "mmap()");
+      }
+    } else {
+      p.huge = make_unique<HugePageWrapper>(HUGE_1GiB, true);
+      p.fd = p.huge->getFd();
+      p.vaddr = p.huge->getVAddr();
+      p.paddr = p.huge->getPAddr();
+    }
+    this->pool.push_back(move(p));
+    this->free_pages.push_back(i);
+  }
+
+  struct sockaddr_un addr = sock_addr(sock_path);
+  this->listen_fd =
+      socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (this->listen_fd < 0) {
+    throw system_error(error_code(errno, generic_category()), "socket()");
+  }
+  unlink(sock_path.c_str());
+  if (bind(this->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+      listen(this->listen_fd, 16)) {
+    close(this->listen_fd);
+    throw system_error(error_code(errno, generic_category()),
+                       "bind() " + sock_path);
+  }
+}
+
+XSvcDaemon::~XSvcDaemon() {
+  for (auto &c : this->clients)
+    this->release(*c);
+  close(this->listen_fd);
+  unlink(this->sock_path.c_str());
+  for (auto &p : this->pool) {
+    if (p.huge)
+      continue;
+    munmap(p.vaddr, PAGE_LEN);
+    close(p.fd);
+  }
+}
+
+void XSvcDaemon::accept_clients() {
+  while (1) {
+    int fd = accept4(this->listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0)
+      return;
+
+    // The hello follows connect() right away, don't let a stuck client
+    // hold up everyone else for long
+    struct timeval tv = {0, 100000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    xsvc_hello hello = {};
+    vector<int> none;
+    xsvc_welcome welcome = {XDMA_SVC_MAGIC, 0, 0, PAGE_LEN};
+    if (recv_fds(fd, &hello, sizeof(hello), none) != sizeof(hello) ||
+        hello.magic != XDMA_SVC_MAGIC || hello.version != XDMA_SVC_VERSION ||
+        hello.n_pages == 0 || hello.n_pages > XDMA_SVC_MAX_PAGES) {
+      welcome.status = -EINVAL;
+    } else if (hello.n_pages > this->free_pages.size()) {
+      welcome.status = -ENOMEM;
+    }
+    for (int f : none)
+      close(f);
+
+    unique_ptr<client> c;
+    if (!welcome.status) {
+      c = make_unique<client>();
+      c->sock = fd;
+      c->ctrl_len = ctrl_size(XDMA_SVC_SQ_ENTRIES, XDMA_SVC_CQ_ENTRIES);
+      c->ctrl_fd = memfd_create("xdma_svc_ctrl", MFD_CLOEXEC);
+      c->ctrl = (c->ctrl_fd < 0 || ftruncate(c->ctrl_fd, c->ctrl_len))
+                    ? (xsvc_ctrl *)MAP_FAILED
+                    : (xsvc_ctrl *)mmap(nullptr, c->ctrl_len,
+                                        PROT_READ | PROT_WRITE, MAP_SHARED,
+                                        c->ctrl_fd, 0);
+      if (c->ctrl == MAP_FAILED) {
+        if (c->ctrl_fd >= 0)
+          close(c->ctrl_fd);
+        welcome.status = -errno;
+        c.reset();
+      }
+    }
+    if (welcome.status) {
+      try {
+        send_fds(fd, &welcome, sizeof(welcome), {});
+      } catch (const system_error &) {
+      }
+      close(fd);
+      continue;
+    }
+
+    // Placement new leaves the atomics zeroed by ftruncate()
+    new (c->ctrl) xsvc_ctrl;
+    c->ctrl->magic = XDMA_SVC_MAGIC;
+    c->ctrl->version = XDMA_SVC_VERSION;
+    c->ctrl->sq_entries = XDMA_SVC_SQ_ENTRIES;
+    c->ctrl->cq_entries = XDMA_SVC_CQ_ENTRIES;
+    c->ctrl->buf_len = hello.n_pages * PAGE_LEN;
+    c->sq = (xsvc_sqe *)(c->ctrl + 1);
+    c->cq = (xsvc_cqe *)(c->sq + XDMA_SVC_SQ_ENTRIES);
+    c->sq_head = c->cq_tail = 0;
+    c->inflight = 0;
+    c->gone = false;
+
+    vector<int> fds = {c->ctrl_fd};
+    for (uint32_t i = 0; i < hello.n_pages; i++) {
+      c->pages.push_back(this->free_pages.back());
+      this->free_pages.pop_back();
+      fds.push_back(this->pool[c->pages.back()].fd);
+    }
+    welcome.n_pages = hello.n_pages;
+    try {
+      send_fds(fd, &welcome, sizeof(welcome), fds);
+    } catch (const system_error &) {
+      this->release(*c);
+      continue;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    this->clients.push_back(move(c));
+  }
+}
+
+void XSvcDaemon::check_sockets() {
+  vector<struct pollfd> pfd;
+  for (auto &c : this->clients)
+    pfd.push_back({c->sock, POLLIN, 0});
+  if (pfd.empty() || ::poll(pfd.data(), pfd.size(), 0) <= 0)
+    return;
+  for (size_t i = 0; i < pfd.size(); i++) {
+    char b;
+    // Clients never send after the hello, anything here is EOF or an error
+    if (pfd[i].revents && recv(pfd[i].fd, &b, 1, MSG_DONTWAIT) <= 0)
+      this->clients[i]->gone = true;
+  }
+}
+
+void XSvcDaemon::complete(client &c, uint64_t id, uint64_t len,
+                          int32_t status, bool late) {
+  c.cq[c.cq_tail & (XDMA_SVC_CQ_ENTRIES - 1)] = {id, len, status, late};
+  c.ctrl->cq_tail.store(++c.cq_tail, memory_order_release);
+}
+
+// The control segment is writable by the client, sizes and bounds come
+// from the daemon's own state. Only sq_tail and cq_head are read from it,
+// and a client whose indices are further apart than the rings is dropped.
+void XSvcDaemon::serve(client &c) {
+  xsvc_ctrl *ctrl = c.ctrl;
+  uint32_t tail = ctrl->sq_tail.load(memory_order_acquire);
+  uint32_t head = c.sq_head;
+  if (head == tail)
+    return;
+  if (tail - head > XDMA_SVC_SQ_ENTRIES) {
+    c.gone = true;
+    return;
+  }
+  XDMA_TRACE_SCOPE("svc_serve");
+
+  for (; head != tail; head++) {
+    // Every accepted entry needs a completion slot to land in
+    uint32_t cq_used = c.cq_tail - ctrl->cq_head.load(memory_order_acquire);
+    if (cq_used > XDMA_SVC_CQ_ENTRIES) {
+      c.gone = true;
+      break;
+    }
+    if (cq_used + c.inflight >= XDMA_SVC_CQ_ENTRIES)
+      break;
+    xsvc_sqe e = c.sq[head & (XDMA_SVC_SQ_ENTRIES - 1)];
+    uint64_t pg = e.offset / PAGE_LEN, off = e.offset % PAGE_LEN;
+    if (e.dir > DIR_C2H || e.len == 0 || pg >= c.pages.size() ||
+        e.len > PAGE_LEN - off) {
+      this->complete(c, e.id, 0, -EINVAL, false);
+      continue;
+    }
+    const page &p = this->pool[c.pages[pg]];
+    xfer_request req = {};
+    req.id = this->next_id++;
+    req.dir = (XDMA_DIR)e.dir;
+    req.channel = e.channel;
+    req.host_paddr = p.paddr + off;
+    req.card_addr = e.card_addr;
+    req.len = e.len;
+    req.priority = e.priority;
+    req.deadline_ns = e.deadline_ns;
+    try {
+      this->backend.submit(req, (uint8_t *)p.vaddr + off);
+    } catch (const std::range_error &) {
+      this->complete(c, e.id, 0, -EINVAL, false);
+      continue;
+    }
+    this->inflight[req.id] = {&c, e.id};
+    c.inflight++;
+  }
+  c.sq_head = head;
+  ctrl->sq_head.store(head, memory_order_release);
+}
+
+void XSvcDaemon::release(client &c) {
+  for (uint32_t pg : c.pages) {
+    // The next owner must not see this client's data
+    memset(this->pool[pg].vaddr, 0, PAGE_LEN);
+    this->free_pages.push_back(pg);
+  }
+  c.pages.clear();
+  munmap(c.ctrl, c.ctrl_len);
+  close(c.ctrl_fd);
+  close(c.sock);
+}
+
+void XSvcDaemon::run(const atomic<bool> &stop) {
+  vector<xfer_done> done;
+  uint64_t iter = 0, idle = 0;
+
+  while (!stop) {
+    // Control path every so often, or whenever there is nothing else to do
+    if ((iter++ & 1023) == 0 || idle) {
+      this->accept_clients();
+      this->check_sockets();
+    }
+    uint64_t n_work = 0;
+    for (auto &c : this->clients) {
+      uint32_t before = c->sq_head;
+      if (!c->gone)
+        this->serve(*c);
+      n_work += c->sq_head - before;
+    }
+
+    done.clear();
+    n_work += this->backend.poll(done);
+    for (auto &d : done) {
+      auto it = this->inflight.find(d.id);
+      if (it == this->inflight.end())
+        continue;
+      client *c = it->second.c;
+      c->inflight--;
+      this->complete(*c, it->second.id, d.len, 0, d.late);
+      this->inflight.erase(it);
+    }
+
+    // A client that left keeps its pages until the card is done with them
+    for (size_t i = 0; i < this->clients.size();) {
+      client &c = *this->clients[i];
+      if (c.gone && !c.inflight) {
+        this->release(c);
+        this->clients.erase(this->clients.begin() + i);
+      } else {
+        i++;
+      }
+    }
+
+    if (n_work) {
+      idle = 0;
+    } else if (++idle > 1000) {
+      struct timespec ts = {0, 50000};
+      nanosleep(&ts, nullptr);
+    }
+  }
+}
+
+XSvcClient::XSvcClient(uint32_t n_pages, const string &sock_path,
+                       int uio_index) {
+  string path = sock_path.empty() ? svc_sock_path(uio_index) : sock_path;
+  struct sockaddr_un addr = sock_addr(path);
+  xsvc_hello hello = {XDMA_SVC_MAGIC, XDMA_SVC_VERSION, n_pages};
+  xsvc_welcome welcome = {};
+  vector<int> fds;
+
+  this->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (this->sock < 0) {
+    throw system_error(error_code(errno, generic_category()), "socket()");
+  }
+  if (connect(this->sock, (struct sockaddr *)&addr, sizeof(addr))) {
+    close(this->sock);
+    throw system_error(error_code(errno, generic_category()),
+                       "connect() " + path);
+  }
+  try {
+    send_fds(this->sock, &hello, sizeof(hello), {});
+  } catch (...) {
+    close(this->sock);
+    throw;
+  }
+  ssize_t rv = recv_fds(this->sock, &welcome, sizeof(welcome), fds);
+  int err = (rv != sizeof(welcome) || welcome.magic != XDMA_SVC_MAGIC)
+                ? EPROTO
+                : (welcome.status ? -welcome.status
+                                  : (fds.size() != n_pages + 1 ? EPROTO : 0));
+  if (err) {
+    for (int f : fds)
+      close(f);
+    close(this->sock);
+    throw system_error(error_code(err, generic_category()), "xdma_svcd");
+  }
+
+  this->ctrl_len = ctrl_size(XDMA_SVC_SQ_ENTRIES, XDMA_SVC_CQ_ENTRIES);
+  this->ctrl = (xsvc_ctrl *)mmap(nullptr, this->ctrl_len,
+                                 PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+  // Pages side by side, aligned so 1 GiB pages can be mapped in
+  this->buf_len = (uint64_t)n_pages * welcome.page_len;
+  this->map_len = this->buf_len + welcome.page_len;
+  void *va = mmap(nullptr, this->map_len, PROT_NONE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  err = (this->ctrl == MAP_FAILED || va == MAP_FAILED) ? errno : 0;
+  this->buf = (uint8_t *)(((uintptr_t)va + welcome.page_len - 1) &
+                          ~(welcome.page_len - 1));
+  for (uint32_t i = 0; !err && i < n_pages; i++) {
+    if (mmap(this->buf + i * welcome.page_len, welcome.page_len,
+             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fds[i + 1],
+             0) == MAP_FAILED)
+      err = errno;
+  }
+  for (int f : fds)
+    close(f);
+  if (err) {
+    if (this->ctrl != MAP_FAILED)
+      munmap(this->ctrl, this->ctrl_len);
+    if (va != MAP_FAILED)
+      munmap(va, this->map_len);
+    close(this->sock);
+    throw system_error(error_code(err, generic_category()), "mmap()");
+  }
+  // Keep only the aligned part reserved
+  munmap(va, (uint8_t *)this->buf - (uint8_t *)va);
+  if ((uint8_t *)va + this->map_len > this->buf + this->buf_len)
+    munmap(this->buf + this->buf_len,
+           (uint8_t *)va + this->map_len - (this->buf + this->buf_len));
+  this->map_len = this->buf_len;
+  this->sq = (xsvc_sqe *)(this->ctrl + 1);
+  this->cq = (xsvc_cqe *)(this->sq + this->ctrl->sq_entries);
+}
+
+XSvcClient::~XSvcClient() {
+  munmap(this->buf, this->map_len);
+  munmap(this->ctrl, this->ctrl_len);
+  close(this->sock);
+}
+
+bool XSvcClient::submit(uint64_t id, XDMA_DIR dir, uint64_t offset,
+                        uint64_t len, uint64_t card_addr, int32_t channel,
+                        int32_t priority, uint64_t deadline_ns) {
+  uint32_t tail = this->ctrl->sq_tail.load(memory_order_relaxed);
+  uint32_t head = this->ctrl->sq_head.load(memory_order_acquire);
+  if (tail - head == this->ctrl->sq_entries)
+    return false;
+  this->sq[tail & (this->ctrl->sq_entries - 1)] = {
+      id, (uint32_t)dir, channel, offset, card_addr, len, priority, 0,
+      deadline_ns};
+  this->ctrl->sq_tail.store(tail + 1, memory_order_release);
+  return true;
+}
+
+size_t XSvcClient::poll(vector<xsvc_cqe> &done) {
+  uint32_t head = this->ctrl->cq_head.load(memory_order_relaxed);
+  uint32_t tail = this->ctrl->cq_tail.load(memory_order_acquire);
+  for (uint32_t i = head; i != tail; i++)
+    done.push_back(this->cq[i & (this->ctrl->cq_entries - 1)]);
+  this->ctrl->cq_head.store(tail, memory_order_release);
+  return tail - head;
+}
+
+} // namespace XDMA_udrv
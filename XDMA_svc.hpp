@@ -0,0 +1,228 @@
+#ifndef _XDMA_SVC_HPP_
+#define _XDMA_SVC_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "XDMA_sched.hpp"
+#include "XDMA_udrv.hpp"
+
+// Unix socket of the service for /dev/uioN, XDMA_SVC_SOCK_ENV overrides
+#define XDMA_SVC_SOCK_PREFIX "/run/xdma_udrv.uio"
+#define XDMA_SVC_SOCK_ENV "XDMA_SVC_SOCK"
+#define XDMA_SVC_MAGIC 0x58535643
+#define XDMA_SVC_VERSION 1
+#define XDMA_SVC_SQ_ENTRIES 1024
+#define XDMA_SVC_CQ_ENTRIES 1024
+// Buffer pages handed to one client at most
+#define XDMA_SVC_MAX_PAGES 16
+
+namespace XDMA_udrv {
+
+/*
+Multi-process DMA service, SPDK style. xdma_svcd owns the device and a pool
+of 1 GiB pages. A client connects over a Unix socket and gets back, as
+file descriptors, a control segment with its submission/completion rings
+and its buffer pages, which both sides map. From then on the socket only
+tells the daemon the client went away: the client writes xsvc_sqe entries
+and bumps sq_tail, the daemon polls every client's rings and posts
+xsvc_cqe entries, no syscalls either way.
+Transfers name a buffer offset, the daemon turns it into a bus address, so
+data moves straight between the card and the client's pages.
+*/
+
+// Submission, one transfer within one buffer page
+struct xsvc_sqe {
+  uint64_t id;
+  uint32_t dir; // XDMA_DIR
+  // -1 lets the daemon pick
+  int32_t channel;
+  // Into the client buffer
+  uint64_t offset;
+  uint64_t card_addr;
+  uint64_t len;
+  int32_t priority;
+  uint32_t reserved;
+  uint64_t deadline_ns;
+};
+
+struct xsvc_cqe {
+  uint64_t id;
+  uint64_t len;
+  // 0 or -errno
+  int32_t status;
+  uint32_t late;
+};
+
+/*
+Start of the control segment, the rings follow it. Indices run freely and
+are masked by the (power of two) ring size. Each index has one writer and
+its own cache line.
+*/
+struct xsvc_ctrl {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t sq_entries;
+  uint32_t cq_entries;
+  uint64_t buf_len;
+  alignas(64) std::atomic<uint32_t> sq_tail; // client
+  alignas(64) std::atomic<uint32_t> sq_head; // daemon
+  alignas(64) std::atomic<uint32_t> cq_tail; // daemon
+  alignas(64) std::atomic<uint32_t> cq_head; // client
+};
+
+// Socket handshake, the reply carries the control and page fds
+struct xsvc_hello {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t n_pages;
+};
+
+struct xsvc_welcome {
+  uint32_t magic;
+  int32_t status;
+  uint32_t n_pages;
+  uint64_t page_len;
+};
+
+std::string svc_sock_path(int uio_index);
+
+// Where the daemon sends transfers
+class XSvcBackend {
+public:
+  virtual ~XSvcBackend() {}
+  // host is the daemon's mapping of the buffer at req.host_paddr. Throws
+  // std::range_error for transfers the device cannot do.
+  virtual void submit(const xfer_request &req, void *host) = 0;
+  virtual size_t poll(std::vector<xfer_done> &done) = 0;
+};
+
+// The card, through an XScheduler over channels 0 .. n_channels - 1
+class XSchedBackend : public XSvcBackend {
+public:
+  XSchedBackend(XDMA &xdma, uint32_t n_channels);
+  void submit(const xfer_request &req, void *host) override;
+  size_t poll(std::vector<xfer_done> &done) override;
+
+private:
+  std::vector<std::unique_ptr<XDMAEngine>> engines;
+  std::unique_ptr<XScheduler> sched;
+};
+
+/*
+Software stand-in for an AXI-MM card: H2C copies into card memory, C2H
+copies out of it, so data written to an address comes back from it.
+Transfers complete on the next poll(), or at mibps if that is set.
+*/
+class XSoftDevice : public XSvcBackend {
+public:
+  XSoftDevice(uint64_t card_len, double mibps = 0);
+  void submit(const xfer_request &req, void *host) override;
+  size_t poll(std::vector<xfer_done> &done) override;
+
+private:
+  struct job {
+    xfer_request req;
+    void *host;
+  };
+  std::vector<uint8_t> card;
+  double tsc_per_byte;
+  uint64_t busy_until;
+  std::deque<job> jobs;
+};
+
+class XSvcDaemon {
+public:
+  // soft: buffer pages are plain shared memory, no hugepages needed, for
+  // the software device
+  XSvcDaemon(XSvcBackend &backend, const std::string &sock_path,
+             uint32_t n_pages, bool soft = false);
+  ~XSvcDaemon();
+
+  // Serve until stop is set
+  void run(const std::atomic<bool> &stop);
+
+  uint32_t getNrClients() { return this->clients.size(); }
+  uint32_t getNrFreePages() { return this->free_pages.size(); }
+
+private:
+  struct page {
+    int fd;
+    void *vaddr;
+    uint64_t paddr;
+    std::unique_ptr<HugePageWrapper> huge;
+  };
+  struct client {
+    int sock;
+    int ctrl_fd;
+    xsvc_ctrl *ctrl;
+    size_t ctrl_len;
+    xsvc_sqe *sq;
+    xsvc_cqe *cq;
+    std::vector<uint32_t> pages;
+    // Daemon's own copies of the indices it writes, the ones in ctrl are
+    // only published
+    uint32_t sq_head;
+    uint32_t cq_tail;
+    uint32_t inflight;
+    bool gone;
+  };
+  struct pending {
+    client *c;
+    uint64_t id;
+  };
+
+  void accept_clients();
+  void check_sockets();
+  void serve(client &c);
+  void complete(client &c, uint64_t id, uint64_t len, int32_t status,
+                bool late);
+  void release(client &c);
+
+  XSvcBackend &backend;
+  std::string sock_path;
+  int listen_fd;
+  std::vector<page> pool;
+  std::vector<uint32_t> free_pages;
+  std::vector<std::unique_ptr<client>> clients;
+  // Backend request id to the client's
+  std::unordered_map<uint64_t, pending> inflight;
+  uint64_t next_id;
+};
+
+class XSvcClient {
+public:
+  // sock_path empty: svc_sock_path(uio_index)
+  XSvcClient(uint32_t n_pages = 1, const std::string &sock_path = "",
+             int uio_index = 0);
+  ~XSvcClient();
+
+  void *getBuffer() { return this->buf; }
+  uint64_t getBufferLen() { return this->buf_len; }
+  // False if the submission ring is full. The transfer must not cross a
+  // 1 GiB page of the buffer.
+  bool submit(uint64_t id, XDMA_DIR dir, uint64_t offset, uint64_t len,
+              uint64_t card_addr = 0, int32_t channel = -1,
+              int32_t priority = 0, uint64_t deadline_ns = 0);
+  // Move completions to done, returns how many
+  size_t poll(std::vector<xsvc_cqe> &done);
+
+private:
+  int sock;
+  xsvc_ctrl *ctrl;
+  size_t ctrl_len;
+  xsvc_sqe *sq;
+  xsvc_cqe *cq;
+  uint8_t *buf;
+  uint64_t buf_len;
+  size_t map_len;
+};
+
+} // namespace XDMA_udrv
+
+#endif
@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <numeric>
+#include <ostream>
+#include <system_error>
+#include <vector>
+
+#include <errno.h>
+#include <time.h>
+
+#include "XDMA_poll.hpp"
+#include "XDMA_timing.hpp"
+#include "XDMA_trace.hpp"
+
+using namespace std;
+
+namespace {
+
+double calibrate_tsc() {
+  struct timespec tstart, tend;
+  uint64_t c0, c1;
+  clock_gettime(CLOCK_MONOTONIC, &tstart);
+  c0 = __rdtsc();
+  // 10 ms is plenty for a few ppm on invariant TSC
+  do {
+    clock_gettime(CLOCK_MONOTONIC, &tend);
+  } while ((tend.tv_sec - tstart.tv_sec) * 1000000000LL +
+               (tend.tv_nsec - tstart.tv_nsec) <
+           10000000LL);
+  c1 = __rdtsc();
+  return (double)(c1 - c0) / ((tend.tv_sec - tstart.tv_sec) * 1e9 +
+                              (tend.tv_nsec - tstart.tv_nsec));
+}
+
+} // namespace
+
+namespace XDMA_udrv {
+
+double tsc_per_ns() {
+  static const double ratio = calibrate_tsc();
+  return ratio;
+}
+
+void check_stall(XDMAEngine *engine, uint64_t t_last, uint64_t now,
+                 uint64_t timeout_ns, uint64_t &t_checked) {
+  // An engine that stopped on an error never completes, look at its status
+  // every 10 us of stall rather than on every poll
+  const uint64_t check_tsc = 10000 * tsc_per_ns();
+  if (now - t_checked < check_tsc)
+    return;
+  t_checked = now;
+  if (engine)
+    engine->check_status();
+  if (timeout_ns && now - t_last > timeout_ns * tsc_per_ns()) {
+    if (engine)
+      stat_add(engine->stats()->errors, 1);
+    throw system_error(error_code(-ETIMEDOUT, generic_category()),
+                       "completion timed out");
+  }
+}
+
+XCompletionTimeline::XCompletionTimeline(uint32_t n_desc)
+    : t0(0), timeout_ns(0), t_checked(0),
+      tsc(n_desc, 0), bytes(n_desc, 0), polls(n_desc, 0) {
+  // Calibrate now rather than inside a transfer
+  tsc_per_ns();
+}
+
+void XCompletionTimeline::wait_by_count(XDMAEngine &engine, XPoller *poller,
+                                        uint64_t desc_bytes) {
+  XDMA_TRACE_SCOPE("wait_by_count");
+  uint32_t done = 0;
+  uint64_t n_poll = 0;
+  uint64_t t_start = tsc_read(), t_last = t_start;
+  uint64_t expected = poller ? poller->expected_tsc(desc_bytes) : 0;
+  while (done < this->tsc.size()) {
+    uint32_t cnt = engine.completed_count();
+    uint64_t now = tsc_read();
+    n_poll++;
+    if (cnt == 0xFFFFFFFF || cnt <= done) {
+      check_stall(&engine, t_last, now, this->timeout_ns, this->t_checked);
+      if (poller)
+        poller->backoff(t_last, expected);
+      continue;
+    }
+    t_last = now;
+    cnt = (cnt > this->tsc.size()) ? this->tsc.size() : cnt;
+    XDMA_TRACE_INSTANT("desc_completed");
+    stat_add(engine.stats()->polls, n_poll);
+    stat_add(engine.stats()->desc_completed, cnt - done);
+    stat_add(engine.stats()->bytes, (uint64_t)(cnt - done) * desc_bytes);
+    stat_set(engine.stats()->ring_occupancy, this->tsc.size() - cnt);
+    uint32_t first = done;
+    for (; done < cnt; done++) {
+      this->tsc[done] = now;
+      this->polls[done] = n_poll;
+      n_poll = 0;
+    }
+    if (this->on_complete)
+      this->on_complete(first, done);
+  }
+  if (poller)
+    poller->account((uint64_t)desc_bytes * this->tsc.size(), t_start);
+}
+
+void XCompletionTimeline::wait_by_writeback(volatile c2h_wb *wb,
+                                            XDMAEngine *engine) {
+  XDMA_TRACE_SCOPE("wait_by_writeback");
+  uint64_t n_poll = 0, t_last = tsc_read();
+  for (uint32_t i = 0; i < this->tsc.size(); i++) {
+    while ((wb[i].status >> 16) != XDMA_C2H_WB_MAGIC) {
+      n_poll++;
+      check_stall(engine, t_last, tsc_read(), this->timeout_ns,
+                  this->t_checked);
+    }
+    this->tsc[i] = t_last = tsc_read();
+    XDMA_TRACE_INSTANT("desc_completed");
+    this->polls[i] = n_poll + 1;
+    if (engine) {
+      stat_add(engine->stats()->polls, n_poll + 1);
+      stat_add(engine->stats()->desc_completed, 1);
+      stat_add(engine->stats()->bytes, wb[i].length);
+      stat_set(engine->stats()->ring_occupancy, this->tsc.size() - i - 1);
+    }
+    n_poll = 0;
+    if (this->on_complete)
+      this->on_complete(i, i + 1);
+  }
+}
+
+void XCompletionTimeline::load_lengths(const c2h_wb *wb) {
+  for (uint32_t i = 0; i < this->bytes.size(); i++)
+    this->bytes[i] = wb[i].length;
+}
+
+double XCompletionTimeline::getGapNs(uint32_t idx) {
+  uint64_t prev = idx ? this->tsc[idx - 1] : this->t0;
+  return (this->tsc[idx] - prev) / tsc_per_ns();
+}
+
+double XCompletionTimeline::getChunkMiBps(uint32_t idx) {
+  double gap = this->getGapNs(idx);
+  // Coalesced completions have no gap of their own
+  return gap ? this->bytes[idx] / gap * 1e9 / (1 << 20) : 0.0;
+}
+
+uint32_t XCompletionTimeline::getWorstStallIdx() {
+  uint32_t worst = 0;
+  for (uint32_t i = 1; i < this->tsc.size(); i++) {
+    if (this->getGapNs(i) > this->getGapNs(worst))
+      worst = i;
+  }
+  return worst;
+}
+
+double XCompletionTimeline::getDurationNs() {
+  return this->tsc.empty() ? 0 : (this->tsc.back() - this->t0) / tsc_per_ns();
+}
+
+void XCompletionTimeline::report(ostream &os, bool verbose) {
+  uint32_t n = this->tsc.size();
+  char line[128];
+  if (n == 0)
+    return;
+
+  uint64_t total = accumulate(this->bytes.begin(), this->bytes.end(), 0ULL);
+  vector<double> gaps(n);
+  for (uint32_t i = 0; i < n; i++)
+    gaps[i] = this->getGapNs(i);
+  vector<double> sorted(gaps);
+  sort(sorted.begin(), sorted.end());
+  double median = sorted[n / 2];
+
+  snprintf(line, sizeof(line),
+           "%u descriptor(s), %llu byte(s) in %.0lf ns, %.5lf MiB/s\n", n,
+           (unsigned long long)total, this->getDurationNs(),
+           total / this->getDurationNs() * 1e9 / (1 << 20));
+  os << line;
+  snprintf(line, sizeof(line),
+           "Completion gap ns: min %.0lf median %.0lf p99 %.0lf max %.0lf\n",
+           sorted[0], median, sorted[(n - 1) * 99 / 100], sorted[n - 1]);
+  os << line;
+
+  // log2 histogram of inter-completion gaps
+  array<uint32_t, 64> hist{};
+  for (auto g : gaps)
+    hist[(g < 1) ? 0 : 63 - __builtin_clzll((uint64_t)g)]++;
+  os << "Gap histogram:" << endl;
+  for (int b = 0; b < 64; b++) {
+    if (!hist[b])
+      continue;
+    snprintf(line, sizeof(line), "  [%12llu, %12llu) ns: %u\n",
+             b ? 1ULL << b : 0ULL, 2ULL << b, hist[b]);
+    os << line;
+  }
+
+  // Worst stalls against the median gap
+  vector<uint32_t> order(n);
+  iota(order.begin(), order.end(), 0);
+  sort(order.begin(), order.end(),
+       [&gaps](uint32_t a, uint32_t b) { return gaps[a] > gaps[b]; });
+  os << "Worst stalls:" << endl;
+  for (uint32_t i = 0; i < n && i < 5; i++) {
+    uint32_t idx = order[i];
+    snprintf(line, sizeof(line),
+             "  desc %6u: %12.0lf ns (%.1lfx median), %llu poll(s)\n", idx,
+             gaps[idx], median ? gaps[idx] / median : 0.0,
+             (unsigned long long)this->polls[idx]);
+    os << line;
+  }
+
+  if (!verbose)
+    return;
+  os << "Per-chunk throughput:" << endl;
+  for (uint32_t i = 0; i < n; i++) {
+    snprintf(line, sizeof(line),
+             "  desc %6u: %10u B %12.0lf ns %12.3lf MiB/s\n", i,
+             this->bytes[i], gaps[i], this->getChunkMiBps(i));
+    os << line;
+  }
+}
+
+} // namespace XDMA_udrv
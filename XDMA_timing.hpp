@@ -0,0 +1,81 @@
+#ifndef _XDMA_TIMING_HPP_
+#define _XDMA_TIMING_HPP_
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <vector>
+
+#include <x86intrin.h>
+
+#include "XDMA_udrv.hpp"
+
+namespace XDMA_udrv {
+
+class XPoller;
+
+inline uint64_t tsc_read() { return __rdtsc(); }
+// TSC ticks per nanosecond, calibrated against CLOCK_MONOTONIC on first use
+double tsc_per_ns();
+// For completion polls that came back empty, t_last being the TSC of the
+// last progress. Every 10 us of stall (t_checked tracks when) checks the
+// engine's status, if given, then throws system_error ETIMEDOUT once
+// timeout_ns (0: never) have passed.
+void check_stall(XDMAEngine *engine, uint64_t t_last, uint64_t now,
+                 uint64_t timeout_ns, uint64_t &t_checked);
+
+/*
+Per-descriptor completion timestamps of one transfer.
+mark_start() right before the doorbell, then one of the wait_*() to poll
+completions. Each completed descriptor gets the TSC of the poll that first
+saw it, descriptors that show up in the same poll share a timestamp.
+*/
+class XCompletionTimeline {
+public:
+  XCompletionTimeline(uint32_t n_desc);
+
+  void mark_start() { this->t0 = tsc_read(); }
+  // Poll the channel's completed descriptor count register, backing off
+  // between reads through poller if given
+  void wait_by_count(XDMAEngine &engine, XPoller *poller = nullptr,
+                     uint64_t desc_bytes = MEM_CHUNK_SIZE);
+  // Poll C2H stream writeback magic in host memory, no MMIO unless engine is
+  // given to check for errors while stalled and count into its stats
+  void wait_by_writeback(volatile c2h_wb *wb, XDMAEngine *engine = nullptr);
+  // Called from the wait with every newly completed range [first, end)
+  void set_on_complete(std::function<void(uint32_t, uint32_t)> fn) {
+    this->on_complete = fn;
+  }
+  // Waits throw system_error ETIMEDOUT after this long without a completion,
+  // 0 (default) waits forever. Engine errors are thrown as they are seen.
+  void set_timeout_ns(uint64_t ns) { this->timeout_ns = ns; }
+  // Bytes moved per descriptor, from the writeback length
+  void load_lengths(const c2h_wb *wb);
+  void set_length(uint32_t idx, uint32_t bytes) { this->bytes[idx] = bytes; }
+
+  uint32_t getNrDesc() { return this->tsc.size(); }
+  uint64_t getT0() { return this->t0; }
+  uint64_t getTsc(uint32_t idx) { return this->tsc[idx]; }
+  // ns between completion idx and the previous one (or mark_start())
+  double getGapNs(uint32_t idx);
+  double getChunkMiBps(uint32_t idx);
+  uint64_t getPolls(uint32_t idx) { return this->polls[idx]; }
+  uint32_t getWorstStallIdx();
+  double getDurationNs();
+
+  // Summary, gap histogram and worst stalls, per-chunk table if verbose
+  void report(std::ostream &os, bool verbose = false);
+
+private:
+  uint64_t t0;
+  std::function<void(uint32_t, uint32_t)> on_complete;
+  uint64_t timeout_ns;
+  uint64_t t_checked;
+  std::vector<uint64_t> tsc;
+  std::vector<uint32_t> bytes;
+  std::vector<uint64_t> polls;
+};
+
+} // namespace XDMA_udrv
+
+#endif
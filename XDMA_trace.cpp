@@ -0,0 +1,79 @@
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "XDMA_timing.hpp"
+#include "XDMA_trace.hpp"
+
+using namespace std;
+
+namespace XDMA_udrv {
+
+#ifdef XDMA_TRACE
+
+namespace {
+
+// Rings outlive their threads so a dump after join still sees them
+mutex rings_lock;
+vector<trace_ring *> rings;
+
+} // namespace
+
+trace_ring *trace_ring_register() {
+  trace_ring *r = new trace_ring;
+  r->head.store(0);
+  r->tid = syscall(SYS_gettid);
+  lock_guard<mutex> lk(rings_lock);
+  rings.push_back(r);
+  return r;
+}
+
+bool trace_dump_chrome(const char *path) {
+  FILE *fp = fopen(path, "w");
+  if (!fp)
+    return false;
+
+  lock_guard<mutex> lk(rings_lock);
+  double ratio = tsc_per_ns();
+  uint64_t origin = UINT64_MAX;
+  for (auto r : rings) {
+    uint64_t h = r->head.load(memory_order_acquire);
+    uint64_t first = (h > trace_ring::capacity) ? h - trace_ring::capacity : 0;
+    if (h > first && r->ev[first % trace_ring::capacity].tsc < origin)
+      origin = r->ev[first % trace_ring::capacity].tsc;
+  }
+
+  // Timestamps in microseconds from the oldest retained event
+  fprintf(fp, "{\"traceEvents\":[\n");
+  bool first_ev = true;
+  for (auto r : rings) {
+    uint64_t h = r->head.load(memory_order_acquire);
+    uint64_t first = (h > trace_ring::capacity) ? h - trace_ring::capacity : 0;
+    for (uint64_t i = first; i < h; i++) {
+      const trace_event &e = r->ev[i % trace_ring::capacity];
+      fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3lf,",
+              first_ev ? "" : ",\n", e.name, e.ph,
+              (e.tsc - origin) / ratio / 1000.0);
+      if (e.ph == 'X')
+        fprintf(fp, "\"dur\":%.3lf,", e.dur / ratio / 1000.0);
+      else
+        fprintf(fp, "\"s\":\"t\",");
+      fprintf(fp, "\"pid\":%d,\"tid\":%d}", getpid(), r->tid);
+      first_ev = false;
+    }
+  }
+  fprintf(fp, "\n],\"displayTimeUnit\":\"ns\"}\n");
+  return fclose(fp) == 0;
+}
+
+#else
+
+bool trace_dump_chrome(const char *path) { return false; }
+
+#endif
+
+} // namespace XDMA_udrv
@@ -0,0 +1,87 @@
+#ifndef _XDMA_TRACE_HPP_
+#define _XDMA_TRACE_HPP_
+
+#include <atomic>
+#include <cstdint>
+
+#include <x86intrin.h>
+
+/*
+Hot path tracer, compiled in with -DXDMA_TRACE (make TRACE=1) and gone
+otherwise. Events are rdtsc stamped into a per-thread ring that only its own
+thread writes, oldest events are overwritten. Names must be string literals.
+Dump with trace_dump_chrome() once the traced threads are quiet.
+*/
+
+namespace XDMA_udrv {
+
+// Write all rings as Chrome trace / Perfetto JSON, false if tracing is
+// compiled out or the file can't be written
+bool trace_dump_chrome(const char *path);
+
+#ifdef XDMA_TRACE
+
+struct trace_event {
+  const char *name;
+  uint64_t tsc;
+  uint64_t dur;
+  char ph;
+};
+
+struct trace_ring {
+  static const uint32_t capacity = 1 << 16;
+  std::atomic<uint64_t> head;
+  int32_t tid;
+  trace_event ev[capacity];
+};
+
+trace_ring *trace_ring_register();
+
+inline trace_ring *trace_local() {
+  static thread_local trace_ring *ring = trace_ring_register();
+  return ring;
+}
+
+inline void trace_record(const char *name, uint64_t tsc, uint64_t dur,
+                         char ph) {
+  trace_ring *r = trace_local();
+  uint64_t h = r->head.load(std::memory_order_relaxed);
+  trace_event &e = r->ev[h & (trace_ring::capacity - 1)];
+  e.name = name;
+  e.tsc = tsc;
+  e.dur = dur;
+  e.ph = ph;
+  r->head.store(h + 1, std::memory_order_release);
+}
+
+class trace_scope {
+public:
+  trace_scope(const char *name) : name(name), t0(__rdtsc()) {}
+  ~trace_scope() { trace_record(this->name, this->t0, __rdtsc() - t0, 'X'); }
+
+private:
+  const char *name;
+  uint64_t t0;
+};
+
+#define XDMA_TRACE_CAT_(a, b) a##b
+#define XDMA_TRACE_CAT(a, b) XDMA_TRACE_CAT_(a, b)
+#define XDMA_TRACE_SCOPE(name)                                                 \
+  XDMA_udrv::trace_scope XDMA_TRACE_CAT(_xdma_trace_, __LINE__)(name)
+#define XDMA_TRACE_INSTANT(name)                                               \
+  XDMA_udrv::trace_record(name, __rdtsc(), 0, 'i')
+
+#else
+
+#define XDMA_TRACE_SCOPE(name)                                                 \
+  do {                                                                         \
+  } while (0)
+#define XDMA_TRACE_INSTANT(name)                                               \
+  do {                                                                         \
+  } while (0)
+
+#endif
+
+} // namespace XDMA_udrv
+
+#endif
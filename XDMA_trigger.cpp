@@ -0,0 +1,264 @@
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include <errno.h>
+
+#include "XDMA_timing.hpp"
+#include "XDMA_trace.hpp"
+#include "XDMA_trigger.hpp"
+
+using namespace std;
+
+namespace XDMA_udrv {
+
+XTriggerRing::XTriggerRing(uint64_t size, uint32_t chunk_size)
+    : desc_wb_buf(HugePageSizeType::HUGE_2MiB) {
+  if ((chunk_size & (chunk_size - 1)) || chunk_size > MEM_CHUNK_SIZE ||
+      chunk_size < XDMA_MIN_CHUNK_SIZE) {
+    throw std::range_error("Invalid chunk size");
+  }
+  // Descriptors in the lower 1 MiB of desc_wb_buf, WB in the upper 1 MiB
+  uint64_t n_desc = size / chunk_size;
+  if (size % chunk_size || n_desc < 4 ||
+      n_desc > (1 << 20) / sizeof(xdma_desc)) {
+    throw std::range_error("Invalid history size for the chunk size");
+  }
+  this->nr_desc = n_desc;
+  this->chunk_size = chunk_size;
+  this->max_in_flight = (XDMA_MAX_DESC_CREDITS < n_desc / 2)
+                            ? XDMA_MAX_DESC_CREDITS
+                            : n_desc / 2;
+  for (uint64_t i = 0; i < size; i += 1UL << 30) {
+    this->data_buf.push_back(
+        make_unique<HugePageWrapper>(HugePageSizeType::HUGE_1GiB));
+  }
+  this->lengths.resize(n_desc);
+  this->status.resize(n_desc);
+  this->tscs.resize(n_desc);
+  this->engine = nullptr;
+  this->head = this->posted = 0;
+  this->limit = UINT64_MAX;
+}
+
+void XTriggerRing::initialize() {
+  XDMA_TRACE_SCOPE("XTriggerRing::initialize");
+  memset((void *)this->desc_wb_buf.getVAddr(), 0, this->desc_wb_buf.getLen());
+
+  struct xdma_desc *pdesc = (struct xdma_desc *)this->desc_wb_buf.getVAddr();
+  uint64_t desc_paddr = this->desc_wb_buf.getPAddr();
+  uint64_t wb_paddr = desc_paddr + this->desc_wb_buf.getLen() / 2;
+  uint32_t chunk_per_pg = (1UL << 30) / this->chunk_size;
+  const uint32_t desc_per_pg = 4096 / sizeof(xdma_desc);
+
+  // Same circular layout as XPacketRing, no stop bit anywhere
+  for (uint32_t i = 0; i < this->nr_desc; i++) {
+    uint32_t next = (i + 1) % this->nr_desc;
+    uint32_t block_end = next / desc_per_pg * desc_per_pg + desc_per_pg - 1;
+    block_end = (block_end > this->nr_desc - 1) ? this->nr_desc - 1 : block_end;
+    uint32_t nxt_adj = (block_end - next > 15) ? 15 : block_end - next;
+    uint64_t next_addr = desc_paddr + next * sizeof(xdma_desc);
+    uint64_t buff_addr = this->data_buf[i / chunk_per_pg]->getPAddr() +
+                         (uint64_t)(i % chunk_per_pg) * this->chunk_size;
+    uint64_t wb_addr = wb_paddr + i * sizeof(c2h_wb);
+
+    pdesc[i].control = __MASK_SHIFT__(16, 16, XDMA_DESC_MAGIC) |
+                       __MASK_SHIFT__(8, 6, nxt_adj);
+    pdesc[i].bytes = this->chunk_size;
+    pdesc[i].next_lo = next_addr;
+    pdesc[i].next_hi = next_addr >> 32;
+    pdesc[i].dst_addr_lo = buff_addr;
+    pdesc[i].dst_addr_hi = buff_addr >> 32;
+    pdesc[i].src_addr_lo = wb_addr;
+    pdesc[i].src_addr_hi = wb_addr >> 32;
+  }
+  this->head = this->posted = 0;
+  this->limit = UINT64_MAX;
+}
+
+void XTriggerRing::start(XDMAEngine &engine) {
+  if (engine.get_dir() != DIR_C2H || !engine.is_stream()) {
+    throw std::logic_error("Trigger ring needs a C2H stream engine");
+  }
+  this->engine = &engine;
+  engine.stop();
+  engine.set_credit_mode(true);
+  engine.start(this->desc_wb_buf.getPAddr());
+  this->post_credits();
+}
+
+void XTriggerRing::stop() {
+  if (!this->engine)
+    return;
+  this->engine->stop();
+  this->engine->set_credit_mode(false);
+  this->engine = nullptr;
+}
+
+void XTriggerRing::post_credits() {
+  uint64_t target = this->head + this->max_in_flight;
+  target = (target > this->limit) ? this->limit : target;
+  if (target <= this->posted || !this->engine)
+    return;
+  this->engine->add_credits(target - this->posted);
+  this->posted = target;
+}
+
+uint32_t XTriggerRing::poll() {
+  volatile c2h_wb *pwb =
+      (volatile c2h_wb *)((uintptr_t)this->desc_wb_buf.getVAddr() +
+                          this->desc_wb_buf.getLen() / 2);
+  uint64_t head_before = this->head, n_byte = 0;
+  uint64_t now = tsc_read();
+
+  while (this->head < this->posted) {
+    uint32_t slot = this->head % this->nr_desc;
+    uint32_t status = pwb[slot].status;
+    if ((status >> 16) != XDMA_C2H_WB_MAGIC)
+      break;
+    this->lengths[slot] = pwb[slot].length;
+    this->status[slot] = status;
+    this->tscs[slot] = now;
+    n_byte += this->lengths[slot];
+    pwb[slot].status = 0;
+    this->head++;
+  }
+  this->post_credits();
+  if (this->engine) {
+    xdma_chan_stats *st = this->engine->stats();
+    stat_add(st->polls, 1);
+    stat_add(st->desc_completed, this->head - head_before);
+    stat_add(st->bytes, n_byte);
+    stat_set(st->ring_occupancy, this->posted - this->head);
+  }
+  return this->head - head_before;
+}
+
+void XTriggerRing::hold(uint64_t seq) {
+  // The engine writing chunk seq + nr_desc would overwrite seq
+  this->limit = seq + this->nr_desc;
+}
+
+uint64_t XTriggerRing::getOldest() {
+  return (this->posted > this->nr_desc) ? this->posted - this->nr_desc : 0;
+}
+
+void *XTriggerRing::getChunk(uint64_t seq) {
+  uint32_t slot = seq % this->nr_desc;
+  uint32_t chunk_per_pg = (1UL << 30) / this->chunk_size;
+  return (void *)((uintptr_t)this->data_buf[slot / chunk_per_pg]->getVAddr() +
+                  (uint64_t)(slot % chunk_per_pg) * this->chunk_size);
+}
+
+trigger_fn trigger_on_register(XDMA &xdma, int bar_index, size_t offset,
+                               uint32_t mask, uint32_t value) {
+  if (offset + 4 > xdma.bar_len(bar_index)) {
+    throw std::range_error("Trigger register outside the BAR");
+  }
+  volatile uint32_t *reg =
+      (volatile uint32_t *)((uintptr_t)xdma.bar_vaddr(bar_index) + offset);
+  return [reg, mask, value](XTriggerRing &, uint64_t, uint64_t end,
+                            uint64_t &trigger) {
+    uint32_t v = *reg;
+    if (v == 0xFFFFFFFF || (v & mask) != value)
+      return false;
+    trigger = end;
+    return true;
+  };
+}
+
+trigger_fn trigger_on_user_irq(XDMA &xdma, uint32_t mask) {
+  // Only pending status is looked at, nothing has to wait on the vector
+  xdma.irq_user_enable(mask, true);
+  return [&xdma, mask](XTriggerRing &, uint64_t, uint64_t end,
+                       uint64_t &trigger) {
+    uint32_t v = xdma.irq_user_pending();
+    if (v == 0xFFFFFFFF || !(v & mask))
+      return false;
+    trigger = end;
+    return true;
+  };
+}
+
+trigger_fn trigger_on_match(const vector<uint8_t> &pattern) {
+  if (pattern.empty()) {
+    throw std::range_error("Empty trigger pattern");
+  }
+  return [pattern](XTriggerRing &ring, uint64_t first, uint64_t end,
+                   uint64_t &trigger) {
+    for (uint64_t seq = first; seq < end; seq++) {
+      if (memmem(ring.getChunk(seq), ring.getLength(seq), pattern.data(),
+                 pattern.size())) {
+        trigger = seq;
+        return true;
+      }
+    }
+    return false;
+  };
+}
+
+trigger_window trigger_capture(XTriggerRing &ring, XDMAEngine &engine,
+                               const trigger_fn &fn, uint64_t pre_bytes,
+                               uint64_t post_bytes, uint64_t timeout_ns) {
+  XDMA_TRACE_SCOPE("trigger_capture");
+  uint64_t chunk = ring.getChunkSize();
+  uint64_t pre = (pre_bytes + chunk - 1) / chunk;
+  uint64_t post = (post_bytes + chunk - 1) / chunk;
+  uint64_t timeout_tsc = timeout_ns * tsc_per_ns();
+  uint64_t check_tsc = 1000000 * tsc_per_ns();
+  trigger_window w = {0, 0, 0};
+  bool triggered = false;
+
+  if (post == 0 || pre + post > ring.getHistoryChunks()) {
+    throw std::range_error("Trigger window larger than the ring");
+  }
+  ring.initialize();
+  ring.start(engine);
+  uint64_t t_start = tsc_read(), t_last = t_start, t_checked = t_start;
+  try {
+    while (!triggered || ring.getHead() < w.end) {
+      uint64_t first = ring.getHead();
+      uint32_t n = ring.poll();
+      uint64_t now = tsc_read();
+      uint64_t trigger;
+
+      if (!triggered && fn(ring, first, first + n, trigger)) {
+        XDMA_TRACE_INSTANT("trigger");
+        triggered = true;
+        w.trigger = trigger;
+        w.first = (trigger > pre) ? trigger - pre : 0;
+        w.first = (w.first < ring.getOldest()) ? ring.getOldest() : w.first;
+        w.end = trigger + post;
+        ring.hold(w.first);
+      }
+      if (n) {
+        t_last = now;
+        continue;
+      }
+      if (now - t_checked > check_tsc) {
+        t_checked = now;
+        engine.check_status();
+      }
+      if (!timeout_tsc)
+        continue;
+      if (!triggered && now - t_start > timeout_tsc) {
+        throw system_error(error_code(-ETIMEDOUT, generic_category()),
+                           "no trigger");
+      }
+      // The stream went quiet after the trigger, keep what there is
+      if (triggered && now - t_last > timeout_tsc) {
+        w.end = ring.getHead();
+        break;
+      }
+    }
+  } catch (...) {
+    ring.stop();
+    throw;
+  }
+  ring.stop();
+  return w;
+}
+
+} // namespace XDMA_udrv
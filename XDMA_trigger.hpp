@@ -0,0 +1,106 @@
+#ifndef _XDMA_TRIGGER_HPP_
+#define _XDMA_TRIGGER_HPP_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "XDMA_udrv.hpp"
+
+namespace XDMA_udrv {
+
+/*
+C2H history ring for triggered capture.
+A circular chain of chunk_size descriptors over size bytes of 1 GiB pages.
+Unlike XPacketRing nothing waits for a consumer: poll() hands each
+completed slot straight back to the engine, so the ring always holds the
+most recent size bytes of the stream, minus what is in flight. hold() stops
+that at a chunk so the history from there on survives until it is saved.
+Chunks are addressed by a free running sequence number.
+*/
+class XTriggerRing {
+public:
+  XTriggerRing(uint64_t size, uint32_t chunk_size = 1 << 20);
+  void initialize();
+  void start(XDMAEngine &engine);
+  void stop();
+  // Collect completed chunks and re-credit their slots, returns # of new
+  // chunks
+  uint32_t poll();
+  // Never overwrite chunk seq or later
+  void hold(uint64_t seq);
+
+  // Chunks received so far, the next sequence number
+  uint64_t getHead() { return this->head; }
+  // Oldest chunk not yet overwritten (or being overwritten)
+  uint64_t getOldest();
+  void *getChunk(uint64_t seq);
+  uint32_t getLength(uint64_t seq) {
+    return this->lengths[seq % this->nr_desc];
+  }
+  uint32_t getStatus(uint64_t seq) {
+    return this->status[seq % this->nr_desc];
+  }
+  uint64_t getTsc(uint64_t seq) { return this->tscs[seq % this->nr_desc]; }
+  uint32_t getNrDesc() { return this->nr_desc; }
+  uint32_t getChunkSize() { return this->chunk_size; }
+  // Chunks of history the ring can hold, the rest is in flight
+  uint32_t getHistoryChunks() { return this->nr_desc - this->max_in_flight; }
+
+private:
+  void post_credits();
+
+  uint32_t nr_desc;
+  uint32_t chunk_size;
+  uint32_t max_in_flight;
+  HugePageWrapper desc_wb_buf;
+  std::vector<std::unique_ptr<HugePageWrapper>> data_buf;
+  XDMAEngine *engine;
+  // Writebacks are cleared for reuse, keep what they said
+  std::vector<uint32_t> lengths;
+  std::vector<uint32_t> status;
+  std::vector<uint64_t> tscs;
+  uint64_t head;
+  uint64_t posted;
+  uint64_t limit;
+};
+
+/*
+Trigger condition, called after every poll() with the new chunks
+[first, end). Returns true and the sequence number of the trigger chunk
+when it fires.
+*/
+using trigger_fn =
+    std::function<bool(XTriggerRing &, uint64_t first, uint64_t end,
+                       uint64_t &trigger)>;
+
+// (register & mask) == value in a user BAR, polled once per call
+trigger_fn trigger_on_register(XDMA &xdma, int bar_index, size_t offset,
+                               uint32_t mask, uint32_t value);
+// Any of the user interrupts in mask pending in the IRQ block
+trigger_fn trigger_on_user_irq(XDMA &xdma, uint32_t mask);
+// pattern inside a chunk, matches across chunk boundaries are missed
+trigger_fn trigger_on_match(const std::vector<uint8_t> &pattern);
+
+// Chunks to persist, [first, end), trigger is the first post-trigger one
+struct trigger_window {
+  uint64_t first;
+  uint64_t trigger;
+  uint64_t end;
+};
+
+/*
+Run the ring until fn fires, keep going for post_bytes, then stop the
+engine and return the window of at most pre_bytes before the trigger and
+post_bytes from it, all still in the ring. Throws system_error ETIMEDOUT
+if nothing triggers within timeout_ns (0 waits forever); after the trigger
+the same timeout without data cuts the window short.
+*/
+trigger_window trigger_capture(XTriggerRing &ring, XDMAEngine &engine,
+                               const trigger_fn &fn, uint64_t pre_bytes,
+                               uint64_t post_bytes, uint64_t timeout_ns = 0);
+
+} // namespace XDMA_udrv
+
+#endif
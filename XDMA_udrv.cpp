@@ -1,8 +1,11 @@
+#include <algorithm>
 #include <array>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <inttypes.h>
 #include <iostream>
 #include <regex>
 #include <stdexcept>
@@ -12,34 +15,249 @@
 #include <endian.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/mempolicy.h>
+#include <poll.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "XDMA_pio.hpp"
+#include "XDMA_trace.hpp"
 #include "XDMA_udrv.hpp"
 
 using namespace std;
 namespace fs = std::filesystem;
 
-namespace {} // namespace
+namespace {
+
+// Read a sysfs attribute into buf with trailing whitespace stripped
+ssize_t sysfs_read(const char *path, char *buf, size_t len) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  ssize_t rv = read(fd, buf, len - 1);
+  close(fd);
+  if (rv < 0)
+    return -1;
+  while (rv > 0 && (buf[rv - 1] == '\n' || buf[rv - 1] == ' '))
+    rv--;
+  buf[rv] = '\0';
+  return rv;
+}
+
+bool sysfs_read_u64(const char *path, uint64_t &value) {
+  char buf[32], *end;
+  if (sysfs_read(path, buf, sizeof(buf)) <= 0)
+    return false;
+  value = strtoull(buf, &end, 0);
+  return end != buf;
+}
+
+// "uio12" -> 12, -1 if name is not of the form <prefix><digits>
+int32_t parse_index(const char *name, const char *prefix) {
+  size_t plen = strlen(prefix);
+  char *end;
+  if (strncmp(name, prefix, plen) != 0 || name[plen] == '\0')
+    return -1;
+  long idx = strtol(name + plen, &end, 10);
+  return (*end == '\0') ? idx : -1;
+}
+
+bool uio_is_xdma(int32_t uio_index) {
+  char path[64], name[32];
+  snprintf(path, sizeof(path), UIO_SYS_PATH "uio%d/name", uio_index);
+  return sysfs_read(path, name, sizeof(name)) > 0 &&
+         strcmp(name, XDMA_UIO_NAME) == 0;
+}
+
+// Lowest numbered XDMA UIO, or uio_index itself if given and valid
+int32_t uio_find_xdma(int32_t uio_index) {
+  if (uio_index != -1) {
+    if (!uio_is_xdma(uio_index))
+      throw system_error(error_code(-EINVAL, generic_category()),
+                         "specified uio not found");
+    return uio_index;
+  }
+  DIR *dir = opendir(UIO_SYS_PATH);
+  if (!dir)
+    throw system_error(error_code(-ENOENT, generic_category()), "no xdma uio");
+  int32_t found = -1;
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != nullptr) {
+    int32_t idx = parse_index(ent->d_name, "uio");
+    if (idx < 0 || (found != -1 && idx > found))
+      continue;
+    if (uio_is_xdma(idx))
+      found = idx;
+  }
+  closedir(dir);
+  if (found == -1)
+    throw system_error(error_code(-ENOENT, generic_category()), "no xdma uio");
+  return found;
+}
+
+// UIO maps are numbered contiguously, stop at the first missing one
+vector<XDMA_udrv::uio_map_info> uio_read_maps(int32_t uio_index) {
+  vector<XDMA_udrv::uio_map_info> maps;
+  char path[96];
+  for (int32_t i = 0; i < PCIE_MAX_BARS; i++) {
+    XDMA_udrv::uio_map_info m;
+    int n = snprintf(path, sizeof(path), UIO_SYS_PATH "uio%d/maps/map%d/",
+                     uio_index, i);
+    m.map_id = i;
+    strcpy(path + n, "addr");
+    if (!sysfs_read_u64(path, m.addr))
+      break;
+    strcpy(path + n, "offset");
+    if (!sysfs_read_u64(path, m.offset))
+      m.offset = 0;
+    strcpy(path + n, "size");
+    if (!sysfs_read_u64(path, m.size))
+      throw system_error(error_code(-ENOENT, generic_category()),
+                         "missing one of the map attributes");
+    maps.push_back(m);
+  }
+  return maps;
+}
+
+/*
+Cache layout, one record per line:
+uio <index>
+map <id> <addr> <offset> <size>
+*/
+bool enum_cache_load(const char *cache_path, int32_t uio_index,
+                     int32_t &cached_index,
+                     vector<XDMA_udrv::uio_map_info> &maps) {
+  char buf[1024];
+  if (sysfs_read(cache_path, buf, sizeof(buf)) <= 0)
+    return false;
+  char *save, *line = strtok_r(buf, "\n", &save);
+  if (!line || sscanf(line, "uio %d", &cached_index) != 1)
+    return false;
+  if (uio_index != -1 && uio_index != cached_index)
+    return false;
+  maps.clear();
+  while ((line = strtok_r(nullptr, "\n", &save)) != nullptr) {
+    XDMA_udrv::uio_map_info m;
+    if (sscanf(line, "map %d %" SCNx64 " %" SCNx64 " %" SCNx64, &m.map_id,
+               &m.addr, &m.offset, &m.size) != 4 ||
+        m.map_id < 0 || m.map_id >= PCIE_MAX_BARS)
+      return false;
+    maps.push_back(m);
+  }
+  if (maps.empty() || !uio_is_xdma(cached_index))
+    return false;
+  // Cheap staleness check: BAR assignment may change across reboots/rescans
+  char path[64];
+  uint64_t addr;
+  snprintf(path, sizeof(path), UIO_SYS_PATH "uio%d/maps/map0/addr",
+           cached_index);
+  return sysfs_read_u64(path, addr) && addr == maps[0].addr;
+}
+
+void enum_cache_store(const char *cache_path, int32_t uio_index,
+                      const vector<XDMA_udrv::uio_map_info> &maps) {
+  char buf[1024];
+  int n = snprintf(buf, sizeof(buf), "uio %d\n", uio_index);
+  for (const auto &m : maps) {
+    n += snprintf(buf + n, sizeof(buf) - n,
+                  "map %d 0x%" PRIx64 " 0x%" PRIx64 " 0x%" PRIx64 "\n",
+                  m.map_id, m.addr, m.offset, m.size);
+  }
+  // Write then rename so concurrent starters never see a partial file
+  string tmp = string(cache_path) + ".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return;
+  bool ok = write(fd, buf, n) == n;
+  close(fd);
+  if (!ok || rename(tmp.c_str(), cache_path) != 0)
+    unlink(tmp.c_str());
+}
+
+// Match a map's physical address against device/resource to get the BAR index
+int32_t uio_map_to_resource(int32_t uio_index, uint64_t addr) {
+  char path[64], buf[1024];
+  snprintf(path, sizeof(path), UIO_SYS_PATH "uio%d/device/resource",
+           uio_index);
+  if (sysfs_read(path, buf, sizeof(buf)) <= 0)
+    return -1;
+  char *save, *line = strtok_r(buf, "\n", &save);
+  for (int32_t i = 0; line && i < PCIE_MAX_BARS;
+       i++, line = strtok_r(nullptr, "\n", &save)) {
+    uint64_t start = strtoull(line, nullptr, 16);
+    if (start == addr)
+      return i;
+  }
+  return -1;
+}
+
+// nxt_adj of descriptor i of n when the chain is fetched in blocks of
+// `block` adjacent descriptors. Power of two blocks never cross a 4 KiB page.
+uint32_t block_nxt_adj(uint32_t i, uint32_t n, uint32_t block) {
+  uint32_t start = i / block * block;
+  int32_t len = (n - start < block) ? n - start : block;
+  int32_t adj = len - 2 - (int32_t)(i - start);
+  return (adj < 0) ? 0 : adj;
+}
+
+bool is_pow2(uint64_t v) { return v && !(v & (v - 1)); }
+
+bool profile_valid(const XDMA_udrv::xdma_profile &p) {
+  using namespace XDMA_udrv;
+  return is_pow2(p.chunk_size) && p.chunk_size <= MEM_CHUNK_SIZE &&
+         p.chunk_size >= XDMA_MIN_PROFILE_CHUNK_SIZE && is_pow2(p.adj_block) &&
+         p.adj_block <= XDMA_MAX_ADJ_BLOCK;
+}
+
+} // namespace
 
 namespace XDMA_udrv {
 
-HugePageWrapper::HugePageWrapper(HugePageSizeType size) {
+HugePageWrapper::HugePageWrapper(HugePageSizeType size, bool shared,
+                                 int32_t numa_node) {
   int flag = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
-  if (size == HUGE_1GiB) {
-    flag |= (30 << MAP_HUGE_SHIFT);
-    this->length = 1 << 30;
-  } else {
-    flag |= (21 << MAP_HUGE_SHIFT);
-    this->length = 1 << 21;
-  }
+  int huge_shift = (size == HUGE_1GiB) ? 30 : 21;
+  flag |= (huge_shift << MAP_HUGE_SHIFT);
+  this->length = 1UL << huge_shift;
   this->size_type = size;
-  this->virt_addr =
-      mmap((void *)0x0UL, this->length, PROT_READ | PROT_WRITE, flag, -1, 0);
+  this->fd = -1;
+  if (shared) {
+    // MFD_HUGE_* shares the MAP_HUGE_* encoding
+    this->fd = memfd_create("xdma_udrv", MFD_CLOEXEC | MFD_HUGETLB |
+                                             (huge_shift << MAP_HUGE_SHIFT));
+    if (this->fd < 0) {
+      throw system_error(error_code(errno, generic_category()),
+                         "memfd_create()");
+    }
+    if (ftruncate(this->fd, this->length)) {
+      close(this->fd);
+      throw system_error(error_code(errno, generic_category()), "ftruncate()");
+    }
+    flag = MAP_SHARED;
+  }
+  this->virt_addr = mmap((void *)0x0UL, this->length, PROT_READ | PROT_WRITE,
+                         flag, this->fd, 0);
   if (this->virt_addr == (void *)-1) {
+    if (this->fd >= 0)
+      close(this->fd);
     throw system_error(error_code(errno, generic_category()), "mmap()");
   }
+  // Before the first touch. Preferred rather than bound: a node that ran
+  // dry falls back to another one instead of SIGBUS on the fault below.
+  if (numa_node >= 0 && numa_node < 64) {
+    unsigned long mask = 1UL << numa_node;
+    if (syscall(SYS_mbind, this->virt_addr, this->length, MPOL_PREFERRED,
+                &mask, 64, 0)) {
+      munmap(this->virt_addr, this->length);
+      if (this->fd >= 0)
+        close(this->fd);
+      throw system_error(error_code(errno, generic_category()), "mbind()");
+    }
+  }
   // Harmless write to enable allocated hugepage
   uint32_t temp;
   temp = *((uint32_t *)this->virt_addr);
@@ -75,6 +293,8 @@ HugePageWrapper::~HugePageWrapper() {
   if (this->virt_addr != (void *)-1) {
     munmap(this->virt_addr, this->length);
   }
+  if (this->fd >= 0)
+    close(this->fd);
 }
 
 BAR_wrapper::BAR_wrapper(uint64_t start, size_t len, off64_t offset) {
@@ -90,12 +310,32 @@ BAR_wrapper::BAR_wrapper(uint64_t start, size_t len, off64_t offset) {
   }
   close(mem_fd);
   this->len = len;
+  this->map_base = this->vaddr;
+  this->map_len = len;
+}
+
+BAR_wrapper::BAR_wrapper(const char *path, size_t len, off64_t map_offset,
+                         off64_t offset) {
+  int fd;
+  fd = open(path, O_RDWR | O_SYNC | O_CLOEXEC);
+  if (fd == -1) {
+    throw system_error(error_code(errno, generic_category()), path);
+  }
+  this->map_len = len + offset;
+  this->map_base = mmap((void *)0, this->map_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, map_offset);
+  close(fd);
+  if (this->map_base == (void *)-1) {
+    throw system_error(error_code(errno, generic_category()), "mmap()");
+  }
+  this->vaddr = (void *)((uintptr_t)this->map_base + offset);
+  this->len = len;
 }
 
 BAR_wrapper::~BAR_wrapper() {
-  if (vaddr) {
+  if (map_base) {
     int rv;
-    rv = munmap(vaddr, len);
+    rv = munmap(map_base, map_len);
     if (rv) {
       perror("munmap()");
     }
@@ -218,26 +458,100 @@ unique_ptr<XDMA> XDMA::XDMA_factory(int32_t uio_index) {
     num_of_bars++;
   }
   ret->num_of_bars = num_of_bars;
+  ret->identify_xdma_bar();
+  ret->load_profile();
+
+  return ret;
+}
+
+unique_ptr<XDMA> XDMA::XDMA_factory(const XDMA_factory_opt &opt) {
+  vector<uio_map_info> maps;
+  int32_t target_id = -1;
+
+  if (!opt.cache_path ||
+      !enum_cache_load(opt.cache_path, opt.uio_index, target_id, maps)) {
+    target_id = uio_find_xdma(opt.uio_index);
+    maps = uio_read_maps(target_id);
+    if (maps.empty()) {
+      throw system_error(error_code(-ENOENT, generic_category()),
+                         "xdma uio has no maps");
+    }
+    if (opt.cache_path)
+      enum_cache_store(opt.cache_path, target_id, maps);
+  }
+
+  unique_ptr<XDMA> ret = make_unique<XDMA>(target_id);
+  long pg_size = getpagesize();
+  char path[96];
+
+  for (const auto &m : maps) {
+    switch (opt.map_method) {
+    case BAR_MAP_DEVMEM:
+      ret->bars[m.map_id] =
+          make_unique<BAR_wrapper>(m.addr, (size_t)m.size, m.offset);
+      break;
+    case BAR_MAP_UIO:
+      snprintf(path, sizeof(path), UIO_DEV_PATH "uio%d", target_id);
+      ret->bars[m.map_id] = make_unique<BAR_wrapper>(
+          path, (size_t)m.size, m.map_id * pg_size, m.offset);
+      break;
+    case BAR_MAP_RESOURCE: {
+      int32_t res = uio_map_to_resource(target_id, m.addr);
+      if (res < 0) {
+        throw system_error(error_code(-ENOENT, generic_category()),
+                           "no PCI resource matches uio map");
+      }
+      snprintf(path, sizeof(path), UIO_SYS_PATH "uio%d/device/resource%d",
+               target_id, res);
+      ret->bars[m.map_id] =
+          make_unique<BAR_wrapper>(path, (size_t)m.size, 0, m.offset);
+      break;
+    }
+    }
+  }
+  ret->num_of_bars = maps.size();
+  ret->identify_xdma_bar();
+  ret->load_profile();
+
+  return ret;
+}
 
+vector<int32_t> XDMA::enumerate() {
+  vector<int32_t> found;
+  DIR *dir = opendir(UIO_SYS_PATH);
+  if (!dir)
+    return found;
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != nullptr) {
+    int32_t idx = parse_index(ent->d_name, "uio");
+    if (idx >= 0 && uio_is_xdma(idx))
+      found.push_back(idx);
+  }
+  closedir(dir);
+  sort(found.begin(), found.end());
+  return found;
+}
+
+void XDMA::identify_xdma_bar() {
   // Who the fxxk decided to place XDMA register randomly?
   // If only 1 BAR exists, XDMA register would reside in BAR0
   if (num_of_bars == 1) {
-    ret->xdma_bar_index = 0;
+    this->xdma_bar_index = 0;
   }
   // If there're 3 BARs, XDMA register would reside in BAR1
   else if (num_of_bars == 3) {
-    ret->xdma_bar_index = 1;
+    this->xdma_bar_index = 1;
   }
   // Chaos evil
   else if (num_of_bars == 2) {
     uint64_t bar0_len, bar1_len;
     uint32_t bar0_config, bar1_config;
-    bar0_config = *((uint32_t *)((uint64_t)ret->bars[0]->getVAddr() + 0x3000));
-    bar1_config = *((uint32_t *)((uint64_t)ret->bars[1]->getVAddr() + 0x3000));
+    bar0_config = *((uint32_t *)((uint64_t)this->bars[0]->getVAddr() + 0x3000));
+    bar1_config = *((uint32_t *)((uint64_t)this->bars[1]->getVAddr() + 0x3000));
     bar0_config &= 0xFFFF0000;
     bar1_config &= 0xFFFF0000;
-    bar0_len = ret->bars[0]->getLen();
-    bar1_len = ret->bars[1]->getLen();
+    bar0_len = this->bars[0]->getLen();
+    bar1_len = this->bars[1]->getLen();
 
     // The most tricky case
     if (bar0_len == bar1_len && bar0_len == XDMA_REGISTER_LEN) {
@@ -246,18 +560,18 @@ unique_ptr<XDMA> XDMA::XDMA_factory(int32_t uio_index) {
                            "Can't distinguish XDMA register");
       }
       if (bar0_config == XDMA_CONFIG_IDENTIFIER_MASKED)
-        ret->xdma_bar_index = 0;
+        this->xdma_bar_index = 0;
       else
-        ret->xdma_bar_index = 1;
+        this->xdma_bar_index = 1;
     } else if (bar0_len == XDMA_REGISTER_LEN) {
       if (bar0_config == XDMA_CONFIG_IDENTIFIER_MASKED)
-        ret->xdma_bar_index = 0;
+        this->xdma_bar_index = 0;
       else
         throw system_error(error_code(-EINVAL, generic_category()),
                            "Config identifier mismatched");
     } else if (bar1_len == XDMA_REGISTER_LEN) {
       if (bar1_config == XDMA_CONFIG_IDENTIFIER_MASKED)
-        ret->xdma_bar_index = 1;
+        this->xdma_bar_index = 1;
       else
         throw system_error(error_code(-EINVAL, generic_category()),
                            "Config identifier mismatched");
@@ -267,11 +581,10 @@ unique_ptr<XDMA> XDMA::XDMA_factory(int32_t uio_index) {
     }
   }
 
-  return ret;
 }
 
 void *XDMA::bar_vaddr(int bar_index) {
-  if (bar_index < 0 || bar_index > PCIE_MAX_BARS) {
+  if (bar_index < 0 || bar_index >= PCIE_MAX_BARS) {
     return nullptr;
   } else if (!this->bars[bar_index]) {
     return nullptr;
@@ -281,7 +594,7 @@ void *XDMA::bar_vaddr(int bar_index) {
 }
 
 size_t XDMA::bar_len(int bar_index) {
-  if (bar_index < 0 || bar_index > PCIE_MAX_BARS) {
+  if (bar_index < 0 || bar_index >= PCIE_MAX_BARS) {
     return 0;
   } else if (!this->bars[bar_index]) {
     return 0;
@@ -290,6 +603,263 @@ size_t XDMA::bar_len(int bar_index) {
   }
 }
 
+bool XDMA::map_bar_wc(int bar_index) {
+  if (bar_index < 0 || bar_index >= PCIE_MAX_BARS || !this->bars[bar_index] ||
+      bar_index == this->xdma_bar_index) {
+    return false;
+  }
+  if (this->bars_wc[bar_index])
+    return true;
+
+  vector<uio_map_info> maps = uio_read_maps(this->uio_index);
+  if (bar_index >= (int)maps.size())
+    return false;
+  int32_t res = uio_map_to_resource(this->uio_index, maps[bar_index].addr);
+  if (res < 0)
+    return false;
+
+  // resourceN_wc only exists for prefetchable BARs
+  char path[96];
+  snprintf(path, sizeof(path), UIO_SYS_PATH "uio%d/device/resource%d_wc",
+           this->uio_index, res);
+  try {
+    this->bars_wc[bar_index] = make_unique<BAR_wrapper>(
+        path, this->bars[bar_index]->getLen(), 0, maps[bar_index].offset);
+  } catch (system_error &e) {
+    return false;
+  }
+  return true;
+}
+
+void *XDMA::bar_vaddr_wc(int bar_index) {
+  if (bar_index < 0 || bar_index >= PCIE_MAX_BARS ||
+      !this->bars_wc[bar_index]) {
+    return nullptr;
+  }
+  return this->bars_wc[bar_index]->getVAddr();
+}
+
+void XDMA::pio_write(int bar_index, size_t offset, const void *src,
+                     size_t len) {
+  if (offset + len > this->bar_len(bar_index)) {
+    throw std::range_error("PIO write over BAR range");
+  }
+  // The copy routines move whole dwords and the streaming stores fault on
+  // a misaligned destination
+  if (offset % 4 || len % 4) {
+    throw std::range_error("PIO write not 4-byte aligned");
+  }
+  if (this->bar_vaddr_wc(bar_index)) {
+    pio_copy_wc((void *)((uintptr_t)this->bar_vaddr_wc(bar_index) + offset),
+                src, len);
+    pio_flush();
+  } else {
+    pio_copy_uc(
+        (volatile void *)((uintptr_t)this->bar_vaddr(bar_index) + offset), src,
+        len);
+  }
+}
+
+void XDMA::enable_stats() {
+  if (!this->stats)
+    this->stats = make_unique<XStats>(this->uio_index, true);
+}
+
+xdma_chan_stats *XDMA::chan_stats(int dir, uint32_t channel) {
+  return this->stats ? this->stats->chan(dir, channel) : nullptr;
+}
+
+XDMA::~XDMA() {
+  if (this->uio_fd >= 0)
+    close(this->uio_fd);
+}
+
+uint32_t XDMA::irq_channel_bit(int dir, uint32_t channel) {
+  if (channel >= 4) {
+    throw std::range_error("Invalid channel");
+  }
+  if (dir == DIR_H2C)
+    return channel;
+  // Engines are numbered from 0 without gaps, count the H2C ones once
+  if (this->num_h2c < 0) {
+    this->num_h2c = 0;
+    while (this->num_h2c < 4) {
+      uint32_t id = this->ctrl_reg_read(H2C_CHANNEL, this->num_h2c,
+                                        XDMA_CH_IDENTIFIER);
+      if ((id >> 20) != XDMA_CH_ID_SUBSYSTEM)
+        break;
+      this->num_h2c++;
+    }
+  }
+  return this->num_h2c + channel;
+}
+
+uint32_t XDMA::irq_channel_mask(int dir, uint32_t channel) {
+  return 1 << this->irq_channel_bit(dir, channel);
+}
+
+void XDMA::irq_channel_enable(int dir, uint32_t channel, bool enable) {
+  this->ctrl_reg_write(IRQ_BLOCK, 0,
+                       enable ? XDMA_IRQ_CHANNEL_EN_W1S
+                              : XDMA_IRQ_CHANNEL_EN_W1C,
+                       this->irq_channel_mask(dir, channel));
+}
+
+void XDMA::irq_channel_vector(int dir, uint32_t channel, uint32_t vector) {
+  if (vector > 0x1F) {
+    throw std::range_error("Invalid vector");
+  }
+  uint32_t bit = this->irq_channel_bit(dir, channel);
+  uint32_t reg = XDMA_IRQ_CHANNEL_VECTOR + (bit / 4) * 4;
+  uint32_t shift = (bit % 4) * 8;
+  uint32_t v = this->ctrl_reg_read(IRQ_BLOCK, 0, reg);
+  v &= ~(0x1F << shift);
+  v |= vector << shift;
+  this->ctrl_reg_write(IRQ_BLOCK, 0, reg, v);
+}
+
+uint32_t XDMA::irq_channel_pending() {
+  return this->ctrl_reg_read(IRQ_BLOCK, 0, XDMA_IRQ_CHANNEL_PENDING);
+}
+
+void XDMA::irq_user_enable(uint32_t mask, bool enable) {
+  this->ctrl_reg_write(IRQ_BLOCK, 0,
+                       enable ? XDMA_IRQ_USER_EN_W1S : XDMA_IRQ_USER_EN_W1C,
+                       mask);
+}
+
+uint32_t XDMA::irq_user_pending() {
+  return this->ctrl_reg_read(IRQ_BLOCK, 0, XDMA_IRQ_USER_PENDING);
+}
+
+uint32_t XDMA::irq_wait(int timeout_ms) {
+  char path[32];
+  int32_t one = 1;
+  uint32_t count;
+
+  if (this->uio_fd < 0) {
+    snprintf(path, sizeof(path), UIO_DEV_PATH "uio%d", this->uio_index);
+    this->uio_fd = open(path, O_RDWR | O_CLOEXEC);
+    if (this->uio_fd < 0) {
+      throw system_error(error_code(errno, generic_category()),
+                         "open() " + string(path));
+    }
+  }
+  // Drivers without irqcontrol keep the line enabled and reject this
+  (void)write(this->uio_fd, &one, sizeof(one));
+  struct pollfd pfd = {this->uio_fd, POLLIN, 0};
+  int rv = poll(&pfd, 1, timeout_ms);
+  if (rv < 0) {
+    throw system_error(error_code(errno, generic_category()), "poll()");
+  }
+  if (rv == 0)
+    return 0;
+  if (read(this->uio_fd, &count, sizeof(count)) != sizeof(count)) {
+    throw system_error(error_code(errno, generic_category()), "read()");
+  }
+  return count;
+}
+
+string XDMA::device_key() {
+  const char *attrs[] = {"vendor", "device", "current_link_width",
+                         "current_link_speed"};
+  string key;
+  char path[96], buf[64];
+
+  for (int i = 0; i < 4; i++) {
+    snprintf(path, sizeof(path), UIO_SYS_PATH "uio%d/device/%s",
+             this->uio_index, attrs[i]);
+    if (sysfs_read(path, buf, sizeof(buf)) <= 0)
+      strcpy(buf, "unknown");
+    char *v = buf;
+    if (strncmp(v, "0x", 2) == 0)
+      v += 2;
+    // "8.0 GT/s PCIe" -> "8.0GT"
+    char *sp = strchr(v, ' ');
+    if (sp)
+      strcpy(sp, "GT");
+    key += (i == 0) ? "" : ((i == 2) ? "_x" : "_");
+    key += v;
+  }
+  return key;
+}
+
+string XDMA::profile_path() {
+  const char *dir = getenv(XDMA_PROFILE_DIR_ENV);
+  string path = dir ? dir : XDMA_PROFILE_DIR;
+  if (!path.empty() && path.back() != '/')
+    path += '/';
+  return path + this->device_key() + ".profile";
+}
+
+/*
+Profile file, one "key value" per line:
+chunk_size 4194304
+adj_block 8
+completion 0
+adaptive 1
+mibps 3456.7
+*/
+bool XDMA::load_profile() {
+  char buf[512];
+  xdma_profile p;
+
+  if (sysfs_read(this->profile_path().c_str(), buf, sizeof(buf)) <= 0)
+    return false;
+  char *save, *line = strtok_r(buf, "\n", &save);
+  for (; line; line = strtok_r(nullptr, "\n", &save)) {
+    char key[32];
+    double value;
+    if (sscanf(line, "%31s %lf", key, &value) != 2)
+      return false;
+    if (strcmp(key, "chunk_size") == 0)
+      p.chunk_size = value;
+    else if (strcmp(key, "adj_block") == 0)
+      p.adj_block = value;
+    else if (strcmp(key, "completion") == 0)
+      p.completion = (value) ? CPL_WRITEBACK : CPL_COUNT;
+    else if (strcmp(key, "adaptive") == 0)
+      p.adaptive = value;
+    else if (strcmp(key, "mibps") == 0)
+      p.mibps = value;
+  }
+  // A bad file falls back to defaults rather than failing the open
+  if (!profile_valid(p)) {
+    return false;
+  }
+  this->profile = p;
+  return true;
+}
+
+bool XDMA::save_profile() {
+  // Same bounds load_profile() checks, rather than a file it would ignore
+  if (!profile_valid(this->profile)) {
+    errno = EINVAL;
+    return false;
+  }
+  string path = this->profile_path();
+  string tmp = path + ".tmp";
+  char buf[256];
+  int n = snprintf(buf, sizeof(buf),
+                   "chunk_size %u\nadj_block %u\ncompletion %d\nadaptive "
+                   "%d\nmibps %.1lf\n",
+                   this->profile.chunk_size, this->profile.adj_block,
+                   (int)this->profile.completion, (int)this->profile.adaptive,
+                   this->profile.mibps);
+
+  mkdir(path.substr(0, path.rfind('/')).c_str(), 0755);
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return false;
+  bool ok = write(fd, buf, n) == n;
+  close(fd);
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
 ostream &operator<<(ostream &os, const XDMA &xdma) {
   os << "XDMA: " << endl;
   os << "uio: uio" << xdma.uio_index << endl;
@@ -301,6 +871,7 @@ ostream &operator<<(ostream &os, const XDMA &xdma) {
 
 uint32_t XDMA::ctrl_reg_write(const uint32_t xdma_reg_addr,
                               const uint32_t data) {
+  XDMA_TRACE_SCOPE("ctrl_reg_write");
   *((volatile uint32_t *)((uint64_t)this->bar_vaddr(
                               this->get_xdma_bar_index()) +
                           (xdma_reg_addr & 0x0000FFFF))) = htole32(data);
@@ -320,6 +891,7 @@ uint32_t XDMA::ctrl_reg_write(const XDMA_ADDR_TARGET target,
 }
 
 uint32_t XDMA::ctrl_reg_read(const uint32_t xdma_reg_addr) {
+  XDMA_TRACE_SCOPE("ctrl_reg_read");
   return le32toh(*((volatile uint32_t *)((uint64_t)this->bar_vaddr(
                                              this->get_xdma_bar_index()) +
                                          (xdma_reg_addr & 0x0000FFFF))));
@@ -334,6 +906,216 @@ uint32_t XDMA::ctrl_reg_read(const XDMA_ADDR_TARGET target,
   return this->ctrl_reg_read(xdma_reg_addr);
 }
 
+void desc_irq_interval(xdma_desc *desc, uint32_t n_desc, uint32_t interval) {
+  if (interval == 0) {
+    throw std::range_error("Invalid interrupt interval");
+  }
+  for (uint32_t i = 0; i < n_desc; i++) {
+    desc[i].control &= ~XDMA_DESC_COMPLETED;
+    if ((i + 1) % interval == 0 || i == n_desc - 1)
+      desc[i].control |= XDMA_DESC_COMPLETED;
+  }
+}
+
+string xdma_status_str(uint32_t status) {
+  const char *flags[] = {"busy",          "descriptor_stopped",
+                         "descriptor_completed", "align_mismatch",
+                         "magic_stopped", "invalid_length",
+                         "idle_stopped"};
+  const char *fields[] = {"read_error", "write_error", "desc_error"};
+  const char *causes[] = {"UR", "CA", "parity", "EP", "unexpected"};
+  string str;
+
+  if (status == 0xFFFFFFFF)
+    return "device not responding";
+  for (int i = 0; i < 7; i++) {
+    if (status & (1 << i))
+      str += string(str.empty() ? "" : ", ") + flags[i];
+  }
+  for (int i = 0; i < 3; i++) {
+    uint32_t field = (status >> (9 + 5 * i)) & 0x1F;
+    if (!field)
+      continue;
+    str += string(str.empty() ? "" : ", ") + fields[i] + "(";
+    for (int j = 0, n = 0; j < 5; j++) {
+      if (field & (1 << j))
+        str += string(n++ ? "|" : "") + causes[j];
+    }
+    str += ")";
+  }
+  return str.empty() ? "idle" : str;
+}
+
+XDMAEngine::XDMAEngine(XDMA &xdma, XDMA_DIR dir, uint32_t channel)
+    : xdma(xdma), dir(dir), channel(channel) {
+  this->ch_target = (dir == DIR_H2C) ? H2C_CHANNEL : C2H_CHANNEL;
+  this->sgdma_target = (dir == DIR_H2C) ? H2C_SGDMA : C2H_SGDMA;
+  this->desc_mode = DESC_HOST_MEMORY;
+  this->byp_uc = nullptr;
+  this->byp_wc = nullptr;
+  this->st = xdma.chan_stats(dir, channel);
+  if (!this->st)
+    this->st = &this->local_st;
+  this->last_error = 0;
+
+  uint32_t id =
+      xdma.ctrl_reg_read(this->ch_target, channel, XDMA_CH_IDENTIFIER);
+  if ((id >> 20) != XDMA_CH_ID_SUBSYSTEM ||
+      ((id >> 16) & 0xF) != (uint32_t)this->ch_target) {
+    throw system_error(error_code(-ENODEV, generic_category()),
+                       "engine not present");
+  }
+  this->stream = id & XDMA_CH_ID_STREAM;
+}
+
+void XDMAEngine::start(uint64_t desc_paddr, uint32_t nxt_adj) {
+  this->stop();
+  this->clear_status();
+  this->desc_mode = DESC_HOST_MEMORY;
+  xdma.ctrl_reg_write(this->sgdma_target, this->channel, XDMA_SGDMA_DESC_LO,
+                      desc_paddr);
+  xdma.ctrl_reg_write(this->sgdma_target, this->channel, XDMA_SGDMA_DESC_HI,
+                      desc_paddr >> 32);
+  xdma.ctrl_reg_write(this->sgdma_target, this->channel, XDMA_SGDMA_DESC_ADJ,
+                      nxt_adj);
+  xdma.ctrl_reg_write(this->ch_target, this->channel, XDMA_CH_CONTROL_W1S,
+                      XDMA_CH_IE_DESC_COMPLETED | XDMA_CH_IE_ERRORS);
+  xdma.ctrl_reg_write(this->ch_target, this->channel, XDMA_CH_CONTROL_W1S,
+                      XDMA_CH_RUN);
+  this->st->active.store(1, memory_order_relaxed);
+}
+
+void XDMAEngine::set_bypass_window(int bar_index, size_t offset) {
+  if (bar_index == xdma.get_xdma_bar_index() ||
+      offset + sizeof(xdma_desc) > xdma.bar_len(bar_index)) {
+    throw std::range_error("Invalid descriptor bypass window");
+  }
+  this->byp_uc =
+      (volatile void *)((uintptr_t)xdma.bar_vaddr(bar_index) + offset);
+  // A WC mapping lets a descriptor go out as a single 32-byte TLP
+  if (xdma.map_bar_wc(bar_index))
+    this->byp_wc = (void *)((uintptr_t)xdma.bar_vaddr_wc(bar_index) + offset);
+  else
+    this->byp_wc = nullptr;
+}
+
+void XDMAEngine::start_bypass() {
+  if (!this->byp_uc) {
+    throw std::logic_error("Descriptor bypass window not set");
+  }
+  this->stop();
+  this->clear_status();
+  this->desc_mode = DESC_BYPASS;
+  xdma.ctrl_reg_write(this->ch_target, this->channel, XDMA_CH_CONTROL_W1S,
+                      XDMA_CH_IE_DESC_COMPLETED | XDMA_CH_IE_ERRORS);
+  xdma.ctrl_reg_write(this->ch_target, this->channel, XDMA_CH_CONTROL_W1S,
+                      XDMA_CH_RUN);
+  this->st->active.store(1, memory_order_relaxed);
+}
+
+void XDMAEngine::bypass_push(const xdma_desc &desc) {
+  this->bypass_push(&desc, 1);
+}
+
+void XDMAEngine::bypass_push(const xdma_desc *desc, size_t n) {
+  if (this->desc_mode != DESC_BYPASS) {
+    throw std::logic_error("Engine not started in bypass mode");
+  }
+  // Every descriptor goes to the same slot, order is kept by sfence (WC) or
+  // by UC store ordering
+  for (size_t i = 0; i < n; i++) {
+    if (this->byp_wc) {
+      pio_copy_wc(this->byp_wc, &desc[i], sizeof(xdma_desc));
+      pio_flush();
+    } else {
+      pio_copy_uc(this->byp_uc, &desc[i], sizeof(xdma_desc));
+    }
+  }
+}
+
+void XDMAEngine::set_credit_mode(bool enable) {
+  uint32_t bit = 1 << (this->channel + ((this->dir == DIR_C2H) ? 16 : 0));
+  xdma.ctrl_reg_write(SGDMA_COMMON, 0,
+                      enable ? XDMA_SGDMA_COMMON_CREDIT_MODE_W1S
+                             : XDMA_SGDMA_COMMON_CREDIT_MODE_W1C,
+                      bit);
+}
+
+void XDMAEngine::add_credits(uint32_t credits) {
+  xdma.ctrl_reg_write(this->sgdma_target, this->channel,
+                      XDMA_SGDMA_DESC_CREDITS, credits);
+}
+
+void XDMAEngine::stop() {
+  xdma.ctrl_reg_write(this->ch_target, this->channel, XDMA_CH_CONTROL_W1C,
+                      XDMA_CH_RUN);
+  this->st->active.store(0, memory_order_relaxed);
+}
+
+uint32_t XDMAEngine::status() {
+  return xdma.ctrl_reg_read(this->ch_target, this->channel, XDMA_CH_STATUS);
+}
+
+uint32_t XDMAEngine::clear_status() {
+  return xdma.ctrl_reg_read(this->ch_target, this->channel,
+                            XDMA_CH_STATUS_RC);
+}
+
+uint32_t XDMAEngine::completed_count() {
+  return xdma.ctrl_reg_read(this->ch_target, this->channel,
+                            XDMA_CH_COMPLETED_DESC);
+}
+
+void XDMAEngine::irq_enable(uint32_t ie_bits) {
+  xdma.ctrl_reg_write(this->ch_target, this->channel, XDMA_CH_CONTROL_W1S,
+                      ie_bits);
+  xdma.irq_channel_enable(this->dir, this->channel, true);
+}
+
+void XDMAEngine::irq_disable() {
+  xdma.irq_channel_enable(this->dir, this->channel, false);
+}
+
+uint32_t XDMAEngine::check_status() {
+  uint32_t status = this->status();
+  bool gone = (status == 0xFFFFFFFF);
+
+  if (!gone && !(status & XDMA_CH_ERROR_MASK))
+    return status;
+  this->last_error = gone ? status : (status & XDMA_CH_ERROR_MASK);
+  stat_add(this->st->errors, 1);
+  XDMA_TRACE_INSTANT("engine_error");
+  throw system_error(error_code(gone ? -ENODEV : -EIO, generic_category()),
+                     string((this->dir == DIR_H2C) ? "H2C" : "C2H") +
+                         to_string(this->channel) + ": " +
+                         xdma_status_str(status));
+}
+
+void XDMAEngine::reset(uint64_t timeout_ns) {
+  struct timespec tstart, tnow;
+  XDMA_TRACE_SCOPE("XDMAEngine::reset");
+
+  // There is no per-channel reset, clearing run aborts the chain once the
+  // outstanding requests drain
+  this->stop();
+  xdma.ctrl_reg_write(this->ch_target, this->channel, XDMA_CH_CONTROL_W1C,
+                      XDMA_CH_IE_DESC_COMPLETED | XDMA_CH_IE_ERRORS);
+  clock_gettime(CLOCK_MONOTONIC, &tstart);
+  while (1) {
+    uint32_t status = this->status();
+    if (status != 0xFFFFFFFF && !(status & XDMA_CH_BUSY))
+      break;
+    clock_gettime(CLOCK_MONOTONIC, &tnow);
+    if ((tnow.tv_sec - tstart.tv_sec) * 1000000000ULL + tnow.tv_nsec -
+            tstart.tv_nsec >
+        timeout_ns) {
+      throw system_error(error_code(-ETIMEDOUT, generic_category()),
+                         "engine stuck busy");
+    }
+  }
+  this->clear_status();
+}
+
 /*
 Not sure if this is a good way.
 Encapsulate descriptor and huge page buffer related resources and methods in
@@ -348,33 +1130,37 @@ XHugeBuffer::XHugeBuffer()
   memset((void *)this->desc_buf.getVAddr(), 0, this->desc_buf.getLen());
 }
 
-// Preliminary. Chunk size should be configurable?
-void XHugeBuffer::initialize(size_t xfer_size) {
+void XHugeBuffer::initialize(size_t xfer_size, uint32_t chunk_size) {
+  XDMA_TRACE_SCOPE("XHugeBuffer::initialize");
   if (xfer_size > this->data_buf.getLen()) {
     throw std::range_error("Request size over range");
   }
+  if (!is_pow2(chunk_size) || chunk_size > MEM_CHUNK_SIZE ||
+      chunk_size < XDMA_MIN_CHUNK_SIZE) {
+    throw std::range_error("Invalid chunk size");
+  }
+  uint32_t n_desc =
+      xfer_size / chunk_size + ((xfer_size % chunk_size) ? (1) : (0));
+  if (n_desc > (1 << 20) / sizeof(xdma_desc)) {
+    throw std::range_error("Too many descriptors for the chunk size");
+  }
   // Clear descriptor buffer
   memset((void *)this->desc_buf.getVAddr(), 0, this->desc_buf.getLen());
 
-  uint32_t n_desc =
-      xfer_size / MEM_CHUNK_SIZE + ((xfer_size % MEM_CHUNK_SIZE) ? (1) : (0));
-  uint32_t last_block_idx = xfer_size / MEM_CHUNK_SIZE - 1;
+  uint32_t last_block_idx = n_desc - 1;
 
   // Store # of desc for later use
   this->n_desc = n_desc;
 
   // Fill in descriptors
-  // !!! Skipped max adjacent descriptors constraint (16) !!!
-  // Since 1 GiB buffer and 128 MiB chunk is used here, there will be no more
-  // than 8 descriptors
+  // Adjacent descriptors are fetched in blocks of at most 16
   struct xdma_desc *pdesc = (struct xdma_desc *)this->desc_buf.getVAddr();
   // Magic, next_adj and length
   // !!! Endianess is not handled since we're on x86 !!!
-  for (uint32_t i = 0, nxt_adj = n_desc - 2; i < n_desc; i++, nxt_adj--) {
-    nxt_adj = (nxt_adj < 0) ? 0 : nxt_adj;
+  for (uint32_t i = 0; i < n_desc; i++) {
     pdesc[i].control |= __MASK_SHIFT__(16, 16, XDMA_DESC_MAGIC);
-    pdesc[i].control |= __MASK_SHIFT__(8, 6, nxt_adj);
-    pdesc[i].bytes = MEM_CHUNK_SIZE;
+    pdesc[i].control |= __MASK_SHIFT__(8, 6, block_nxt_adj(i, n_desc, 16));
+    pdesc[i].bytes = chunk_size;
   }
   // Set stop and completed flag at the last descriptor
   pdesc[last_block_idx].control |= __MASK_SHIFT__(0, 1, 1);
@@ -387,7 +1173,8 @@ void XHugeBuffer::initialize(size_t xfer_size) {
   }
   // Set buffer address and WB address
   for (uint32_t i = 0; i < n_desc; i++) {
-    uint64_t buff_addr = this->data_buf.getPAddr() + i * MEM_CHUNK_SIZE;
+    uint64_t buff_addr =
+        this->data_buf.getPAddr() + (uint64_t)i * chunk_size;
     uint64_t wb_addr = this->desc_buf.getPAddr() + this->desc_buf.getLen() / 2 +
                        i * sizeof(c2h_wb);
     pdesc[i].dst_addr_lo = buff_addr;
@@ -407,11 +1194,28 @@ uint64_t XHugeBuffer::getXferedSize() {
   return xfered_size;
 }
 
-XSGBuffer::XSGBuffer(const uint64_t size)
-    : desc_wb_buf(HugePageSizeType::HUGE_2MiB) {
-  uint32_t nr_1gibp;
+XSGBuffer::XSGBuffer(const uint64_t size, uint32_t chunk_size,
+                     uint32_t adj_block, HugePageSizeType page_type,
+                     int32_t numa_node)
+    : desc_wb_buf(HugePageSizeType::HUGE_2MiB, false, numa_node) {
+  uint32_t nr_pg;
 
   this->size = size;
+  this->chunk_size = chunk_size;
+  this->adj_block = adj_block;
+  this->page_len = (page_type == HUGE_1GiB) ? (1UL << 30) : (1UL << 21);
+
+  // Chunks must tile data pages and adjacent blocks 4 KiB of descriptors
+  if (!is_pow2(chunk_size) || chunk_size > MEM_CHUNK_SIZE ||
+      chunk_size > this->page_len || chunk_size < XDMA_MIN_CHUNK_SIZE) {
+    throw std::range_error("Invalid chunk size");
+  }
+  if (!is_pow2(adj_block) || adj_block > XDMA_MAX_ADJ_BLOCK) {
+    throw std::range_error("Invalid adjacent block size");
+  }
+  if (size / chunk_size > (1 << 20) / sizeof(xdma_desc)) {
+    throw std::range_error("Too many descriptors for the chunk size");
+  }
 
   // Currently descriptor buffer size is 1MiB (share 2 MiB hugepage with C2H WB)
   // 1 MiB / sizeof(desc) = 32768
@@ -422,16 +1226,19 @@ XSGBuffer::XSGBuffer(const uint64_t size)
     throw std::runtime_error("Can't receive more than 3 GiB (soft constraint)");
   }
 
-  nr_1gibp = size / (1UL << 30) + (size % (1UL << 30) ? 1 : 0);
-  for (uint32_t i = 0; i < nr_1gibp; i++) {
+  nr_pg = size / this->page_len + (size % this->page_len ? 1 : 0);
+  for (uint32_t i = 0; i < nr_pg; i++) {
     this->data_buf.push_back(
-        make_unique<HugePageWrapper>(HugePageSizeType::HUGE_1GiB));
+        make_unique<HugePageWrapper>(page_type, false, numa_node));
   }
 }
 
 XSGBuffer::XSGBuffer(const vector<uint64_t> &size)
     : desc_wb_buf(HugePageSizeType::HUGE_2MiB) {
   int n_blocks = 0, nr_1gibp;
+  this->chunk_size = MEM_CHUNK_SIZE;
+  this->adj_block = 8;
+  this->page_len = 1UL << 30;
   for (auto s : size) {
     n_blocks += s / MEM_CHUNK_SIZE + ((s % MEM_CHUNK_SIZE) ? 1 : 0);
     this->n_desc.push_back(s / MEM_CHUNK_SIZE + ((s % MEM_CHUNK_SIZE) ? 1 : 0));
@@ -444,42 +1251,31 @@ XSGBuffer::XSGBuffer(const vector<uint64_t> &size)
     this->data_buf.push_back(
         make_unique<HugePageWrapper>(HugePageSizeType::HUGE_1GiB));
   }
+  this->size = (uint64_t)n_blocks * MEM_CHUNK_SIZE;
 }
 
 void XSGBuffer::initialize() {
+  XDMA_TRACE_SCOPE("XSGBuffer::initialize");
   uint32_t nr_desc;
+  uint32_t chunk_per_pg = this->page_len / this->chunk_size;
 
   // # of chunks = # of descriptors
-  nr_desc = this->size / MEM_CHUNK_SIZE + (this->size % MEM_CHUNK_SIZE ? 1 : 0);
+  nr_desc = this->size / this->chunk_size +
+            (this->size % this->chunk_size ? 1 : 0);
   this->nr_desc = nr_desc;
 
+  // Start clean, initialize() may be called again with the same buffer
+  memset((void *)this->desc_wb_buf.getVAddr(), 0,
+         this->desc_wb_buf.getLen());
   struct xdma_desc *pdesc = (struct xdma_desc *)this->desc_wb_buf.getVAddr();
 
-  // Magic and length
+  // Magic, length and nxt_adj
   // !!! Endianess is not handled since we're on x86 !!!
   for (uint32_t i = 0; i < nr_desc; i++) {
     pdesc[i].control |= __MASK_SHIFT__(16, 16, XDMA_DESC_MAGIC);
-    pdesc[i].bytes = MEM_CHUNK_SIZE;
-  }
-
-  // nxt_adj
-  // use 8 desc/block <=> 1GiB/block
-  // full block
-  for (uint32_t full_1gib = 0; full_1gib < nr_desc / 8; full_1gib++) {
-    for (int i = 0; i < 8; i++) {
-      pdesc[8 * full_1gib + i].control |=
-          __MASK_SHIFT__(8, 6, ((6 - i) < 0) ? 0 : (6 - i));
-    }
-  }
-  // residual
-  if (nr_desc % 8) {
-    for (int i = 0; i < nr_desc % 8; i++) {
-      pdesc[8 * (nr_desc / 8) + i].control |=
-          __MASK_SHIFT__(8, 6,
-                         (((int32_t)nr_desc % 8 - 2 - i) < 0)
-                             ? 0
-                             : ((int32_t)nr_desc % 8 - 2 - i));
-    }
+    pdesc[i].control |=
+        __MASK_SHIFT__(8, 6, block_nxt_adj(i, nr_desc, this->adj_block));
+    pdesc[i].bytes = this->chunk_size;
   }
 
   // Set stop and completed flag at the last descriptor
@@ -495,8 +1291,8 @@ void XSGBuffer::initialize() {
 
   // Set buffer address and WB address
   for (uint32_t i = 0; i < nr_desc; i++) {
-    uint64_t buff_addr =
-        this->data_buf[i / 8]->getPAddr() + (i % 8) * MEM_CHUNK_SIZE;
+    uint64_t buff_addr = this->data_buf[i / chunk_per_pg]->getPAddr() +
+                         (uint64_t)(i % chunk_per_pg) * this->chunk_size;
     uint64_t wb_addr = this->desc_wb_buf.getPAddr() +
                        this->desc_wb_buf.getLen() / 2 + i * sizeof(c2h_wb);
     pdesc[i].dst_addr_lo = buff_addr;
@@ -518,6 +1314,11 @@ uint64_t XSGBuffer::getDataBufferPaddr(uint32_t index) {
   return this->data_buf[index]->getPAddr();
 }
 
+void XSGBuffer::setIrqInterval(uint32_t interval) {
+  desc_irq_interval((xdma_desc *)this->desc_wb_buf.getVAddr(), this->nr_desc,
+                    interval);
+}
+
 uint64_t XSGBuffer::getXferedSize() {
   c2h_wb *pwb = (c2h_wb *)((uintptr_t)this->desc_wb_buf.getVAddr() +
                            this->desc_wb_buf.getLen() / 2);
@@ -528,4 +1329,196 @@ uint64_t XSGBuffer::getXferedSize() {
   return xfered_size;
 }
 
+sg_chunk XSGBuffer::getChunk(uint32_t idx) {
+  if (idx >= this->nr_desc) {
+    throw std::range_error("Chunk index out of range");
+  }
+  uint32_t chunk_per_pg = this->page_len / this->chunk_size;
+  volatile c2h_wb *wb = this->getWBVaddr() + idx;
+  uint32_t status = wb->status;
+  sg_chunk c;
+  c.idx = idx;
+  c.data = (uint8_t *)this->data_buf[idx / chunk_per_pg]->getVAddr() +
+           (uint64_t)(idx % chunk_per_pg) * this->chunk_size;
+  c.status = status;
+  c.length = ((status >> 16) == XDMA_C2H_WB_MAGIC) ? wb->length
+                                                    : this->chunk_size;
+  c.tsc = 0;
+  return c;
+}
+
+XPacketRing::XPacketRing(uint32_t n_desc, uint32_t desc_size)
+    : desc_wb_buf(HugePageSizeType::HUGE_2MiB) {
+  uint64_t total = (uint64_t)n_desc * desc_size;
+
+  // Descriptors in the lower 1 MiB of desc_wb_buf, WB in the upper 1 MiB
+  if (n_desc < 2 || n_desc > (1 << 20) / sizeof(xdma_desc)) {
+    throw std::range_error("Invalid number of packet descriptors");
+  }
+  if (desc_size == 0 || desc_size % 64 || desc_size >= (1 << 28)) {
+    throw std::range_error("Invalid packet descriptor size");
+  }
+  // One hugepage keeps consecutive descriptors physically contiguous
+  if (total > (1UL << 30)) {
+    throw std::range_error("Packet ring over 1 GiB");
+  }
+  this->data_buf = make_unique<HugePageWrapper>(
+      (total > (1 << 21)) ? HUGE_1GiB : HUGE_2MiB);
+  this->nr_desc = n_desc;
+  this->desc_size = desc_size;
+  this->engine = nullptr;
+  this->head = this->released = this->posted = 0;
+}
+
+void XPacketRing::initialize() {
+  XDMA_TRACE_SCOPE("XPacketRing::initialize");
+  memset((void *)this->desc_wb_buf.getVAddr(), 0, this->desc_wb_buf.getLen());
+
+  struct xdma_desc *pdesc = (struct xdma_desc *)this->desc_wb_buf.getVAddr();
+  uint64_t desc_paddr = this->desc_wb_buf.getPAddr();
+  uint64_t wb_paddr = desc_paddr + this->desc_wb_buf.getLen() / 2;
+  // 4 KiB of descriptors per adjacent block
+  const uint32_t desc_per_pg = 4096 / sizeof(xdma_desc);
+
+  // No stop bit anywhere, the last descriptor links back to the first and
+  // credits keep the engine from running over unreleased buffers
+  for (uint32_t i = 0; i < this->nr_desc; i++) {
+    uint32_t next = (i + 1) % this->nr_desc;
+    uint32_t block_end = next / desc_per_pg * desc_per_pg + desc_per_pg - 1;
+    block_end = (block_end > this->nr_desc - 1) ? this->nr_desc - 1 : block_end;
+    uint32_t nxt_adj = (block_end - next > 15) ? 15 : block_end - next;
+    uint64_t next_addr = desc_paddr + next * sizeof(xdma_desc);
+    uint64_t buff_addr = this->data_buf->getPAddr() + (uint64_t)i * desc_size;
+    uint64_t wb_addr = wb_paddr + i * sizeof(c2h_wb);
+
+    pdesc[i].control = __MASK_SHIFT__(16, 16, XDMA_DESC_MAGIC) |
+                       __MASK_SHIFT__(8, 6, nxt_adj);
+    pdesc[i].bytes = this->desc_size;
+    pdesc[i].next_lo = next_addr;
+    pdesc[i].next_hi = next_addr >> 32;
+    pdesc[i].dst_addr_lo = buff_addr;
+    pdesc[i].dst_addr_hi = buff_addr >> 32;
+    pdesc[i].src_addr_lo = wb_addr;
+    pdesc[i].src_addr_hi = wb_addr >> 32;
+  }
+  this->head = this->released = this->posted = 0;
+}
+
+void XPacketRing::start(XDMAEngine &engine) {
+  if (engine.get_dir() != DIR_C2H || !engine.is_stream()) {
+    throw std::logic_error("Packet ring needs a C2H stream engine");
+  }
+  this->engine = &engine;
+  engine.stop();
+  engine.set_credit_mode(true);
+  // Start with no credits so the chain address is latched first
+  engine.start(this->desc_wb_buf.getPAddr());
+  this->post_credits();
+}
+
+void XPacketRing::stop() {
+  if (!this->engine)
+    return;
+  this->engine->stop();
+  this->engine->set_credit_mode(false);
+  this->engine = nullptr;
+}
+
+void XPacketRing::post_credits() {
+  uint64_t room = this->released + this->nr_desc - this->posted;
+  uint64_t in_flight = this->posted - this->head;
+  uint64_t credits = XDMA_MAX_DESC_CREDITS - in_flight;
+  credits = (room < credits) ? room : credits;
+  if (credits == 0 || !this->engine)
+    return;
+  this->engine->add_credits(credits);
+  this->posted += credits;
+}
+
+size_t XPacketRing::recv(c2h_packet *pkts, size_t max) {
+  volatile c2h_wb *pwb =
+      (volatile c2h_wb *)((uintptr_t)this->desc_wb_buf.getVAddr() +
+                          this->desc_wb_buf.getLen() / 2);
+  uint8_t *data = (uint8_t *)this->data_buf->getVAddr();
+  uint64_t head_before = this->head, n_byte = 0;
+  size_t n_pkt = 0;
+
+  while (n_pkt < max) {
+    uint64_t idx = this->head;
+    uint32_t length = 0;
+    bool eop = false;
+
+    // Walk descriptors of one packet, commit only once it is complete
+    while (idx < this->posted) {
+      uint32_t slot = idx % this->nr_desc;
+      uint32_t status = pwb[slot].status;
+      if ((status >> 16) != XDMA_C2H_WB_MAGIC)
+        break;
+      length += pwb[slot].length;
+      idx++;
+      if (status & XDMA_C2H_WB_EOP) {
+        eop = true;
+        break;
+      }
+      // Wrapping ring, hand out what we have as a fragment
+      if (idx % this->nr_desc == 0)
+        break;
+    }
+    // Every credited descriptor filled without EOP: the engine waits for
+    // credits that only come once this part is handed out and released
+    bool starved = (idx == this->posted);
+    if (idx == this->head ||
+        (!eop && idx % this->nr_desc != 0 && !starved))
+      break;
+
+    pkts[n_pkt].data = data + (this->head % this->nr_desc) * this->desc_size;
+    pkts[n_pkt].length = length;
+    pkts[n_pkt].eop = eop;
+    n_byte += length;
+    n_pkt++;
+    for (; this->head < idx; this->head++)
+      pwb[this->head % this->nr_desc].status = 0;
+  }
+  if (this->engine) {
+    xdma_chan_stats *st = this->engine->stats();
+    stat_add(st->polls, 1);
+    stat_add(st->desc_completed, this->head - head_before);
+    stat_add(st->bytes, n_byte);
+    stat_set(st->ring_occupancy, this->posted - this->released);
+  }
+  if (n_pkt)
+    XDMA_TRACE_INSTANT("packets_received");
+  return n_pkt;
+}
+
+void XPacketRing::release() {
+  this->released = this->head;
+  this->post_credits();
+}
+
+uint64_t XPacketRing::recover() {
+  if (!this->engine) {
+    throw std::logic_error("Packet ring not started");
+  }
+  volatile c2h_wb *pwb =
+      (volatile c2h_wb *)((uintptr_t)this->desc_wb_buf.getVAddr() +
+                          this->desc_wb_buf.getLen() / 2);
+  uint64_t dropped = 0;
+
+  this->engine->reset();
+  // Descriptors of a packet cut short have writebacks but no EOP, and credited
+  // ones may be half filled, none of them are handed out
+  for (uint64_t idx = this->head; idx < this->posted; idx++) {
+    uint32_t slot = idx % this->nr_desc;
+    dropped += ((pwb[slot].status >> 16) == XDMA_C2H_WB_MAGIC) ? 1 : 0;
+    pwb[slot].status = 0;
+  }
+  // Credits don't survive the restart, the ring is unchanged otherwise
+  this->posted = this->head;
+  this->engine->start(this->desc_wb_buf.getPAddr() +
+                      (this->head % this->nr_desc) * sizeof(xdma_desc));
+  this->post_credits();
+  return dropped;
+}
+
 } // namespace XDMA_udrv
\ No newline at end of file
@@ -1,16 +1,24 @@
 #ifndef _XDMA_UDRV_HPP_
 #define _XDMA_UDRV_HPP_
 
+#include <array>
 #include <cstdint>
 #include <cstdlib>
 #include <memory>
+#include <ostream>
 #include <vector>
 
+#include "XDMA_stats.hpp"
+
 #define PCIE_MAX_BARS 6
 
 #define UIO_SYS_PATH "/sys/class/uio/"
+#define UIO_DEV_PATH "/dev/"
 
 #define XDMA_UIO_NAME "xdma_uio"
+#define XDMA_PROFILE_DIR "/var/lib/xdma_udrv/"
+#define XDMA_PROFILE_DIR_ENV "XDMA_UDRV_PROFILE_DIR"
+
 #define XDMA_REGISTER_LEN 65536
 #define XDMA_CONFIG_IDENTIFIER_MASKED 0x1FC30000
 
@@ -25,6 +33,13 @@ const uint32_t MEM_CHUNK_SIZE = 1UL << 27;
 const uint64_t XSGB_MAX_SIZE = 3 * (1UL << 30);
 // Max Chunks
 const uint64_t XSGB_MAX_N_CHUNK = XSGB_MAX_SIZE / MEM_CHUNK_SIZE;
+// Smallest chunk size
+const uint32_t XDMA_MIN_CHUNK_SIZE = 1UL << 12;
+// Smallest chunk size a profile may pick, 32768 descriptors still cover a
+// 1 GiB page
+const uint32_t XDMA_MIN_PROFILE_CHUNK_SIZE = 1UL << 15;
+// Engine fetches at most 16 adjacent descriptors
+const uint32_t XDMA_MAX_ADJ_BLOCK = 16;
 
 #define __GET_MASK__(_len) ((1 << _len) - 1)
 #define __GET_SHIFTED_MASK__(_offset, _len) (__GET_MASK__(_len) << _offset)
@@ -34,18 +49,110 @@ const uint64_t XSGB_MAX_N_CHUNK = XSGB_MAX_SIZE / MEM_CHUNK_SIZE;
 // XDMA register constants
 #define XDMA_DESC_MAGIC 0xAD4B
 
+// Descriptor control bits
+#define XDMA_DESC_STOP (1 << 0)
+#define XDMA_DESC_COMPLETED (1 << 1)
+#define XDMA_DESC_EOP (1 << 4)
+
+// H2C_CHANNEL/C2H_CHANNEL register offsets
+#define XDMA_CH_IDENTIFIER 0x00
+#define XDMA_CH_CONTROL 0x04
+#define XDMA_CH_CONTROL_W1S 0x08
+#define XDMA_CH_CONTROL_W1C 0x0C
+#define XDMA_CH_STATUS 0x40
+#define XDMA_CH_STATUS_RC 0x44
+#define XDMA_CH_COMPLETED_DESC 0x48
+
+// Channel identifier
+#define XDMA_CH_ID_SUBSYSTEM 0x1FC
+#define XDMA_CH_ID_STREAM (1 << 15)
+
+// Channel control/status bits
+#define XDMA_CH_RUN (1 << 0)
+#define XDMA_CH_IE_DESC_STOPPED (1 << 1)
+#define XDMA_CH_IE_DESC_COMPLETED (1 << 2)
+#define XDMA_CH_IE_IDLE_STOPPED (1 << 6)
+#define XDMA_CH_IE_ALIGN_MISMATCH (1 << 3)
+#define XDMA_CH_IE_MAGIC_STOPPED (1 << 4)
+#define XDMA_CH_IE_INVALID_LENGTH (1 << 5)
+#define XDMA_CH_IE_READ_ERROR (0x1F << 9)
+#define XDMA_CH_IE_WRITE_ERROR (0x1F << 14)
+#define XDMA_CH_IE_DESC_ERROR (0x1F << 19)
+#define XDMA_CH_IE_ERRORS                                                      \
+  (XDMA_CH_IE_ALIGN_MISMATCH | XDMA_CH_IE_MAGIC_STOPPED |                      \
+   XDMA_CH_IE_INVALID_LENGTH | XDMA_CH_IE_READ_ERROR |                         \
+   XDMA_CH_IE_WRITE_ERROR | XDMA_CH_IE_DESC_ERROR)
+#define XDMA_CH_BUSY (1 << 0)
+#define XDMA_CH_DESC_STOPPED (1 << 1)
+#define XDMA_CH_DESC_COMPLETED (1 << 2)
+#define XDMA_CH_ALIGN_MISMATCH (1 << 3)
+#define XDMA_CH_MAGIC_STOPPED (1 << 4)
+#define XDMA_CH_INVALID_LENGTH (1 << 5)
+#define XDMA_CH_IDLE_STOPPED (1 << 6)
+// 5-bit fields, bit 0 UR, 1 CA, 2 parity, 3 header EP, 4 unexpected cpl
+#define XDMA_CH_READ_ERROR (0x1F << 9)
+#define XDMA_CH_WRITE_ERROR (0x1F << 14)
+#define XDMA_CH_DESC_ERROR (0x1F << 19)
+#define XDMA_CH_ERROR_MASK                                                     \
+  (XDMA_CH_ALIGN_MISMATCH | XDMA_CH_MAGIC_STOPPED | XDMA_CH_INVALID_LENGTH |   \
+   XDMA_CH_READ_ERROR | XDMA_CH_WRITE_ERROR | XDMA_CH_DESC_ERROR)
+
+// Completion waits give up after this long without progress
+#define XDMA_COMPLETION_TIMEOUT_NS 1000000000ULL
+
+// IRQ_BLOCK register offsets. Channel bits: H2C channel n at bit n, C2H
+// channels right after the H2C ones.
+#define XDMA_IRQ_USER_EN 0x04
+#define XDMA_IRQ_USER_EN_W1S 0x08
+#define XDMA_IRQ_USER_EN_W1C 0x0C
+#define XDMA_IRQ_CHANNEL_EN 0x10
+#define XDMA_IRQ_CHANNEL_EN_W1S 0x14
+#define XDMA_IRQ_CHANNEL_EN_W1C 0x18
+#define XDMA_IRQ_USER_REQUEST 0x40
+#define XDMA_IRQ_CHANNEL_REQUEST 0x44
+#define XDMA_IRQ_USER_PENDING 0x48
+#define XDMA_IRQ_CHANNEL_PENDING 0x4C
+// 5-bit vector numbers, 4 per register, channel ones indexed by the same
+// bit as the enable/pending masks
+#define XDMA_IRQ_USER_VECTOR 0x80
+#define XDMA_IRQ_CHANNEL_VECTOR 0xA0
+
+// H2C_SGDMA/C2H_SGDMA register offsets
+#define XDMA_SGDMA_DESC_LO 0x80
+#define XDMA_SGDMA_DESC_HI 0x84
+#define XDMA_SGDMA_DESC_ADJ 0x88
+#define XDMA_SGDMA_DESC_CREDITS 0x8C
+
+// SGDMA_COMMON register offsets, H2C channel n at bit n, C2H at bit 16 + n
+#define XDMA_SGDMA_COMMON_CREDIT_MODE 0x20
+#define XDMA_SGDMA_COMMON_CREDIT_MODE_W1S 0x24
+#define XDMA_SGDMA_COMMON_CREDIT_MODE_W1C 0x28
+
+// Descriptor credits register is 10 bits wide
+#define XDMA_MAX_DESC_CREDITS 1023
+
+// C2H stream writeback status
+#define XDMA_C2H_WB_MAGIC 0x52B4
+#define XDMA_C2H_WB_EOP (1 << 0)
+
 class HugePageWrapper {
 public:
   HugePageWrapper() = delete;
-  HugePageWrapper(enum HugePageSizeType);
+  // shared: backed by a hugetlb memfd that other processes can map
+  // numa_node: node the page is preferably taken from, -1 for any
+  HugePageWrapper(enum HugePageSizeType, bool shared = false,
+                  int32_t numa_node = -1);
   ~HugePageWrapper();
 
   void *getVAddr() { return this->virt_addr; }
   uint64_t getPAddr() { return this->phy_addr; }
   size_t getLen() { return this->length; }
   HugePageSizeType getSizeType() { return this->size_type; }
+  // memfd of a shared page, -1 otherwise
+  int getFd() { return this->fd; }
 
 private:
+  int fd;
   size_t length;
   uint64_t phy_addr;
   void *virt_addr;
@@ -56,6 +163,10 @@ class BAR_wrapper {
 public:
   BAR_wrapper() = delete;
   BAR_wrapper(uint64_t start, size_t len, off64_t offset);
+  // Map through a device node (/dev/uioN or PCI resource file). map_offset is
+  // the mmap() offset and offset the region start within the first page.
+  BAR_wrapper(const char *path, size_t len, off64_t map_offset,
+              off64_t offset);
   ~BAR_wrapper();
 
   void *getVAddr() { return this->vaddr; }
@@ -64,9 +175,49 @@ public:
 
 private:
   void *vaddr;
+  void *map_base;
+  size_t map_len;
   size_t len;
 };
 
+// How XDMA_factory maps BARs into the process
+enum BAR_MAP_METHOD : int {
+  BAR_MAP_DEVMEM = 0, // /dev/mem at the physical address (legacy)
+  BAR_MAP_UIO,        // /dev/uioN at offset map_id * page size
+  BAR_MAP_RESOURCE    // /sys/class/uio/uioN/device/resourceM
+};
+
+// One UIO memory map as exported by /sys/class/uio/uioN/maps/mapM
+struct uio_map_info {
+  int32_t map_id;
+  uint64_t addr;
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct XDMA_factory_opt {
+  int32_t uio_index = -1;
+  BAR_MAP_METHOD map_method = BAR_MAP_UIO;
+  // Enumeration cache file, nullptr disables caching
+  const char *cache_path = nullptr;
+};
+
+// How completions are detected
+enum XDMA_COMPLETION_MODE : int {
+  CPL_COUNT = 0, // completed descriptor count register
+  CPL_WRITEBACK  // C2H stream writeback in host memory
+};
+
+// Transfer settings of one device, tuned by xdma_tune
+struct xdma_profile {
+  uint32_t chunk_size = MEM_CHUNK_SIZE;
+  uint32_t adj_block = 8;
+  XDMA_COMPLETION_MODE completion = CPL_COUNT;
+  bool adaptive = false;
+  // Throughput the tuner measured, 0 for built-in defaults
+  double mibps = 0;
+};
+
 enum XDMA_ADDR_TARGET : int {
   H2C_CHANNEL = 0,
   C2H_CHANNEL,
@@ -81,9 +232,18 @@ enum XDMA_ADDR_TARGET : int {
 class XDMA {
 public:
   XDMA() = delete;
-  XDMA(int uio_index) { this->uio_index = uio_index; }
+  XDMA(int uio_index) {
+    this->uio_index = uio_index;
+    this->uio_fd = -1;
+    this->num_h2c = -1;
+  }
+  ~XDMA();
 
   static unique_ptr<XDMA> XDMA_factory(int32_t uio_index = -1);
+  // Fast path: plain sysfs reads, no regex/iostream, optional cache
+  static unique_ptr<XDMA> XDMA_factory(const XDMA_factory_opt &opt);
+  // uio indices of every XDMA UIO, ascending
+  static vector<int32_t> enumerate();
 
   uint32_t ctrl_reg_write(const uint32_t xdma_reg_addr, const uint32_t data);
   uint32_t ctrl_reg_write(const XDMA_ADDR_TARGET target, const uint32_t channel,
@@ -97,15 +257,69 @@ public:
   int get_uio_index() { return this->uio_index; }
   void *bar_vaddr(int bar_index);
   size_t bar_len(int bar_index);
+  // Map resourceN_wc of a prefetchable user BAR, false if not available
+  bool map_bar_wc(int bar_index);
+  void *bar_vaddr_wc(int bar_index);
+  // Copy to a user BAR, through the WC mapping with streaming stores if
+  // map_bar_wc() succeeded, 32-bit UC stores otherwise. offset and len
+  // must be multiples of 4 (range_error).
+  void pio_write(int bar_index, size_t offset, const void *src, size_t len);
+  // Publish live counters to shared memory for xdma_top. Call before creating
+  // engines, channels created earlier keep counting into their own block.
+  void enable_stats();
+  // nullptr without enable_stats()
+  xdma_chan_stats *chan_stats(int dir, uint32_t channel);
+
+  // Interrupt moderation. The engines have no interrupt counter, a channel
+  // interrupts when a descriptor with the Completed bit finishes or the
+  // chain stops. Mark every Nth descriptor (desc_irq_interval()) and poll
+  // writebacks in between.
+  uint32_t irq_channel_mask(int dir, uint32_t channel);
+  void irq_channel_enable(int dir, uint32_t channel, bool enable);
+  void irq_channel_vector(int dir, uint32_t channel, uint32_t vector);
+  uint32_t irq_channel_pending();
+  void irq_user_enable(uint32_t mask, bool enable);
+  uint32_t irq_user_pending();
+  // Re-arm and block on /dev/uioN, returns the UIO event count or 0 on
+  // timeout (-1 waits forever)
+  uint32_t irq_wait(int timeout_ms = -1);
+
+  // "<vendor>_<device>_x<link width>_<link speed>GT" of the PCI function
+  string device_key();
+  const xdma_profile &get_profile() { return this->profile; }
+  void set_profile(const xdma_profile &profile) { this->profile = profile; }
+  // <profile dir>/<device_key>.profile, dir from $XDMA_UDRV_PROFILE_DIR
+  string profile_path();
+  // XDMA_factory loads the profile, built-in defaults if there is none
+  bool load_profile();
+  bool save_profile();
   friend ostream &operator<<(ostream &os, const XDMA &xdma);
 
   static const int num_of_bars_max = PCIE_MAX_BARS;
 
 private:
+  void identify_xdma_bar();
+  // Bit of a channel in the interrupt block, C2H after all H2C engines
+  uint32_t irq_channel_bit(int dir, uint32_t channel);
+
   int uio_index;
+  int uio_fd;
+  // # of H2C engines, C2H interrupt bits start there
+  int32_t num_h2c;
   int32_t num_of_bars;
   int32_t xdma_bar_index;
   array<unique_ptr<BAR_wrapper>, PCIE_MAX_BARS> bars;
+  array<unique_ptr<BAR_wrapper>, PCIE_MAX_BARS> bars_wc;
+  unique_ptr<XStats> stats;
+  xdma_profile profile;
+};
+
+enum XDMA_DIR : int { DIR_H2C = 0, DIR_C2H };
+
+// Where the engine takes descriptors from
+enum XDMA_DESC_MODE : int {
+  DESC_HOST_MEMORY = 0, // fetched by the engine from SGDMA 0x80/0x84
+  DESC_BYPASS           // pushed by the host through a user BAR window
 };
 
 struct xdma_desc {
@@ -129,11 +343,91 @@ struct c2h_wb {
   uint32_t length;
 } __attribute__((packed));
 
+/*
+One H2C or C2H channel.
+Host-memory mode: start() points the SGDMA at a descriptor chain in host
+memory and sets run.
+Bypass mode: the design routes a window in a user BAR to the channel's
+descriptor bypass port. Each descriptor is written as one 32-byte xdma_desc
+slot, the user logic forwards it once the last dword has landed. Flow control
+is left to the design (e.g. a FIFO deep enough for the chain).
+*/
+// Set the Completed bit (status and interrupt) only on every interval-th
+// descriptor of a chain and on the last one
+void desc_irq_interval(xdma_desc *desc, uint32_t n_desc, uint32_t interval);
+
+// "busy, magic_stopped, read_error(UR)" style decoding of a channel status
+string xdma_status_str(uint32_t status);
+
+class XDMAEngine {
+public:
+  XDMAEngine() = delete;
+  XDMAEngine(XDMA &xdma, XDMA_DIR dir, uint32_t channel);
+
+  XDMA_DIR get_dir() { return this->dir; }
+  uint32_t get_channel() { return this->channel; }
+  XDMA_DESC_MODE get_desc_mode() { return this->desc_mode; }
+  bool is_stream() { return this->stream; }
+
+  // Host-memory descriptor mode
+  void start(uint64_t desc_paddr, uint32_t nxt_adj = 0);
+  // Descriptor bypass mode
+  void set_bypass_window(int bar_index, size_t offset);
+  void start_bypass();
+  void bypass_push(const xdma_desc &desc);
+  void bypass_push(const xdma_desc *desc, size_t n);
+
+  // Descriptor credit mode, the engine fetches only as many descriptors as
+  // credits given so a circular chain can't overrun the consumer
+  void set_credit_mode(bool enable);
+  void add_credits(uint32_t credits);
+
+  void stop();
+  uint32_t status();
+  // Read-to-clear status, returns the bits that were set
+  uint32_t clear_status();
+  uint32_t completed_count();
+  bool is_busy() { return this->status() & XDMA_CH_BUSY; }
+  xdma_chan_stats *stats() { return this->st; }
+
+  // Route channel interrupts through the IRQ block. ie_bits picks the
+  // sources, completed descriptors and end of chain by default.
+  void irq_enable(uint32_t ie_bits = XDMA_CH_IE_DESC_COMPLETED |
+                                     XDMA_CH_IE_DESC_STOPPED |
+                                     XDMA_CH_IE_IDLE_STOPPED);
+  void irq_disable();
+
+  // Returns the status, throws system_error EIO (ENODEV if the device stopped
+  // answering) with the decoded bits if the channel flagged an error
+  uint32_t check_status();
+  // Error bits of the last failure check_status() saw
+  uint32_t get_last_error() { return this->last_error; }
+  // Stop, wait for busy to drop and clear latched status so the channel can
+  // be started again, throws ETIMEDOUT if it doesn't go idle
+  void reset(uint64_t timeout_ns = XDMA_COMPLETION_TIMEOUT_NS);
+
+private:
+  XDMA &xdma;
+  XDMA_DIR dir;
+  uint32_t channel;
+  XDMA_ADDR_TARGET ch_target;
+  XDMA_ADDR_TARGET sgdma_target;
+  bool stream;
+  XDMA_DESC_MODE desc_mode;
+  volatile void *byp_uc;
+  void *byp_wc;
+  xdma_chan_stats *st;
+  // Counters of an engine without a stats segment, never read, kept per
+  // engine so threads don't share the cache lines
+  xdma_chan_stats local_st{};
+  uint32_t last_error;
+};
+
 class XHugeBuffer {
 public:
   XHugeBuffer();
 
-  void initialize(size_t xfer_size);
+  void initialize(size_t xfer_size, uint32_t chunk_size = MEM_CHUNK_SIZE);
   uint64_t getXferedSize();
   void *getDataBufferVaddr() { return this->data_buf.getVAddr(); }
   uint64_t getDataBufferPaddr() { return this->data_buf.getPAddr(); }
@@ -146,27 +440,118 @@ private:
   uint32_t n_desc;
 };
 
+// One finished descriptor of an XSGBuffer transfer, data points into it
+struct sg_chunk {
+  uint32_t idx;
+  void *data;
+  uint32_t length;
+  uint32_t status;
+  // TSC of the poll that saw it complete, 0 if not known
+  uint64_t tsc;
+};
+
 // XDMA SG buffer base on huge page
 class XSGBuffer {
 public:
-  XSGBuffer(const uint64_t size);
+  // chunk_size: bytes per descriptor, power of two up to MEM_CHUNK_SIZE
+  // and the data page size
+  // adj_block: descriptors fetched together, power of two up to 16
+  // page_type/numa_node: data pages as chosen by plan_hugepages()
+  XSGBuffer(const uint64_t size, uint32_t chunk_size = MEM_CHUNK_SIZE,
+            uint32_t adj_block = 8, HugePageSizeType page_type = HUGE_1GiB,
+            int32_t numa_node = -1);
   XSGBuffer(const vector<uint64_t> &size);
   void initialize();
   void *getDescWBVaddr() { return this->desc_wb_buf.getVAddr(); }
   uint64_t getDescWBPaddr() { return this->desc_wb_buf.getPAddr(); }
   uint32_t getNrPg() { return this->data_buf.size(); }
+  uint32_t getNrDesc() { return this->nr_desc; }
+  uint32_t getChunkSize() { return this->chunk_size; }
+  uint64_t getPageLen() { return this->page_len; }
+  // After initialize(), see desc_irq_interval()
+  void setIrqInterval(uint32_t interval);
+  c2h_wb *getWBVaddr() {
+    return (c2h_wb *)((uintptr_t)this->desc_wb_buf.getVAddr() +
+                      this->desc_wb_buf.getLen() / 2);
+  }
   void *getDataBufferVaddr(uint32_t index);
   uint64_t getDataBufferPaddr(uint32_t index);
   uint64_t getXferedSize();
+  // Descriptor idx, length from its writeback, chunk size if there is none
+  // yet
+  sg_chunk getChunk(uint32_t idx);
 
 private:
   uint64_t size;
   uint32_t nr_desc;
+  uint32_t chunk_size;
+  uint32_t adj_block;
+  uint64_t page_len;
   HugePageWrapper desc_wb_buf;
   std::vector<unique_ptr<HugePageWrapper>> data_buf;
   vector<int32_t> n_desc;
 };
 
+// One received packet, data points into the ring
+struct c2h_packet {
+  void *data;
+  uint32_t length;
+  // false if the packet continues in the next view (ring wrap)
+  bool eop;
+};
+
+/*
+C2H stream receive ring with per-packet descriptors.
+A circular chain of n_desc descriptors of desc_size bytes each, flow
+controlled by descriptor credits. Completion is detected from the writeback
+magic in host memory, no MMIO on the receive path. Size descriptors to the
+largest packet so each packet lands in one descriptor; longer packets are
+merged into one view as long as they don't wrap the ring or outgrow
+getMaxPacketSize(), past which they arrive as eop = false fragments.
+*/
+class XPacketRing {
+public:
+  XPacketRing(uint32_t n_desc, uint32_t desc_size = 4096);
+  // Never leave the engine writing into freed pages
+  ~XPacketRing() { this->stop(); }
+  void initialize();
+  void start(XDMAEngine &engine);
+  void stop();
+  // Collect up to max completed packets, returns # of views filled. Views
+  // stay valid until release().
+  size_t recv(c2h_packet *pkts, size_t max);
+  // Return every descriptor behind views handed out so far to the engine
+  void release();
+  // After an engine error: reset the channel and restart it at the next free
+  // descriptor, dropping the packet in flight. Views already handed out stay
+  // valid. Returns # of descriptors dropped.
+  uint64_t recover();
+
+  uint32_t getNrDesc() { return this->nr_desc; }
+  uint32_t getDescSize() { return this->desc_size; }
+  // Largest packet received in one view: the engine holds at most
+  // XDMA_MAX_DESC_CREDITS descriptors at a time
+  uint64_t getMaxPacketSize() {
+    uint32_t n = (this->nr_desc < XDMA_MAX_DESC_CREDITS) ? this->nr_desc
+                                                          : XDMA_MAX_DESC_CREDITS;
+    return (uint64_t)n * this->desc_size;
+  }
+  uint64_t getRecvDescCnt() { return this->head; }
+
+private:
+  void post_credits();
+
+  uint32_t nr_desc;
+  uint32_t desc_size;
+  HugePageWrapper desc_wb_buf;
+  unique_ptr<HugePageWrapper> data_buf;
+  XDMAEngine *engine;
+  // Free running descriptor counters: received, released, credited
+  uint64_t head;
+  uint64_t released;
+  uint64_t posted;
+};
+
 } // namespace XDMA_udrv
 
 #endif
\ No newline at end of file
@@ -0,0 +1,331 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <immintrin.h>
+#include <unistd.h>
+
+#include "XDMA_trace.hpp"
+#include "XDMA_unpack.hpp"
+
+using namespace std;
+
+namespace {
+
+// Input bytes a worker deinterleaves between two rounds of lane writes
+const size_t BLOCK = 1 << 20;
+
+template <typename T>
+void sw_unpack(const T *src, size_t n_frames, uint32_t n_lanes,
+               void *const *dst) {
+  for (uint32_t l = 0; l < n_lanes; l++) {
+    T *d = (T *)dst[l];
+    const T *s = src + l;
+    for (size_t f = 0; f < n_frames; f++, s += n_lanes)
+      d[f] = *s;
+  }
+}
+
+// Frames [first, first + n_frames), dst still points at frame 0
+void sw_range(const uint8_t *src, size_t first, size_t n_frames,
+              uint32_t n_lanes, uint32_t sample_bytes, void *const *dst) {
+  void *d[64];
+  for (uint32_t l = 0; l < n_lanes; l++)
+    d[l] = (uint8_t *)dst[l] + first * sample_bytes;
+  src += first * n_lanes * sample_bytes;
+  switch (sample_bytes) {
+  case 1:
+    sw_unpack((const uint8_t *)src, n_frames, n_lanes, d);
+    break;
+  case 2:
+    sw_unpack((const uint16_t *)src, n_frames, n_lanes, d);
+    break;
+  case 4:
+    sw_unpack((const uint32_t *)src, n_frames, n_lanes, d);
+    break;
+  case 8:
+    sw_unpack((const uint64_t *)src, n_frames, n_lanes, d);
+    break;
+  }
+}
+
+/*
+pshufb control gathering each lane's samples of one 16-byte word next to
+each other: lane l ends up in bytes [l * 16 / N, (l + 1) * 16 / N).
+*/
+__m128i lane_shuffle(uint32_t n_lanes, uint32_t sample_bytes) {
+  alignas(16) uint8_t ctl[16];
+  uint32_t frame = n_lanes * sample_bytes, per_lane = 16 / n_lanes;
+  for (uint32_t f = 0; f < 16 / frame; f++)
+    for (uint32_t l = 0; l < n_lanes; l++)
+      for (uint32_t b = 0; b < sample_bytes; b++)
+        ctl[l * per_lane + f * sample_bytes + b] =
+            f * frame + l * sample_bytes + b;
+  return _mm_load_si128((const __m128i *)ctl);
+}
+
+constexpr uint32_t bitrev(uint32_t v, uint32_t n) {
+  uint32_t r = 0;
+  for (uint32_t b = 1; b < n; b <<= 1, v >>= 1)
+    r = (r << 1) | (v & 1);
+  return r;
+}
+
+/*
+The SIMD kernels treat every 128-bit lane of a register on its own. A row is
+one 16-byte word after lane_shuffle(), N rows form an N x N matrix of
+16 / N byte elements (row = word, column = lane) and log2(N) rounds of
+unpacklo/hi transpose it. Rows go in bit reversed so the columns come out in
+order. Register lane k holds the k-th group of N words, which follows group
+k - 1 in the stream, so every column is one contiguous store per lane.
+*/
+template <uint32_t N>
+__attribute__((target("avx2"))) size_t
+avx2_unpack(const uint8_t *src, size_t len, uint32_t sample_bytes,
+            void *const *dst) {
+  const __m256i shuf = _mm256_broadcastsi128_si256(lane_shuffle(N, sample_bytes));
+  const size_t step = 32 * N;
+  __m256i r[N], t[N];
+  size_t done = 0, out = 0;
+
+  for (; done + step <= len; done += step, out += 32) {
+    const uint8_t *s = src + done;
+    for (uint32_t p = 0; p < N; p++) {
+      const uint8_t *w = s + 16 * bitrev(p, N);
+      __m256i v = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)w));
+      v = _mm256_inserti128_si256(
+          v, _mm_loadu_si128((const __m128i *)(w + 16 * N)), 1);
+      r[p] = _mm256_shuffle_epi8(v, shuf);
+    }
+    for (uint32_t width = 16 / N; width < 16; width *= 2) {
+      for (uint32_t i = 0; i < N / 2; i++) {
+        __m256i a = r[i], b = r[i + N / 2];
+        switch (width) {
+        case 1:
+          t[2 * i] = _mm256_unpacklo_epi8(a, b);
+          t[2 * i + 1] = _mm256_unpackhi_epi8(a, b);
+          break;
+        case 2:
+          t[2 * i] = _mm256_unpacklo_epi16(a, b);
+          t[2 * i + 1] = _mm256_unpackhi_epi16(a, b);
+          break;
+        case 4:
+          t[2 * i] = _mm256_unpacklo_epi32(a, b);
+          t[2 * i + 1] = _mm256_unpackhi_epi32(a, b);
+          break;
+        default:
+          t[2 * i] = _mm256_unpacklo_epi64(a, b);
+          t[2 * i + 1] = _mm256_unpackhi_epi64(a, b);
+          break;
+        }
+      }
+      for (uint32_t i = 0; i < N; i++)
+        r[i] = t[i];
+    }
+    for (uint32_t l = 0; l < N; l++)
+      _mm256_storeu_si256((__m256i *)((uint8_t *)dst[l] + out), r[l]);
+  }
+  return done;
+}
+
+template <uint32_t N>
+__attribute__((target("avx512f,avx512bw"))) size_t
+avx512_unpack(const uint8_t *src, size_t len, uint32_t sample_bytes,
+              void *const *dst) {
+  const __m512i shuf =
+      _mm512_broadcast_i32x4(lane_shuffle(N, sample_bytes));
+  const size_t step = 64 * N;
+  __m512i r[N], t[N];
+  size_t done = 0, out = 0;
+
+  for (; done + step <= len; done += step, out += 64) {
+    const uint8_t *s = src + done;
+    for (uint32_t p = 0; p < N; p++) {
+      const uint8_t *w = s + 16 * bitrev(p, N);
+      __m512i v = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i *)w));
+      v = _mm512_inserti32x4(
+          v, _mm_loadu_si128((const __m128i *)(w + 16 * N)), 1);
+      v = _mm512_inserti32x4(
+          v, _mm_loadu_si128((const __m128i *)(w + 32 * N)), 2);
+      v = _mm512_inserti32x4(
+          v, _mm_loadu_si128((const __m128i *)(w + 48 * N)), 3);
+      r[p] = _mm512_shuffle_epi8(v, shuf);
+    }
+    for (uint32_t width = 16 / N; width < 16; width *= 2) {
+      for (uint32_t i = 0; i < N / 2; i++) {
+        __m512i a = r[i], b = r[i + N / 2];
+        switch (width) {
+        case 1:
+          t[2 * i] = _mm512_unpacklo_epi8(a, b);
+          t[2 * i + 1] = _mm512_unpackhi_epi8(a, b);
+          break;
+        case 2:
+          t[2 * i] = _mm512_unpacklo_epi16(a, b);
+          t[2 * i + 1] = _mm512_unpackhi_epi16(a, b);
+          break;
+        case 4:
+          t[2 * i] = _mm512_unpacklo_epi32(a, b);
+          t[2 * i + 1] = _mm512_unpackhi_epi32(a, b);
+          break;
+        default:
+          t[2 * i] = _mm512_unpacklo_epi64(a, b);
+          t[2 * i + 1] = _mm512_unpackhi_epi64(a, b);
+          break;
+        }
+      }
+      for (uint32_t i = 0; i < N; i++)
+        r[i] = t[i];
+    }
+    for (uint32_t l = 0; l < N; l++)
+      _mm512_storeu_si512((uint8_t *)dst[l] + out, r[l]);
+  }
+  return done;
+}
+
+// Bytes of src handled, the caller does the rest
+using simd_fn = size_t (*)(const uint8_t *, size_t, uint32_t, void *const *);
+
+simd_fn select_simd_fn(uint32_t n_lanes) {
+  static const bool has_avx512 = (__builtin_cpu_init(),
+                                  __builtin_cpu_supports("avx512f") &&
+                                      __builtin_cpu_supports("avx512bw"));
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx512) {
+    switch (n_lanes) {
+    case 2:
+      return avx512_unpack<2>;
+    case 4:
+      return avx512_unpack<4>;
+    case 8:
+      return avx512_unpack<8>;
+    case 16:
+      return avx512_unpack<16>;
+    }
+  }
+  if (has_avx2) {
+    switch (n_lanes) {
+    case 2:
+      return avx2_unpack<2>;
+    case 4:
+      return avx2_unpack<4>;
+    case 8:
+      return avx2_unpack<8>;
+    case 16:
+      return avx2_unpack<16>;
+    }
+  }
+  return nullptr;
+}
+
+void check_layout(size_t len, uint32_t n_lanes, uint32_t sample_bytes) {
+  if (n_lanes == 0 || n_lanes > 64) {
+    throw std::range_error("Invalid # of lanes");
+  }
+  if (sample_bytes != 1 && sample_bytes != 2 && sample_bytes != 4 &&
+      sample_bytes != 8) {
+    throw std::range_error("Invalid sample size");
+  }
+  if (len % (n_lanes * sample_bytes)) {
+    throw std::range_error("Length is not a whole number of frames");
+  }
+}
+
+} // namespace
+
+namespace XDMA_udrv {
+
+void deinterleave(const void *src, size_t len, uint32_t n_lanes,
+                  uint32_t sample_bytes, void *const *dst) {
+  check_layout(len, n_lanes, sample_bytes);
+  uint32_t frame = n_lanes * sample_bytes;
+  size_t done = 0;
+  simd_fn fn = (frame <= 16) ? select_simd_fn(n_lanes) : nullptr;
+  if (fn)
+    done = fn((const uint8_t *)src, len, sample_bytes, dst);
+  sw_range((const uint8_t *)src, done / frame, (len - done) / frame, n_lanes,
+           sample_bytes, dst);
+}
+
+void deinterleave_sw(const void *src, size_t len, uint32_t n_lanes,
+                     uint32_t sample_bytes, void *const *dst) {
+  check_layout(len, n_lanes, sample_bytes);
+  sw_range((const uint8_t *)src, 0, len / (n_lanes * sample_bytes), n_lanes,
+           sample_bytes, dst);
+}
+
+XUnpackPool::XUnpackPool(const vector<string> &lane_paths,
+                         uint32_t sample_bytes, unsigned n_threads)
+    : paths(lane_paths), sample_bytes(sample_bytes), dropped(0),
+      scratch(n_threads), pool(n_threads) {
+  check_layout(0, lane_paths.size(), sample_bytes);
+  this->frame_size = lane_paths.size() * sample_bytes;
+  for (auto &p : lane_paths) {
+    int fd = open(p.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0664);
+    if (fd < 0) {
+      int err = errno;
+      for (int f : this->fds)
+        close(f);
+      throw system_error(error_code(err, generic_category()), "open() " + p);
+    }
+    this->fds.push_back(fd);
+  }
+}
+
+XUnpackPool::~XUnpackPool() {
+  // Queued chunks still get written
+  this->pool.stop();
+  for (int fd : this->fds)
+    close(fd);
+}
+
+void XUnpackPool::unpack(const uint8_t *data, size_t len, uint64_t offset,
+                         vector<uint8_t> &scratch) {
+  uint32_t n_lanes = this->fds.size();
+  size_t block = BLOCK / this->frame_size * this->frame_size;
+  size_t lane_block = block / n_lanes;
+  void *dst[64];
+
+  scratch.resize(block);
+  for (uint32_t l = 0; l < n_lanes; l++)
+    dst[l] = scratch.data() + l * lane_block;
+  // Deinterleave a block into scratch while it is hot, then write it out
+  for (size_t done = 0; done < len; done += block) {
+    size_t n = min(block, len - done);
+    {
+      XDMA_TRACE_SCOPE("deinterleave");
+      deinterleave(data + done, n, n_lanes, this->sample_bytes, dst);
+    }
+    uint64_t off = (offset + done) / n_lanes;
+    for (uint32_t l = 0; l < n_lanes; l++) {
+      ssize_t rv = pwrite(this->fds[l], dst[l], n / n_lanes, off);
+      if (rv != (ssize_t)(n / n_lanes)) {
+        throw system_error(error_code((rv < 0) ? errno : EIO,
+                                      generic_category()),
+                           "pwrite() lane");
+      }
+    }
+  }
+}
+
+void XUnpackPool::submit(const void *data, size_t len, uint64_t offset) {
+  if (offset % this->frame_size) {
+    throw std::range_error("Chunk does not start on a frame");
+  }
+  size_t whole = len / this->frame_size * this->frame_size;
+  this->dropped += len - whole;
+  if (!whole)
+    return;
+  const uint8_t *p = (const uint8_t *)data;
+  this->pool.submit([this, p, whole, offset](unsigned worker) {
+    this->unpack(p, whole, offset, this->scratch[worker]);
+  });
+}
+
+void XUnpackPool::wait() { this->pool.wait(); }
+
+} // namespace XDMA_udrv
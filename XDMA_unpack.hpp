@@ -0,0 +1,69 @@
+#ifndef _XDMA_UNPACK_HPP_
+#define _XDMA_UNPACK_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "XDMA_jobs.hpp"
+
+namespace XDMA_udrv {
+
+/*
+Split a stream of frames, n_lanes samples of sample_bytes (1, 2, 4 or 8)
+each, into one planar buffer per lane: dst[l] gets sample l of every frame.
+len is a multiple of the frame size. Power of two lane counts with frames
+up to 16 bytes (e.g. 8 x 16-bit lanes in one 128-bit AXIS word) take an
+AVX-512BW or AVX2 shuffle/transpose kernel when the CPU has one, anything
+else a scalar loop.
+*/
+void deinterleave(const void *src, size_t len, uint32_t n_lanes,
+                  uint32_t sample_bytes, void *const *dst);
+// Scalar reference
+void deinterleave_sw(const void *src, size_t len, uint32_t n_lanes,
+                     uint32_t sample_bytes, void *const *dst);
+
+/*
+Deinterleaves chunks on worker threads as they are submitted, meant to be
+fed from the completion path like XCrcPool. Each lane is written to its own
+file with pwrite(), at the lane offset matching the chunk's stream offset,
+so chunks may finish in any order. Chunk memory has to stay valid until
+wait().
+*/
+class XUnpackPool {
+public:
+  // One path per lane
+  XUnpackPool(const std::vector<std::string> &lane_paths,
+              uint32_t sample_bytes, unsigned n_threads);
+  ~XUnpackPool();
+
+  // len bytes found at offset into the stream, offset a multiple of the
+  // frame size. A trailing partial frame is dropped.
+  void submit(const void *data, size_t len, uint64_t offset);
+  // Block until every submitted chunk is written, throws the first write
+  // error
+  void wait();
+
+  uint32_t getNrLanes() { return this->fds.size(); }
+  uint32_t getFrameSize() { return this->frame_size; }
+  unsigned getNrThreads() { return this->pool.getNrThreads(); }
+  uint64_t getDroppedBytes() { return this->dropped; }
+
+private:
+  void unpack(const uint8_t *data, size_t len, uint64_t offset,
+              std::vector<uint8_t> &scratch);
+
+  std::vector<int> fds;
+  std::vector<std::string> paths;
+  uint32_t sample_bytes;
+  uint32_t frame_size;
+  uint64_t dropped;
+  // Deinterleave buffer of each worker
+  std::vector<std::vector<uint8_t>> scratch;
+  XJobPool pool;
+};
+
+} // namespace XDMA_udrv
+
+#endif
@@ -0,0 +1,82 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "XDMA_crc.hpp"
+
+using namespace std;
+
+struct timespec timediff(struct timespec start, struct timespec end);
+
+double elapsed_s(struct timespec start, struct timespec end) {
+  struct timespec tdiff = timediff(start, end);
+  return tdiff.tv_sec + tdiff.tv_nsec / 1e9;
+}
+
+// CRC32C throughput, single call and pooled over chunks as pcicat --crc does
+int main(int argc, char const *argv[]) {
+  size_t size = (argc > 1) ? strtoull(argv[1], 0, 0) : (1UL << 30);
+  size_t chunk = (argc > 2) ? strtoull(argv[2], 0, 0) : (4UL << 20);
+  uint32_t n_chunk = size / chunk;
+  struct timespec tstart, tend;
+
+  uint8_t *buf = (uint8_t *)mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf == MAP_FAILED) {
+    perror("mmap()");
+    exit(1);
+  }
+  for (size_t i = 0; i < size; i++)
+    buf[i] = i * 131 + (i >> 17);
+
+  // Check the fast path against the table before timing anything
+  if (XDMA_udrv::crc32c(buf, 1 << 20) != XDMA_udrv::crc32c_sw(buf, 1 << 20)) {
+    cerr << "crc32c() disagrees with crc32c_sw()" << endl;
+    exit(1);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &tstart);
+  volatile uint32_t crc = XDMA_udrv::crc32c_sw(buf, size / 16);
+  clock_gettime(CLOCK_MONOTONIC, &tend);
+  printf("%-24s %10.2lf MiB/s\n", "table",
+         size / 16 / elapsed_s(tstart, tend) / (1 << 20));
+
+  clock_gettime(CLOCK_MONOTONIC, &tstart);
+  crc = XDMA_udrv::crc32c(buf, size);
+  clock_gettime(CLOCK_MONOTONIC, &tend);
+  printf("%-24s %10.2lf MiB/s\n", "crc32c, 1 thread",
+         size / elapsed_s(tstart, tend) / (1 << 20));
+  (void)crc;
+
+  unsigned n_cpu = thread::hardware_concurrency();
+  for (unsigned n = 1; n <= n_cpu; n *= 2) {
+    XDMA_udrv::XCrcPool pool(n_chunk, n);
+    clock_gettime(CLOCK_MONOTONIC, &tstart);
+    for (uint32_t i = 0; i < n_chunk; i++)
+      pool.submit(i, buf + (size_t)i * chunk, chunk);
+    pool.wait();
+    clock_gettime(CLOCK_MONOTONIC, &tend);
+    printf("pool, %2u thread(s)        %10.2lf MiB/s\n", n,
+           (size_t)n_chunk * chunk / elapsed_s(tstart, tend) / (1 << 20));
+  }
+  munmap(buf, size);
+  return 0;
+}
+
+struct timespec timediff(struct timespec start, struct timespec end) {
+  struct timespec temp;
+  if ((end.tv_nsec - start.tv_nsec) < 0) {
+    temp.tv_sec = end.tv_sec - start.tv_sec - 1;
+    temp.tv_nsec = 1000000000 + end.tv_nsec - start.tv_nsec;
+  } else {
+    temp.tv_sec = end.tv_sec - start.tv_sec;
+    temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  }
+  return temp;
+}
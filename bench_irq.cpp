@@ -0,0 +1,128 @@
+#include <boost/program_options.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <inttypes.h>
+
+#include "XDMA_timing.hpp"
+#include "XDMA_udrv.hpp"
+
+using namespace std;
+namespace po = boost::program_options;
+
+// One interrupt wakeup: when and how many descriptors were done by then
+struct wake {
+  uint64_t tsc;
+  uint32_t done;
+};
+
+void run(XDMA_udrv::XDMA &xdma, XDMA_udrv::XDMAEngine &c2h,
+         XDMA_udrv::XSGBuffer &buffer, uint32_t interval) {
+  uint32_t n_desc = buffer.getNrDesc();
+  XDMA_udrv::XCompletionTimeline timeline(n_desc);
+  vector<wake> wakes;
+  thread stamp;
+
+  buffer.initialize();
+  buffer.setIrqInterval(interval);
+  c2h.irq_enable();
+  timeline.mark_start();
+  // Writeback polling on the side gives the true completion time of every
+  // descriptor, only C2H stream engines have it
+  if (c2h.is_stream())
+    stamp = thread([&]() {
+      try {
+        timeline.wait_by_writeback(buffer.getWBVaddr());
+      } catch (const system_error &e) {
+        cerr << "Writeback: " << e.what() << endl;
+      }
+    });
+  uint64_t t0 = XDMA_udrv::tsc_read();
+  c2h.start(buffer.getDescWBPaddr());
+
+  uint32_t done = 0;
+  while (done < n_desc) {
+    if (!xdma.irq_wait(1000)) {
+      cerr << "No interrupt for 1 s, status: "
+           << XDMA_udrv::xdma_status_str(c2h.status()) << endl;
+      break;
+    }
+    uint64_t now = XDMA_udrv::tsc_read();
+    // Read-to-clear drops the interrupt condition before the next wait
+    c2h.clear_status();
+    done = c2h.completed_count();
+    wakes.push_back({now, done});
+  }
+  c2h.stop();
+  c2h.irq_disable();
+  if (stamp.joinable())
+    stamp.join();
+
+  double duration_ns =
+      (wakes.empty() ? 0 : wakes.back().tsc - t0) /
+      XDMA_udrv::tsc_per_ns();
+  double lat_sum = 0, lat_max = 0;
+  size_t w = 0;
+  for (uint32_t i = 0; c2h.is_stream() && i < done; i++) {
+    while (wakes[w].done <= i)
+      w++;
+    double lat = (wakes[w].tsc - timeline.getTsc(i)) / XDMA_udrv::tsc_per_ns();
+    lat_sum += lat;
+    lat_max = (lat > lat_max) ? lat : lat_max;
+  }
+  printf("%8u %8zu %12.0lf %8.1lf", interval, wakes.size(),
+         duration_ns ? wakes.size() / duration_ns * 1e9 : 0.0,
+         wakes.size() ? (double)done / wakes.size() : 0.0);
+  if (c2h.is_stream() && done)
+    printf(" %10.2lf %10.2lf\n", lat_sum / done / 1000, lat_max / 1000);
+  else
+    printf(" %10s %10s\n", "-", "-");
+}
+
+int main(int argc, char const *argv[]) {
+  po::options_description desc("Allowed options");
+  desc.add_options()("help,h", "print usage message");
+  desc.add_options()("chunk,s", po::value<uint32_t>()->default_value(4096),
+                     "Bytes per descriptor");
+  desc.add_options()("count,n", po::value<uint32_t>()->default_value(4096),
+                     "# of descriptors per run");
+  desc.add_options()("interval,i", po::value<vector<uint32_t>>()->multitoken(),
+                     "Descriptors per interrupt (default: 1 4 16 64 256)");
+  desc.add_options()("channel,c", po::value<uint32_t>()->default_value(0),
+                     "C2H channel");
+  desc.add_options()("vector", po::value<uint32_t>(),
+                     "Route the channel interrupt to this MSI vector");
+  po::variables_map vm;
+  store(parse_command_line(argc, argv, desc), vm);
+
+  if (vm.count("help")) {
+    cout << desc << "\n";
+    return 0;
+  }
+
+  unique_ptr<XDMA_udrv::XDMA> xdma = XDMA_udrv::XDMA::XDMA_factory();
+  uint32_t chunk = vm["chunk"].as<uint32_t>();
+  uint32_t channel = vm["channel"].as<uint32_t>();
+  vector<uint32_t> intervals = {1, 4, 16, 64, 256};
+  if (vm.count("interval"))
+    intervals = vm["interval"].as<vector<uint32_t>>();
+
+  XDMA_udrv::XDMAEngine c2h(*xdma, XDMA_udrv::DIR_C2H, channel);
+  XDMA_udrv::XSGBuffer buffer((uint64_t)chunk * vm["count"].as<uint32_t>(),
+                              chunk);
+  if (vm.count("vector"))
+    xdma->irq_channel_vector(XDMA_udrv::DIR_C2H, channel,
+                             vm["vector"].as<uint32_t>());
+
+  printf("%8s %8s %12s %8s %10s %10s\n", "interval", "irqs", "irqs/s",
+         "desc/irq", "avg us", "max us");
+  for (auto interval : intervals)
+    run(*xdma, c2h, buffer, interval);
+  return 0;
+}
@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <errno.h>
+#include <inttypes.h>
+
+#include "XDMA_pattern.hpp"
+#include "XDMA_sched.hpp"
+#include "XDMA_timing.hpp"
+#include "XDMA_udrv.hpp"
+
+using namespace std;
+namespace po = boost::program_options;
+
+// Per message: H2C submitted, H2C done, echo received on C2H
+struct msg_time {
+  uint64_t submit;
+  uint64_t sent;
+  uint64_t echo;
+};
+
+struct engine_pair {
+  unique_ptr<XDMA_udrv::XDMAEngine> h2c;
+  unique_ptr<XDMA_udrv::XDMAEngine> c2h;
+};
+
+/*
+count messages of size bytes, up to depth of them in flight. Message i
+goes out on pair i % pairs and has to come back on the same pair's C2H,
+which is posted before the H2C request so the echo always has a buffer.
+*/
+void run(vector<engine_pair> &pairs, XDMA_udrv::HugePageWrapper &tx,
+         XDMA_udrv::HugePageWrapper &rx, const XDMA_udrv::XPattern &pattern,
+         uint64_t size, uint64_t count, uint32_t depth, bool verify) {
+  uint64_t slot = (size + 4095) & ~4095ULL;
+  depth = min<uint64_t>(depth, tx.getLen() / slot);
+  vector<msg_time> t(count);
+  vector<uint8_t> state(count, 0);
+  vector<XDMA_udrv::xfer_done> done;
+  uint64_t next = 0, retired = 0, n_bad = 0;
+  uint64_t timeout_tsc = 1000000000 * XDMA_udrv::tsc_per_ns();
+
+  XDMA_udrv::XScheduler sched(true, 4096, 1024);
+  // Doorbells ring in engine order, C2H credits go out before the H2C ones
+  for (auto &p : pairs)
+    sched.add_engine(*p.c2h);
+  for (auto &p : pairs)
+    sched.add_engine(*p.h2c);
+  if (!verify) {
+    for (uint32_t s = 0; s < depth; s++)
+      pattern.fill((uint8_t *)tx.getVAddr() + s * slot, s * size, size);
+  }
+
+  uint64_t t_start = XDMA_udrv::tsc_read(), t_progress = t_start;
+  while (retired < count) {
+    for (; next < count && next < retired + depth; next++) {
+      uint64_t off = (next % depth) * slot;
+      uint32_t ch = next % pairs.size();
+      // Fresh content every message, a stale echo cannot pass the check
+      if (verify)
+        pattern.fill((uint8_t *)tx.getVAddr() + off, next * size, size);
+
+      XDMA_udrv::xfer_request req = {};
+      req.channel = ch;
+      req.len = size;
+      req.id = 2 * next + 1;
+      req.dir = XDMA_udrv::DIR_C2H;
+      req.host_paddr = rx.getPAddr() + off;
+      sched.submit(req);
+      req.id = 2 * next;
+      req.dir = XDMA_udrv::DIR_H2C;
+      req.host_paddr = tx.getPAddr() + off;
+      sched.submit(req);
+      t[next].submit = XDMA_udrv::tsc_read();
+    }
+
+    done.clear();
+    sched.poll(done);
+    uint64_t now = XDMA_udrv::tsc_read();
+    for (auto &d : done) {
+      uint64_t i = d.id / 2;
+      if (d.id & 1) {
+        t[i].echo = now;
+        if (verify &&
+            pattern.check((uint8_t *)rx.getVAddr() + (i % depth) * slot,
+                          i * size, size) != size)
+          n_bad++;
+      } else {
+        t[i].sent = now;
+      }
+      state[i] |= (d.id & 1) ? 2 : 1;
+    }
+    while (retired < count && state[retired] == 3)
+      retired++;
+
+    if (!done.empty()) {
+      t_progress = now;
+    } else if (now - t_progress > timeout_tsc) {
+      for (auto &p : pairs) {
+        p.h2c->check_status();
+        p.c2h->check_status();
+      }
+      throw system_error(error_code(-ETIMEDOUT, generic_category()),
+                         "message " + to_string(retired) + " never came back");
+    }
+  }
+  double duration_ns = (t[count - 1].echo - t_start) / XDMA_udrv::tsc_per_ns();
+
+  vector<double> rtt(count);
+  for (uint64_t i = 0; i < count; i++)
+    rtt[i] = (t[i].echo - t[i].submit) / XDMA_udrv::tsc_per_ns();
+  sort(rtt.begin(), rtt.end());
+  auto pct = [&rtt](double p) { return rtt[(size_t)((rtt.size() - 1) * p)]; };
+
+  printf("%10" PRIu64 " %6u %10.2lf %10.2lf %9.0lf %9.0lf %9.0lf %9.0lf "
+         "%9.0lf %10.0lf %6" PRIu64 "\n",
+         size, depth, size * count / duration_ns * 1e9 / (1 << 20),
+         2.0 * size * count / duration_ns * 1e9 / (1 << 20), rtt[0],
+         pct(0.5), pct(0.9), pct(0.99), pct(0.999), rtt[count - 1], n_bad);
+}
+
+// Round trip through a bitstream that echoes H2C back on C2H
+int main(int argc, char const *argv[]) {
+  po::options_description desc("Allowed options");
+  desc.add_options()("help,h", "print usage message");
+  desc.add_options()(
+      "size,s", po::value<vector<string>>()->multitoken(),
+      "Message sizes, multiples of 16 (default: 64 B to 1 MiB, x4)");
+  desc.add_options()("count,n", po::value<uint64_t>()->default_value(10000),
+                     "Messages per size");
+  desc.add_options()("depth,d", po::value<uint32_t>()->default_value(1),
+                     "Messages in flight, 1 for unloaded latency");
+  desc.add_options()("pairs,c", po::value<uint32_t>()->default_value(1),
+                     "H2C/C2H channel pairs, channel n echoes onto n");
+  desc.add_options()("no-verify", "Don't check the echoed payload");
+  po::variables_map vm;
+  store(parse_command_line(argc, argv, desc), vm);
+
+  if (vm.count("help")) {
+    cout << desc << "\n";
+    return 0;
+  }
+
+  vector<uint64_t> sizes;
+  if (vm.count("size")) {
+    for (auto s : vm["size"].as<vector<string>>())
+      sizes.push_back(strtoull(s.c_str(), 0, 0));
+  } else {
+    for (uint64_t s = 64; s <= (1 << 20); s *= 4)
+      sizes.push_back(s);
+  }
+  for (auto s : sizes) {
+    if (!s || s % 16 || s > (1UL << 30)) {
+      cerr << "Invalid message size " << s << endl;
+      exit(1);
+    }
+  }
+  uint64_t count = vm["count"].as<uint64_t>();
+  if (!count) {
+    cerr << "Please specify at least one message" << endl;
+    exit(1);
+  }
+  uint32_t depth = vm["depth"].as<uint32_t>();
+  if (!depth) {
+    cerr << "Please allow at least one message in flight" << endl;
+    exit(1);
+  }
+
+  unique_ptr<XDMA_udrv::XDMA> xdma = XDMA_udrv::XDMA::XDMA_factory();
+  vector<engine_pair> pairs(vm["pairs"].as<uint32_t>());
+  for (uint32_t c = 0; c < pairs.size(); c++) {
+    pairs[c].h2c = make_unique<XDMA_udrv::XDMAEngine>(
+        *xdma, XDMA_udrv::DIR_H2C, c);
+    pairs[c].c2h = make_unique<XDMA_udrv::XDMAEngine>(
+        *xdma, XDMA_udrv::DIR_C2H, c);
+  }
+  XDMA_udrv::HugePageWrapper tx(XDMA_udrv::HUGE_1GiB);
+  XDMA_udrv::HugePageWrapper rx(XDMA_udrv::HUGE_1GiB);
+  XDMA_udrv::XPattern pattern(XDMA_udrv::PAT_LFSR128);
+
+  printf("%10s %6s %10s %10s %9s %9s %9s %9s %9s %10s %6s\n", "size", "depth",
+         "MiB/s/dir", "MiB/s tot", "rtt min", "p50", "p90", "p99", "p99.9",
+         "max (ns)", "bad");
+  for (auto s : sizes) {
+    try {
+      run(pairs, tx, rx, pattern, s, count, depth, !vm.count("no-verify"));
+    } catch (const system_error &e) {
+      cerr << "Loopback: " << e.what() << endl;
+      for (auto &p : pairs)
+        cerr << "H2C " << p.h2c->get_channel() << ": "
+             << XDMA_udrv::xdma_status_str(p.h2c->get_last_error())
+             << ", C2H: "
+             << XDMA_udrv::xdma_status_str(p.c2h->get_last_error()) << endl;
+      exit(1);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,124 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "XDMA_pattern.hpp"
+
+using namespace std;
+
+struct axis_word_128 {
+  uint32_t data[4];
+} __attribute__((packed));
+
+void lfsr128(struct axis_word_128 *target, struct axis_word_128 *result);
+struct timespec timediff(struct timespec start, struct timespec end);
+
+double elapsed_s(struct timespec start, struct timespec end) {
+  struct timespec tdiff = timediff(start, end);
+  return tdiff.tv_sec + tdiff.tv_nsec / 1e9;
+}
+
+// Bit serial PRBS31 from the same seed, LSB first
+void prbs31_ref(uint32_t state, uint8_t *dst, size_t len) {
+  memset(dst, 0, len);
+  for (size_t i = 0; i < len * 8; i++) {
+    dst[i / 8] |= (state & 1) << (i % 8);
+    state = (state >> 1) | (((state ^ (state >> 3)) & 1) << 30);
+  }
+}
+
+// The generators against the checkers, straight and after a jump
+bool self_check(uint8_t *buf, size_t len) {
+  const size_t n = 1 << 20;
+  uint8_t *ref = buf + len - n;
+  struct axis_word_128 *w = (struct axis_word_128 *)ref;
+
+  w[0] = {{0x12345678, 0x9ABCDEF0, 0x0F1E2D3C, 0x4B5A6978}};
+  for (size_t i = 1; i < n / 16; i++)
+    lfsr128(&w[i - 1], &w[i]);
+  XDMA_udrv::XPattern lfsr(XDMA_udrv::PAT_LFSR128, 0x9ABCDEF012345678,
+                           0x4B5A69780F1E2D3C);
+  lfsr.fill(buf, 0, n);
+  if (memcmp(buf, ref, n) || lfsr.check(ref + 4112, 4112, 65536) != 65536)
+    return false;
+
+  prbs31_ref(0x2468ACE, ref, n);
+  XDMA_udrv::XPattern prbs(XDMA_udrv::PAT_PRBS31, 0x2468ACE);
+  prbs.fill(buf, 0, n);
+  if (memcmp(buf, ref, n) || prbs.check(ref + 8192, 8192, 4096) != 4096)
+    return false;
+
+  // Threads start on jumped ahead states, the result has to be seamless
+  XDMA_udrv::pattern_fill_mt(lfsr, buf, 0, len - n, 4);
+  if (lfsr.check(buf + (len - n) / 2 - 512, (len - n) / 2 - 512, 1024) !=
+      1024)
+    return false;
+  buf[4096] ^= 1;
+  return lfsr.check(buf, 0, 8192) == 4096;
+}
+
+// Pattern generation throughput, per pattern and thread count
+int main(int argc, char const *argv[]) {
+  size_t size = (argc > 1) ? strtoull(argv[1], 0, 0) : (1UL << 30);
+  struct timespec tstart, tend;
+
+  uint8_t *buf = (uint8_t *)mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf == MAP_FAILED) {
+    perror("mmap()");
+    exit(1);
+  }
+  if (size < (4 << 20) || !self_check(buf, size)) {
+    cerr << "Pattern generator disagrees with the reference" << endl;
+    exit(1);
+  }
+
+  const char *names[] = {"lfsr128", "counter", "prbs31"};
+  unsigned n_cpu = thread::hardware_concurrency();
+  for (int t = XDMA_udrv::PAT_LFSR128; t <= XDMA_udrv::PAT_PRBS31; t++) {
+    XDMA_udrv::XPattern pat((XDMA_udrv::XDMA_PATTERN)t);
+    for (unsigned n = 1; n <= n_cpu; n *= 2) {
+      clock_gettime(CLOCK_MONOTONIC, &tstart);
+      XDMA_udrv::pattern_fill_mt(pat, buf, 0, size, n);
+      clock_gettime(CLOCK_MONOTONIC, &tend);
+      printf("%-8s %2u thread(s) %10.2lf MiB/s\n", names[t], n,
+             size / elapsed_s(tstart, tend) / (1 << 20));
+    }
+  }
+  munmap(buf, size);
+  return 0;
+}
+
+// Software implementation of 128-bit LFSR (bit 127, 125, 100, 98)
+void lfsr128(struct axis_word_128 *target, struct axis_word_128 *result) {
+  int zcnt = 0;
+  zcnt += (target->data[3] >> 31 & 1) ? 0 : 1;
+  zcnt += (target->data[3] >> 29 & 1) ? 0 : 1;
+  zcnt += (target->data[3] >> 4 & 1) ? 0 : 1;
+  zcnt += (target->data[3] >> 2 & 1) ? 0 : 1;
+  result->data[3] =
+      (target->data[3] << 1) | ((target->data[2] & (1 << 31)) ? 1 : 0);
+  result->data[2] =
+      (target->data[2] << 1) | ((target->data[1] & (1 << 31)) ? 1 : 0);
+  result->data[1] =
+      (target->data[1] << 1) | ((target->data[0] & (1 << 31)) ? 1 : 0);
+  result->data[0] = (target->data[0] << 1) | (zcnt & 1 ? 0 : 1);
+}
+
+struct timespec timediff(struct timespec start, struct timespec end) {
+  struct timespec temp;
+  if ((end.tv_nsec - start.tv_nsec) < 0) {
+    temp.tv_sec = end.tv_sec - start.tv_sec - 1;
+    temp.tv_nsec = 1000000000 + end.tv_nsec - start.tv_nsec;
+  } else {
+    temp.tv_sec = end.tv_sec - start.tv_sec;
+    temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  }
+  return temp;
+}
@@ -0,0 +1,166 @@
+#include <boost/program_options.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <inttypes.h>
+#include <time.h>
+
+#include "XDMA_pio.hpp"
+#include "XDMA_udrv.hpp"
+
+using namespace std;
+namespace po = boost::program_options;
+
+struct timespec timediff(struct timespec start, struct timespec end);
+uint64_t elapsed_ns(struct timespec start, struct timespec end);
+
+// Single descriptor H2C transfer from the 2 MiB page, polled to completion
+void h2c_oneshot(XDMA_udrv::XDMAEngine &h2c, XDMA_udrv::HugePageWrapper &page,
+                 uint64_t card_addr, size_t len) {
+  XDMA_udrv::xdma_desc *pdesc = (XDMA_udrv::xdma_desc *)page.getVAddr();
+  uint64_t src = page.getPAddr() + page.getLen() / 2;
+
+  memset(pdesc, 0, sizeof(*pdesc));
+  pdesc->control = __MASK_SHIFT__(16, 16, XDMA_DESC_MAGIC) | XDMA_DESC_STOP |
+                   XDMA_DESC_COMPLETED | XDMA_DESC_EOP;
+  pdesc->bytes = len;
+  pdesc->src_addr_lo = src;
+  pdesc->src_addr_hi = src >> 32;
+  pdesc->dst_addr_lo = card_addr;
+  pdesc->dst_addr_hi = card_addr >> 32;
+
+  h2c.start(page.getPAddr());
+  while (1) {
+    uint32_t ret = h2c.status();
+    if (ret != 0xFFFFFFFF && (ret & XDMA_CH_DESC_COMPLETED))
+      break;
+  }
+  h2c.stop();
+}
+
+int main(int argc, char const *argv[]) {
+  po::options_description desc("Allowed options");
+  desc.add_options()("help,h", "print usage message");
+  desc.add_options()("bar,b", po::value<int>()->default_value(-1),
+                     "User BAR index (default: first non-XDMA BAR)");
+  desc.add_options()("offset,o", po::value<string>()->default_value("0"),
+                     "Byte offset into the user BAR");
+  desc.add_options()("card-addr,a", po::value<string>()->default_value("0"),
+                     "H2C destination card address for the DMA case");
+  desc.add_options()("iter,n", po::value<int>()->default_value(1000),
+                     "Messages per size");
+  po::variables_map vm;
+  store(parse_command_line(argc, argv, desc), vm);
+
+  if (vm.count("help")) {
+    cout << desc << "\n";
+    return 0;
+  }
+
+  unique_ptr<XDMA_udrv::XDMA> xdma = XDMA_udrv::XDMA::XDMA_factory();
+  int bar = vm["bar"].as<int>();
+  size_t offset = strtoull(vm["offset"].as<string>().c_str(), 0, 0);
+  uint64_t card_addr = strtoull(vm["card-addr"].as<string>().c_str(), 0, 0);
+  int n_iter = vm["iter"].as<int>();
+  if (offset % 4) {
+    cerr << "--offset must be a multiple of 4" << endl;
+    exit(1);
+  }
+
+  if (bar == -1) {
+    for (int i = 0; i < XDMA_udrv::XDMA::num_of_bars_max; i++) {
+      if (i != xdma->get_xdma_bar_index() && xdma->bar_len(i)) {
+        bar = i;
+        break;
+      }
+    }
+  }
+  if (bar == -1 || !xdma->bar_len(bar)) {
+    cerr << "No user BAR available" << endl;
+    exit(1);
+  }
+  bool has_wc = xdma->map_bar_wc(bar);
+  XDMA_udrv::XDMAEngine h2c(*xdma, XDMA_udrv::DIR_H2C, 0);
+  if (!has_wc)
+    cerr << "BAR" << bar << " has no WC mapping, WC column skipped" << endl;
+
+  // Lower half descriptor, upper half source data for DMA
+  XDMA_udrv::HugePageWrapper page(XDMA_udrv::HUGE_2MiB);
+  vector<uint8_t> msg(1 << 16);
+  for (size_t i = 0; i < msg.size(); i++)
+    msg[i] = i;
+  memcpy((void *)((uintptr_t)page.getVAddr() + page.getLen() / 2), msg.data(),
+         msg.size());
+
+  volatile uint32_t *uc =
+      (volatile uint32_t *)((uintptr_t)xdma->bar_vaddr(bar) + offset);
+  uint8_t *wc = (uint8_t *)xdma->bar_vaddr_wc(bar);
+
+  printf("%8s %14s %14s %14s\n", "size", "UC ns/MiB/s", "WC ns/MiB/s",
+         "DMA ns/MiB/s");
+  for (size_t size = 8; size <= (1 << 16); size <<= 1) {
+    struct timespec tstart, tend;
+    uint64_t uc_ns, wc_ns = 0, dma_ns;
+
+    if (offset + size > xdma->bar_len(bar)) {
+      cerr << "Message of " << size << " bytes exceeds BAR" << bar << endl;
+      break;
+    }
+
+    // Read back after each message so posted writes are accounted for
+    clock_gettime(CLOCK_MONOTONIC, &tstart);
+    for (int i = 0; i < n_iter; i++) {
+      XDMA_udrv::pio_copy_uc(uc, msg.data(), size);
+      (void)*uc;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &tend);
+    uc_ns = elapsed_ns(tstart, tend) / n_iter;
+
+    if (has_wc) {
+      clock_gettime(CLOCK_MONOTONIC, &tstart);
+      for (int i = 0; i < n_iter; i++) {
+        XDMA_udrv::pio_copy_wc(wc + offset, msg.data(), size);
+        XDMA_udrv::pio_flush();
+        (void)*uc;
+      }
+      clock_gettime(CLOCK_MONOTONIC, &tend);
+      wc_ns = elapsed_ns(tstart, tend) / n_iter;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &tstart);
+    for (int i = 0; i < n_iter; i++)
+      h2c_oneshot(h2c, page, card_addr, size);
+    clock_gettime(CLOCK_MONOTONIC, &tend);
+    dma_ns = elapsed_ns(tstart, tend) / n_iter;
+
+    auto mibps = [size](uint64_t ns) {
+      return ns ? (double)size / ns * 1e9 / (1 << 20) : 0.0;
+    };
+    printf("%8zu %6" PRIu64 "/%7.1lf %6" PRIu64 "/%7.1lf %6" PRIu64
+           "/%7.1lf\n",
+           size, uc_ns, mibps(uc_ns), wc_ns, mibps(wc_ns), dma_ns,
+           mibps(dma_ns));
+  }
+
+  return 0;
+}
+
+uint64_t elapsed_ns(struct timespec start, struct timespec end) {
+  struct timespec tdiff = timediff(start, end);
+  return tdiff.tv_sec * 1000000000ULL + tdiff.tv_nsec;
+}
+
+struct timespec timediff(struct timespec start, struct timespec end) {
+  struct timespec temp;
+  if ((end.tv_nsec - start.tv_nsec) < 0) {
+    temp.tv_sec = end.tv_sec - start.tv_sec - 1;
+    temp.tv_nsec = 1000000000 + end.tv_nsec - start.tv_nsec;
+  } else {
+    temp.tv_sec = end.tv_sec - start.tv_sec;
+    temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  }
+  return temp;
+}
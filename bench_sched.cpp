@@ -0,0 +1,113 @@
+#include <boost/program_options.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <inttypes.h>
+#include <time.h>
+
+#include "XDMA_sched.hpp"
+#include "XDMA_udrv.hpp"
+
+using namespace std;
+namespace po = boost::program_options;
+
+struct timespec timediff(struct timespec start, struct timespec end);
+
+// Run count requests of size bytes through one scheduler configuration
+void run(XDMA_udrv::XDMA &xdma, XDMA_udrv::HugePageWrapper &page,
+         const po::variables_map &vm, const string &mode) {
+  XDMA_udrv::XDMA_DIR dir = (vm["dir"].as<string>() == "c2h")
+                                ? XDMA_udrv::DIR_C2H
+                                : XDMA_udrv::DIR_H2C;
+  uint64_t size = strtoull(vm["size"].as<string>().c_str(), 0, 0);
+  uint64_t count = vm["count"].as<uint64_t>();
+  uint32_t burst = vm["burst"].as<uint32_t>();
+  uint32_t n_ch = vm["channels"].as<uint32_t>();
+  vector<unique_ptr<XDMA_udrv::XDMAEngine>> engines;
+  vector<XDMA_udrv::xfer_done> done;
+  struct timespec tstart, tend, tdiff;
+
+  // naive: one engine start per request, what the tools did so far
+  XDMA_udrv::XScheduler sched(mode == "link", 4096,
+                              (mode == "naive") ? 1 : 1024);
+  for (uint32_t c = 0; c < n_ch; c++) {
+    engines.push_back(make_unique<XDMA_udrv::XDMAEngine>(xdma, dir, c));
+    sched.add_engine(*engines.back());
+  }
+
+  uint64_t submitted = 0, completed = 0;
+  clock_gettime(CLOCK_MONOTONIC, &tstart);
+  while (completed < count) {
+    for (uint32_t i = 0; i < burst && submitted < count; i++, submitted++) {
+      XDMA_udrv::xfer_request req = {};
+      req.id = submitted;
+      req.dir = dir;
+      req.channel = -1;
+      req.host_paddr = page.getPAddr() + (submitted * size) % page.getLen();
+      req.len = size;
+      sched.submit(req);
+    }
+    done.clear();
+    completed += sched.poll(done);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &tend);
+  tdiff = timediff(tstart, tend);
+  double duration_s = tdiff.tv_sec + tdiff.tv_nsec / 1e9;
+
+  printf("%-6s %10.0lf req/s %10.2lf MiB/s  batching %.2lf (%" PRIu64
+         " doorbells)\n",
+         mode.c_str(), count / duration_s,
+         count * size / duration_s / (1 << 20), sched.getBatchingFactor(),
+         sched.getDoorbells());
+}
+
+int main(int argc, char const *argv[]) {
+  po::options_description desc("Allowed options");
+  desc.add_options()("help,h", "print usage message");
+  desc.add_options()("dir,d", po::value<string>()->default_value("h2c"),
+                     "h2c or c2h");
+  desc.add_options()("size,s", po::value<string>()->default_value("4096"),
+                     "Bytes per request");
+  desc.add_options()("count,n", po::value<uint64_t>()->default_value(100000),
+                     "# of requests");
+  desc.add_options()("burst,b", po::value<uint32_t>()->default_value(64),
+                     "Requests submitted between polls");
+  desc.add_options()("channels,c", po::value<uint32_t>()->default_value(1),
+                     "# of channels to spread requests over");
+  desc.add_options()("mode,m", po::value<string>(),
+                     "naive, batch or link (default: all)");
+  po::variables_map vm;
+  store(parse_command_line(argc, argv, desc), vm);
+
+  if (vm.count("help")) {
+    cout << desc << "\n";
+    return 0;
+  }
+
+  unique_ptr<XDMA_udrv::XDMA> xdma = XDMA_udrv::XDMA::XDMA_factory();
+  XDMA_udrv::HugePageWrapper page(XDMA_udrv::HUGE_1GiB);
+
+  if (vm.count("mode")) {
+    run(*xdma, page, vm, vm["mode"].as<string>());
+  } else {
+    for (auto mode : {"naive", "batch", "link"})
+      run(*xdma, page, vm, mode);
+  }
+  return 0;
+}
+
+struct timespec timediff(struct timespec start, struct timespec end) {
+  struct timespec temp;
+  if ((end.tv_nsec - start.tv_nsec) < 0) {
+    temp.tv_sec = end.tv_sec - start.tv_sec - 1;
+    temp.tv_nsec = 1000000000 + end.tv_nsec - start.tv_nsec;
+  } else {
+    temp.tv_sec = end.tv_sec - start.tv_sec;
+    temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  }
+  return temp;
+}
@@ -0,0 +1,82 @@
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "XDMA_udrv.hpp"
+
+using namespace std;
+
+struct timespec timediff(struct timespec start, struct timespec end);
+
+// Open and close the device n_iter times, report min/avg wall time
+void bench(const string &name, int n_iter,
+           function<unique_ptr<XDMA_udrv::XDMA>()> open_fn) {
+  uint64_t min_ns = UINT64_MAX, sum_ns = 0;
+  for (int i = 0; i < n_iter; i++) {
+    struct timespec tstart, tend, tdiff;
+    clock_gettime(CLOCK_MONOTONIC, &tstart);
+    unique_ptr<XDMA_udrv::XDMA> xdma = open_fn();
+    // First register read included, this is what a restarted process waits on
+    xdma->ctrl_reg_read(XDMA_udrv::CONFIG, 0, 0);
+    clock_gettime(CLOCK_MONOTONIC, &tend);
+    tdiff = timediff(tstart, tend);
+    uint64_t ns = tdiff.tv_sec * 1000000000ULL + tdiff.tv_nsec;
+    min_ns = (ns < min_ns) ? ns : min_ns;
+    sum_ns += ns;
+  }
+  printf("%-24s min %10.2lf us  avg %10.2lf us\n", name.c_str(),
+         min_ns / 1000.0, (double)sum_ns / n_iter / 1000.0);
+}
+
+int main(int argc, char const *argv[]) {
+  int n_iter = (argc > 1) ? atoi(argv[1]) : 100;
+  string cache_path = "/tmp/xdma_udrv_enum." + to_string(getpid());
+  XDMA_udrv::XDMA_factory_opt opt;
+
+  cout << "XDMA_factory startup time over " << n_iter << " iteration(s)"
+       << endl;
+
+  bench("legacy (regex, /dev/mem)", n_iter,
+        []() { return XDMA_udrv::XDMA::XDMA_factory(); });
+
+  opt.map_method = XDMA_udrv::BAR_MAP_DEVMEM;
+  bench("sysfs, /dev/mem", n_iter,
+        [&]() { return XDMA_udrv::XDMA::XDMA_factory(opt); });
+
+  opt.map_method = XDMA_udrv::BAR_MAP_UIO;
+  bench("sysfs, /dev/uioN", n_iter,
+        [&]() { return XDMA_udrv::XDMA::XDMA_factory(opt); });
+
+  opt.map_method = XDMA_udrv::BAR_MAP_RESOURCE;
+  bench("sysfs, resourceN", n_iter,
+        [&]() { return XDMA_udrv::XDMA::XDMA_factory(opt); });
+
+  // First call populates the cache, the rest hit it
+  opt.map_method = XDMA_udrv::BAR_MAP_UIO;
+  opt.cache_path = cache_path.c_str();
+  XDMA_udrv::XDMA::XDMA_factory(opt);
+  bench("cached, /dev/uioN", n_iter,
+        [&]() { return XDMA_udrv::XDMA::XDMA_factory(opt); });
+  unlink(cache_path.c_str());
+
+  return 0;
+}
+
+struct timespec timediff(struct timespec start, struct timespec end) {
+  struct timespec temp;
+  if ((end.tv_nsec - start.tv_nsec) < 0) {
+    temp.tv_sec = end.tv_sec - start.tv_sec - 1;
+    temp.tv_nsec = 1000000000 + end.tv_nsec - start.tv_nsec;
+  } else {
+    temp.tv_sec = end.tv_sec - start.tv_sec;
+    temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  }
+  return temp;
+}
@@ -0,0 +1,181 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "XDMA_stream.hpp"
+#include "XDMA_udrv.hpp"
+
+using namespace std;
+
+struct timespec timediff(struct timespec start, struct timespec end);
+
+double elapsed_s(struct timespec start, struct timespec end) {
+  struct timespec tdiff = timediff(start, end);
+  return tdiff.tv_sec + tdiff.tv_nsec / 1e9;
+}
+
+// Something for the consumer to do with each byte
+uint64_t sum(const uint8_t *p, size_t len) {
+  uint64_t s = 0, v;
+  for (size_t i = 0; i + 8 <= len; i += 8) {
+    memcpy(&v, p + i, 8);
+    s += v;
+  }
+  return s;
+}
+
+// Seconds per walk over an application working set
+double walk(const uint8_t *ws, size_t len) {
+  struct timespec tstart, tend;
+  volatile uint8_t sink = 0;
+  clock_gettime(CLOCK_MONOTONIC, &tstart);
+  for (size_t i = 0; i < len; i += 64)
+    sink += ws[i];
+  clock_gettime(CLOCK_MONOTONIC, &tend);
+  return elapsed_s(tstart, tend);
+}
+
+const size_t distances[] = {0, 512, 1024, 2048, 4096, 8192, 16384};
+
+// Copy and consume a buffer much larger than the LLC, as after a capture:
+// memcpy against stream_copy, a plain linear walk against one led by
+// prefetch, and what each copy leaves of a working set in the cache
+int main(int argc, char const *argv[]) {
+  size_t size = (argc > 1) ? strtoull(argv[1], 0, 0) : (1UL << 30);
+  size_t block = 4096;
+  struct timespec tstart, tend;
+  uint64_t check = 0;
+
+  size = size / block * block;
+  if (!size) {
+    cerr << "Size of at least " << block << " byte(s) please" << endl;
+    exit(1);
+  }
+  uint8_t *src = (uint8_t *)mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  uint8_t *dst = (uint8_t *)mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (src == MAP_FAILED || dst == MAP_FAILED) {
+    perror("mmap()");
+    exit(1);
+  }
+  madvise(src, size, MADV_HUGEPAGE);
+  madvise(dst, size, MADV_HUGEPAGE);
+  for (size_t i = 0; i < size; i++)
+    src[i] = i * 131 + (i >> 17);
+  memset(dst, 0, size);
+
+  printf("%zu byte(s)\n", size);
+  clock_gettime(CLOCK_MONOTONIC, &tstart);
+  memcpy(dst, src, size);
+  clock_gettime(CLOCK_MONOTONIC, &tend);
+  printf("%-28s %10.2lf MiB/s\n", "memcpy",
+         size / elapsed_s(tstart, tend) / (1 << 20));
+  for (size_t d : distances) {
+    memset(dst, 0, 4096);
+    clock_gettime(CLOCK_MONOTONIC, &tstart);
+    XDMA_udrv::stream_copy(dst, src, size, d);
+    clock_gettime(CLOCK_MONOTONIC, &tend);
+    if (memcmp(dst, src, size)) {
+      cerr << "stream_copy() corrupted the copy" << endl;
+      exit(1);
+    }
+    printf("stream_copy, distance %-6zu %10.2lf MiB/s\n", d,
+           size / elapsed_s(tstart, tend) / (1 << 20));
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &tstart);
+  check = sum(src, size);
+  clock_gettime(CLOCK_MONOTONIC, &tend);
+  printf("%-28s %10.2lf MiB/s\n", "linear read",
+         size / elapsed_s(tstart, tend) / (1 << 20));
+  for (size_t d : distances) {
+    if (!d)
+      continue;
+    uint64_t s = 0;
+    clock_gettime(CLOCK_MONOTONIC, &tstart);
+    for (size_t off = 0; off < size; off += block) {
+      XDMA_udrv::prefetch_range(src + off + d,
+                              (off + d < size) ? block : 0);
+      s += sum(src + off, block);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &tend);
+    if (s != check) {
+      cerr << "prefetched read disagrees with the linear one" << endl;
+      exit(1);
+    }
+    printf("prefetched read, dist %-6zu %10.2lf MiB/s\n", d,
+           size / elapsed_s(tstart, tend) / (1 << 20));
+  }
+
+  // Half the LLC stands in for the application's working set
+  long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  size_t ws_len = (llc > 0) ? llc / 2 : (4UL << 20);
+  uint8_t *ws = (uint8_t *)malloc(ws_len);
+  memset(ws, 1, ws_len);
+  walk(ws, ws_len);
+  printf("working set of %zu byte(s), %.2lf ns/line warm\n", ws_len,
+         walk(ws, ws_len) * 1e9 / (ws_len / 64));
+  walk(ws, ws_len);
+  memcpy(dst, src, size);
+  printf("  after memcpy      %6.2lf ns/line\n",
+         walk(ws, ws_len) * 1e9 / (ws_len / 64));
+  walk(ws, ws_len);
+  XDMA_udrv::stream_copy(dst, src, size);
+  printf("  after stream_copy %6.2lf ns/line\n",
+         walk(ws, ws_len) * 1e9 / (ws_len / 64));
+  free(ws);
+  munmap(dst, size);
+  munmap(src, size);
+
+  // Through an XSGBuffer if the hugepages are there, chunks of 1 MiB
+  size_t sg_size = (size < XDMA_udrv::XSGB_MAX_SIZE) ? size
+                                                     : XDMA_udrv::XSGB_MAX_SIZE;
+  unique_ptr<XDMA_udrv::XSGBuffer> buffer;
+  try {
+    buffer = make_unique<XDMA_udrv::XSGBuffer>(sg_size, 1 << 20);
+  } catch (const exception &e) {
+    printf("XStreamReader skipped, no hugepages (%s)\n", e.what());
+    return 0;
+  }
+  buffer->initialize();
+  for (uint32_t i = 0; i < buffer->getNrPg(); i++)
+    memset(buffer->getDataBufferVaddr(i), 0x5a, 1UL << 30);
+  check = 0;
+  for (size_t d : distances) {
+    XDMA_udrv::XStreamReader reader(*buffer, d);
+    uint64_t s = 0;
+    clock_gettime(CLOCK_MONOTONIC, &tstart);
+    uint64_t bytes = reader.for_each(
+        [&](const uint8_t *p, size_t len) { s += sum(p, len); });
+    clock_gettime(CLOCK_MONOTONIC, &tend);
+    if (bytes != sg_size || (check && s != check)) {
+      cerr << "XStreamReader lost bytes" << endl;
+      exit(1);
+    }
+    check = s;
+    printf("XStreamReader, distance %-4zu %10.2lf MiB/s\n", d,
+           bytes / elapsed_s(tstart, tend) / (1 << 20));
+  }
+  return 0;
+}
+
+struct timespec timediff(struct timespec start, struct timespec end) {
+  struct timespec temp;
+  if ((end.tv_nsec - start.tv_nsec) < 0) {
+    temp.tv_sec = end.tv_sec - start.tv_sec - 1;
+    temp.tv_nsec = 1000000000 + end.tv_nsec - start.tv_nsec;
+  } else {
+    temp.tv_sec = end.tv_sec - start.tv_sec;
+    temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  }
+  return temp;
+}
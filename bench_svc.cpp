@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <inttypes.h>
+
+#include "XDMA_svc.hpp"
+#include "XDMA_timing.hpp"
+
+using namespace std;
+namespace po = boost::program_options;
+
+/*
+Client side of xdma_svcd: H2C a buffer to card address 0, C2H it back into
+the other half and compare, then time count transfers of size bytes with
+depth in flight. Needs a card (or the software device) that reads back
+what was written, AXI-MM style.
+*/
+int main(int argc, char const *argv[]) {
+  po::options_description desc("Allowed options");
+  desc.add_options()("help,h", "print usage message");
+  desc.add_options()("sock,s", po::value<string>()->default_value(""),
+                     "Daemon socket (default: the uio0 one)");
+  desc.add_options()("size", po::value<uint64_t>()->default_value(1 << 20),
+                     "Bytes per transfer");
+  desc.add_options()("count,n", po::value<uint64_t>()->default_value(10000),
+                     "Transfers to time");
+  desc.add_options()("depth,d", po::value<uint32_t>()->default_value(32),
+                     "Transfers in flight");
+  po::variables_map vm;
+  store(parse_command_line(argc, argv, desc), vm);
+
+  if (vm.count("help")) {
+    cout << desc << "\n";
+    return 0;
+  }
+  uint64_t size = vm["size"].as<uint64_t>();
+  uint64_t count = vm["count"].as<uint64_t>();
+  uint32_t depth = vm["depth"].as<uint32_t>();
+  if (!count) {
+    cerr << "Please specify at least one transfer" << endl;
+    exit(1);
+  }
+  if (!size || size > (256 << 20) || !depth || depth > XDMA_SVC_SQ_ENTRIES) {
+    cerr << "Size up to 256 MiB and depth up to " << XDMA_SVC_SQ_ENTRIES
+         << " please" << endl;
+    exit(1);
+  }
+
+  try {
+    XDMA_udrv::XSvcClient client(1, vm["sock"].as<string>());
+    uint8_t *buf = (uint8_t *)client.getBuffer();
+    uint64_t half = client.getBufferLen() / 2;
+    vector<XDMA_udrv::xsvc_cqe> done;
+
+    // Round trip through card memory
+    for (uint64_t i = 0; i < size; i++)
+      buf[i] = i * 7 + (i >> 13);
+    memset(buf + half, 0, size);
+    client.submit(0, XDMA_udrv::DIR_H2C, 0, size);
+    while (done.empty())
+      client.poll(done);
+    client.submit(1, XDMA_udrv::DIR_C2H, half, size);
+    while (done.size() < 2)
+      client.poll(done);
+    if (done[0].status || done[1].status || memcmp(buf, buf + half, size)) {
+      cerr << "Read back differs from what was written" << endl;
+      exit(1);
+    }
+    printf("Read back %" PRIu64 " byte(s) intact\n", size);
+
+    // Ring latency and throughput, H2C and C2H alternating
+    vector<uint64_t> t_submit(count), lat(count);
+    uint64_t submitted = 0, completed = 0, n_slot = half / size;
+    uint64_t t0 = XDMA_udrv::tsc_read();
+    while (completed < count) {
+      while (submitted < count && submitted - completed < depth) {
+        uint64_t off = (submitted % n_slot) * size;
+        auto dir = (submitted & 1) ? XDMA_udrv::DIR_C2H : XDMA_udrv::DIR_H2C;
+        if (!client.submit(submitted, dir, off, size, off))
+          break;
+        t_submit[submitted++] = XDMA_udrv::tsc_read();
+      }
+      done.clear();
+      client.poll(done);
+      uint64_t now = XDMA_udrv::tsc_read();
+      for (auto &c : done) {
+        if (c.status) {
+          cerr << "Transfer " << c.id << " failed: " << c.status << endl;
+          exit(1);
+        }
+        lat[c.id] = now - t_submit[c.id];
+      }
+      completed += done.size();
+    }
+    double duration_ns = (XDMA_udrv::tsc_read() - t0) / XDMA_udrv::tsc_per_ns();
+    sort(lat.begin(), lat.end());
+    double tpn = XDMA_udrv::tsc_per_ns();
+    printf("%" PRIu64 " transfer(s) of %" PRIu64 " byte(s), depth %u: "
+           "%.0lf/s, %.2lf MiB/s\n",
+           count, size, depth, count / duration_ns * 1e9,
+           count * size / duration_ns * 1e9 / (1 << 20));
+    printf("submit to completion ns: min %.0lf p50 %.0lf p99 %.0lf max %.0lf\n",
+           lat[0] / tpn, lat[count / 2] / tpn, lat[(count - 1) * 99 / 100] / tpn,
+           lat[count - 1] / tpn);
+  } catch (const system_error &e) {
+    cerr << "bench_svc: " << e.what() << endl;
+    exit(1);
+  }
+  return 0;
+}
@@ -0,0 +1,44 @@
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+
+#include "XDMA_timing.hpp"
+#include "XDMA_trace.hpp"
+
+using namespace std;
+
+// Cost of one traced scope, compared against the same empty loop untraced
+int main(int argc, char const *argv[]) {
+  uint64_t n_iter = (argc > 1) ? strtoull(argv[1], 0, 0) : 10000000;
+  volatile uint64_t sink = 0;
+  uint64_t t0, t1, t2, t3;
+
+#ifndef XDMA_TRACE
+  cout << "Built without TRACE=1, measuring the compiled-out macros" << endl;
+#endif
+  t0 = XDMA_udrv::tsc_read();
+  for (uint64_t i = 0; i < n_iter; i++) {
+    sink = sink + i;
+  }
+  t1 = XDMA_udrv::tsc_read();
+  for (uint64_t i = 0; i < n_iter; i++) {
+    XDMA_TRACE_SCOPE("bench");
+    sink = sink + i;
+  }
+  t2 = XDMA_udrv::tsc_read();
+  // rdtsc alone, it dominates the event cost and traps on some hypervisors
+  for (uint64_t i = 0; i < n_iter; i++) {
+    sink = sink + XDMA_udrv::tsc_read();
+  }
+  t3 = XDMA_udrv::tsc_read();
+
+  double base = (t1 - t0) / XDMA_udrv::tsc_per_ns() / n_iter;
+  double traced = (t2 - t1) / XDMA_udrv::tsc_per_ns() / n_iter;
+  double rdtsc = (t3 - t2) / XDMA_udrv::tsc_per_ns() / n_iter - base;
+  // A scope takes two timestamps and writes one event
+  printf("baseline %.2lf ns/iter, traced %.2lf ns/iter\n", base, traced);
+  printf("overhead %.2lf ns/scope, rdtsc %.2lf ns\n", traced - base, rdtsc);
+  if (argc > 2 && !XDMA_udrv::trace_dump_chrome(argv[2]))
+    cerr << "Trace not written" << endl;
+  return 0;
+}
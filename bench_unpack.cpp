@@ -0,0 +1,128 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "XDMA_unpack.hpp"
+
+using namespace std;
+
+struct timespec timediff(struct timespec start, struct timespec end);
+
+double elapsed_s(struct timespec start, struct timespec end) {
+  struct timespec tdiff = timediff(start, end);
+  return tdiff.tv_sec + tdiff.tv_nsec / 1e9;
+}
+
+// Every lane count and sample size against deinterleave_sw(), lengths that
+// leave a scalar tail behind the SIMD blocks
+bool self_check(const uint8_t *buf) {
+  for (uint32_t sb : {1, 2, 4, 8}) {
+    for (uint32_t n = 1; n <= 16; n++) {
+      size_t len = (4096 + 3) * n * sb;
+      vector<vector<uint8_t>> a(n, vector<uint8_t>(len / n)),
+          b(n, vector<uint8_t>(len / n));
+      vector<void *> pa(n), pb(n);
+      for (uint32_t l = 0; l < n; l++) {
+        pa[l] = a[l].data();
+        pb[l] = b[l].data();
+      }
+      XDMA_udrv::deinterleave(buf + 16, len, n, sb, pa.data());
+      XDMA_udrv::deinterleave_sw(buf + 16, len, n, sb, pb.data());
+      if (a != b) {
+        cerr << "deinterleave() disagrees with deinterleave_sw() for " << n
+             << " lane(s) of " << sb << " byte(s)" << endl;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Deinterleave throughput, single call and pooled over chunks with the lanes
+// going to /dev/null, as pcicat --lanes does with files
+int main(int argc, char const *argv[]) {
+  size_t size = (argc > 1) ? strtoull(argv[1], 0, 0) : (1UL << 30);
+  uint32_t n_lanes = (argc > 2) ? strtoul(argv[2], 0, 0) : 8;
+  uint32_t sb = (argc > 3) ? strtoul(argv[3], 0, 0) : 2;
+  uint32_t frame = n_lanes * sb;
+  // Whole frames per chunk
+  size_t chunk = (4UL << 20) / frame * frame;
+  struct timespec tstart, tend;
+
+  if (!n_lanes || n_lanes > 64 || (sb != 1 && sb != 2 && sb != 4 && sb != 8)) {
+    cerr << "1 to 64 lanes of 1, 2, 4 or 8 bytes please" << endl;
+    exit(1);
+  }
+  size = size / chunk * chunk / frame * frame;
+  if (!size) {
+    cerr << "Size of at least " << chunk << " byte(s) please" << endl;
+    exit(1);
+  }
+  uint8_t *buf = (uint8_t *)mmap(nullptr, size + 4096, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  uint8_t *out = (uint8_t *)mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf == MAP_FAILED || out == MAP_FAILED) {
+    perror("mmap()");
+    exit(1);
+  }
+  for (size_t i = 0; i < size + 4096; i++)
+    buf[i] = i * 131 + (i >> 17);
+  memset(out, 0, size);
+
+  if (!self_check(buf))
+    exit(1);
+
+  vector<void *> dst(n_lanes);
+  for (uint32_t l = 0; l < n_lanes; l++)
+    dst[l] = out + l * (size / n_lanes);
+  printf("%u lane(s) of %u byte(s), %zu byte(s)\n", n_lanes, sb, size);
+
+  clock_gettime(CLOCK_MONOTONIC, &tstart);
+  XDMA_udrv::deinterleave_sw(buf, size, n_lanes, sb, dst.data());
+  clock_gettime(CLOCK_MONOTONIC, &tend);
+  printf("%-24s %10.2lf MiB/s\n", "scalar",
+         size / elapsed_s(tstart, tend) / (1 << 20));
+
+  clock_gettime(CLOCK_MONOTONIC, &tstart);
+  XDMA_udrv::deinterleave(buf, size, n_lanes, sb, dst.data());
+  clock_gettime(CLOCK_MONOTONIC, &tend);
+  printf("%-24s %10.2lf MiB/s\n", "deinterleave, 1 thread",
+         size / elapsed_s(tstart, tend) / (1 << 20));
+
+  vector<string> null_lanes(n_lanes, "/dev/null");
+  unsigned n_cpu = thread::hardware_concurrency();
+  for (unsigned n = 1; n <= n_cpu; n *= 2) {
+    XDMA_udrv::XUnpackPool pool(null_lanes, sb, n);
+    clock_gettime(CLOCK_MONOTONIC, &tstart);
+    for (size_t off = 0; off < size; off += chunk)
+      pool.submit(buf + off, chunk, off);
+    pool.wait();
+    clock_gettime(CLOCK_MONOTONIC, &tend);
+    printf("pool, %2u thread(s)        %10.2lf MiB/s\n", n,
+           size / elapsed_s(tstart, tend) / (1 << 20));
+  }
+  munmap(out, size);
+  munmap(buf, size + 4096);
+  return 0;
+}
+
+struct timespec timediff(struct timespec start, struct timespec end) {
+  struct timespec temp;
+  if ((end.tv_nsec - start.tv_nsec) < 0) {
+    temp.tv_sec = end.tv_sec - start.tv_sec - 1;
+    temp.tv_nsec = 1000000000 + end.tv_nsec - start.tv_nsec;
+  } else {
+    temp.tv_sec = end.tv_sec - start.tv_sec;
+    temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  }
+  return temp;
+}
@@ -0,0 +1,109 @@
+#include <boost/program_options.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "XDMA_capture.hpp"
+
+using namespace std;
+namespace po = boost::program_options;
+
+// Show or extract an indexed capture written by pcicat --container
+int main(int argc, char const *argv[]) {
+  po::options_description desc("Allowed options");
+  desc.add_options()("help,h", "print usage message");
+  desc.add_options()("file,f", po::value<string>(), "Capture file");
+  desc.add_options()("chunks", "List every chunk");
+  desc.add_options()("verify", "Check every chunk against its CRC32C");
+  desc.add_options()("extract,x", po::value<uint64_t>(), "Extract this chunk");
+  desc.add_options()("segment,g", po::value<uint32_t>(),
+                     "Extract this segment (--size index of pcicat)");
+  desc.add_options()("output,o", po::value<string>(),
+                     "Extract to this file (default: stdout)");
+  po::positional_options_description pos;
+  pos.add("file", 1);
+  po::variables_map vm;
+  store(po::command_line_parser(argc, argv).options(desc).positional(pos).run(),
+        vm);
+
+  if (vm.count("help") || !vm.count("file")) {
+    cout << desc << "\n";
+    return vm.count("help") ? 0 : 1;
+  }
+
+  XDMA_udrv::XCaptureReader cap(vm["file"].as<string>());
+  const XDMA_udrv::xcap_header &hdr = cap.getHeader();
+
+  if (vm.count("extract") || vm.count("segment")) {
+    int out = STDOUT_FILENO;
+    if (vm.count("output")) {
+      out = open(vm["output"].as<string>().c_str(),
+                 O_WRONLY | O_CREAT | O_TRUNC, 0664);
+      if (out < 0) {
+        perror("open()");
+        exit(1);
+      }
+    }
+    for (uint64_t i = 0; i < cap.getNrChunks(); i++) {
+      if (vm.count("extract") && i != vm["extract"].as<uint64_t>())
+        continue;
+      if (vm.count("segment") &&
+          cap.getIndex(i).segment != vm["segment"].as<uint32_t>())
+        continue;
+      if (write(out, cap.getChunk(i), cap.getIndex(i).length) < 0) {
+        perror("write()");
+        exit(1);
+      }
+    }
+    return 0;
+  }
+
+  uint64_t total = 0;
+  for (uint64_t i = 0; i < cap.getNrChunks(); i++)
+    total += cap.getIndex(i).length;
+  printf("version %" PRIu32 ", %" PRIu64 " chunk(s) of up to %" PRIu32
+         " bytes in %" PRIu32 " segment(s), %" PRIu64 " bytes\n",
+         hdr.version, hdr.n_chunks, hdr.chunk_size, hdr.n_segments, total);
+  printf("index at 0x%" PRIX64 ", data at 0x%" PRIX64 "\n", hdr.index_offset,
+         hdr.data_offset);
+  if (cap.getNrChunks()) {
+    printf("last completion %.3lf ms after the doorbell\n",
+           cap.getChunkNs(cap.getNrChunks() - 1) / 1e6);
+  }
+
+  if (vm.count("verify")) {
+    uint64_t n_bad = 0;
+    if (!cap.hasCrc()) {
+      cerr << "Captured without --crc, nothing to verify" << endl;
+      exit(1);
+    }
+    for (uint64_t i = 0; i < cap.getNrChunks(); i++) {
+      if (!cap.verify(i)) {
+        printf("chunk %" PRIu64 ": CRC32C mismatch\n", i);
+        n_bad++;
+      }
+    }
+    printf("%" PRIu64 " of %" PRIu64 " chunk(s) bad\n", n_bad,
+           cap.getNrChunks());
+    if (n_bad)
+      return 2;
+  }
+
+  if (vm.count("chunks")) {
+    printf("%8s %4s %14s %10s %10s %10s %14s\n", "chunk", "seg", "offset",
+           "length", "status", "crc32c", "t (us)");
+    for (uint64_t i = 0; i < cap.getNrChunks(); i++) {
+      const XDMA_udrv::xcap_index &e = cap.getIndex(i);
+      printf("%8" PRIu64 " %4" PRIu32 " %14" PRIu64 " %10" PRIu32
+             " 0x%08" PRIX32 " 0x%08" PRIX32 " %14.3lf\n",
+             i, e.segment, e.offset, e.length, e.status, e.crc32c,
+             cap.getChunkNs(i) / 1000);
+    }
+  }
+  return 0;
+}
@@ -15,7 +15,16 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include "XDMA_capture.hpp"
+#include "XDMA_chunks.hpp"
+#include "XDMA_crc.hpp"
+#include "XDMA_hugeplan.hpp"
+#include "XDMA_poll.hpp"
+#include "XDMA_sink.hpp"
+#include "XDMA_timing.hpp"
+#include "XDMA_trace.hpp"
 #include "XDMA_udrv.hpp"
+#include "XDMA_unpack.hpp"
 #include "pcicat.hpp"
 
 using namespace std;
@@ -30,14 +39,52 @@ void lfsr128(struct axis_word_128 *target, struct axis_word_128 *result);
 void hexdump(const void *data, size_t size);
 int compare_axis_word(struct axis_word_128 *left, struct axis_word_128 *right);
 struct timespec timediff(struct timespec start, struct timespec end);
+int packet_capture(const po::variables_map &vm);
+string insert_tag(const string &fname, const string &tag);
 
 int main(int argc, char const *argv[]) {
   po::options_description desc("Allowed options");
   desc.add_options()("help,h", "print usage message");
   desc.add_options()("size,s", po::value<vector<string>>()->multitoken(),
-                     "Transfer size in bytes");
+                     "Transfer size in bytes, \"max\" for the largest buffer "
+                     "the free hugepages allow");
+  desc.add_options()("reserve",
+                     "Grow the hugepage pools if the transfer doesn't fit");
   desc.add_options()("fname,f", po::value<string>()->default_value("dump.bin"),
                      "Name of dump file");
+  desc.add_options()("packets,p", po::value<uint64_t>(),
+                     "Packet mode: receive this many EOP-framed packets");
+  desc.add_options()("desc-size", po::value<uint32_t>()->default_value(4096),
+                     "Packet mode: bytes per descriptor");
+  desc.add_options()("ring", po::value<uint32_t>()->default_value(4096),
+                     "Packet mode: # of descriptors in the ring");
+  desc.add_options()("timeout-ms", po::value<uint32_t>()->default_value(0),
+                     "Give up after this long without traffic, 0 waits "
+                     "forever");
+  desc.add_options()("container",
+                     "Write one indexed capture file (see capinfo) to fname");
+  desc.add_options()("crc", po::value<unsigned>(),
+                     "CRC32C every chunk on this many threads");
+  desc.add_options()("lanes", po::value<uint32_t>(),
+                     "Deinterleave this many lanes into planar files "
+                     "<fname>.lane<k>");
+  desc.add_options()("sample-bytes", po::value<uint32_t>()->default_value(2),
+                     "With --lanes, bytes per sample (1, 2, 4 or 8)");
+  desc.add_options()("unpack-threads", po::value<unsigned>()->default_value(2),
+                     "With --lanes, deinterleave on this many threads");
+  desc.add_options()("progressive",
+                     "Write each chunk to its segment file as it completes");
+  desc.add_options()("stripe", po::value<vector<string>>()->multitoken(),
+                     "Stripe chunks over these directories, one writer each");
+  desc.add_options()("timeline,t", "Report per-descriptor completion timing");
+  desc.add_options()("chunks", "With --timeline, list every chunk");
+  desc.add_options()("stats", "Publish live counters for xdma_top");
+  desc.add_options()("cpu", po::value<int>(),
+                     "Pin the polling thread to this core");
+  desc.add_options()("adaptive",
+                     "Back off (pause/umwait) while waiting on completions");
+  desc.add_options()("trace", po::value<string>(),
+                     "Dump Chrome trace JSON here (needs make TRACE=1)");
   po::variables_map vm;
   store(parse_command_line(argc, argv, desc), vm);
 
@@ -46,6 +93,10 @@ int main(int argc, char const *argv[]) {
     return 0;
   }
 
+  if (vm.count("packets")) {
+    return packet_capture(vm);
+  }
+
   if (!vm.count("size")) {
     cerr << "Please specify transfer size" << endl;
     exit(1);
@@ -60,20 +111,57 @@ int main(int argc, char const *argv[]) {
     auto size = strtoull(n.c_str(), 0, 0);
     size_v.push_back(size);
   }
+  unique_ptr<XDMA_udrv::XDMA> xdma = XDMA_udrv::XDMA::XDMA_factory();
+  if (vm.count("stats"))
+    xdma->enable_stats();
+  // Tuned by xdma_tune, built-in defaults otherwise
+  const XDMA_udrv::xdma_profile &profile = xdma->get_profile();
+  uint32_t chunk_size = profile.chunk_size;
+  bool adaptive = vm.count("adaptive") || profile.adaptive;
+
   uint64_t real_xfer_size = 0;
   vector<uint32_t> chunks_v;
   for (auto n : size_v) {
-    chunks_v.push_back(n / XDMA_udrv::MEM_CHUNK_SIZE +
-                       ((n % XDMA_udrv::MEM_CHUNK_SIZE) ? 1 : 0));
+    chunks_v.push_back(n / chunk_size + ((n % chunk_size) ? 1 : 0));
     real_xfer_size += n;
   }
   uint64_t xfer_size = 0;
   for (auto n : chunks_v) {
-    xfer_size += n * XDMA_udrv::MEM_CHUNK_SIZE;
+    xfer_size += (uint64_t)n * chunk_size;
   }
 
-  unique_ptr<XDMA_udrv::XDMA> xdma = XDMA_udrv::XDMA::XDMA_factory();
-  XDMA_udrv::XSGBuffer buffer(xfer_size);
+  // Settle the page layout before mapping anything, a capture that can't
+  // get its pages stops here with the pool counts instead of half built
+  XDMA_udrv::hugeplan_opt plan_opt;
+  bool size_max =
+      size_v.size() == 1 && vm["size"].as<vector<string>>()[0] == "max";
+  plan_opt.size = size_max ? 0 : xfer_size;
+  plan_opt.chunk_size = chunk_size;
+  plan_opt.node = XDMA_udrv::uio_numa_node(xdma->get_uio_index());
+  plan_opt.reserve = vm.count("reserve");
+  XDMA_udrv::hugepage_plan plan;
+  try {
+    plan = XDMA_udrv::plan_hugepages(plan_opt);
+  } catch (const exception &e) {
+    cerr << e.what() << endl;
+    exit(1);
+  }
+  cout << plan.report;
+  if (size_max || plan.chunk_size != chunk_size) {
+    chunk_size = plan.chunk_size;
+    if (size_max)
+      size_v[0] = plan.size;
+    chunks_v.clear();
+    real_xfer_size = xfer_size = 0;
+    for (auto n : size_v) {
+      chunks_v.push_back(n / chunk_size + ((n % chunk_size) ? 1 : 0));
+      real_xfer_size += n;
+      xfer_size += (uint64_t)chunks_v.back() * chunk_size;
+    }
+  }
+
+  XDMA_udrv::XSGBuffer buffer(xfer_size, chunk_size, profile.adj_block,
+                              plan.page_type, plan.node);
   // For timing
   struct timespec tstart, tend, tdiff;
 
@@ -93,52 +181,186 @@ int main(int argc, char const *argv[]) {
   cout << dec;
   hexdump(buffer.getDescWBVaddr(), 32 * 24);
 
-  // Set C2H channel 0 first descriptor block
-  xdma->ctrl_reg_write(XDMA_udrv::XDMA_ADDR_TARGET::C2H_SGDMA, 0, 0x80,
-                       buffer.getDescWBPaddr());
-  printf("descriptor lo readback: 0x%" PRIX32 "\n",
-         xdma->ctrl_reg_read(XDMA_udrv::XDMA_ADDR_TARGET::C2H_SGDMA, 0, 0x80));
-  xdma->ctrl_reg_write(XDMA_udrv::XDMA_ADDR_TARGET::C2H_SGDMA, 0, 0x84,
-                       buffer.getDescWBPaddr() >> 32);
-  printf("descriptor hi readback: 0x%" PRIX32 "\n",
-         xdma->ctrl_reg_read(XDMA_udrv::XDMA_ADDR_TARGET::C2H_SGDMA, 0, 0x84));
+  // Set C2H channel 0 first descriptor block, ie_descriptor_completed and run
+  XDMA_udrv::XDMAEngine c2h(*xdma, XDMA_udrv::DIR_C2H, 0);
+  XDMA_udrv::XCompletionTimeline timeline(buffer.getNrDesc());
+  // The stream may start, or pause, whenever the source likes
+  uint64_t timeout_ns = vm["timeout-ms"].as<uint32_t>() * 1000000ULL;
+  timeline.set_timeout_ns(timeout_ns);
+  XDMA_udrv::poll_config poll_cfg;
+  if (vm.count("cpu")) {
+    poll_cfg.cpu = vm["cpu"].as<int>();
+    XDMA_udrv::pin_current_thread(poll_cfg.cpu);
+  }
+  XDMA_udrv::XPoller poller(poll_cfg);
+  // Checksum and/or deinterleave each chunk on the pools as soon as it
+  // completes
+  unique_ptr<XDMA_udrv::XCrcPool> crc_pool;
+  unique_ptr<XDMA_udrv::XUnpackPool> unpack_pool;
+  uint64_t unpack_offset = 0;
+  if (vm.count("crc")) {
+    crc_pool = make_unique<XDMA_udrv::XCrcPool>(buffer.getNrDesc(),
+                                                vm["crc"].as<unsigned>());
+  }
+  if (vm.count("lanes")) {
+    uint32_t n_lanes = vm["lanes"].as<uint32_t>();
+    uint32_t sample_bytes = vm["sample-bytes"].as<uint32_t>();
+    if (vm.count("container") || vm.count("stripe")) {
+      cerr << "--lanes writes its own files, not with --container or --stripe"
+           << endl;
+      exit(1);
+    }
+    // Frames must not straddle chunks
+    if (!n_lanes || chunk_size % (n_lanes * sample_bytes)) {
+      cerr << "Chunk size " << chunk_size << " is not a whole number of "
+           << n_lanes << " x " << sample_bytes << " byte frames" << endl;
+      exit(1);
+    }
+    vector<string> lane_paths;
+    for (uint32_t l = 0; l < n_lanes; l++)
+      lane_paths.push_back(
+          insert_tag(vm["fname"].as<string>(), "lane" + to_string(l)));
+    unpack_pool = make_unique<XDMA_udrv::XUnpackPool>(
+        lane_paths, sample_bytes, vm["unpack-threads"].as<unsigned>());
+  }
+  auto on_chunk = [&](const XDMA_udrv::sg_chunk &c) {
+    if (crc_pool)
+      crc_pool->submit(c.idx, c.data, c.length);
+    if (unpack_pool) {
+      unpack_pool->submit(c.data, c.length, unpack_offset);
+      unpack_offset += c.length;
+    }
+  };
+  if (crc_pool || unpack_pool) {
+    timeline.set_on_complete([&](uint32_t first, uint32_t end) {
+      for (uint32_t i = first; i < end; i++)
+        on_chunk(buffer.getChunk(i));
+    });
+  }
 
-  // Set C2H channel 0 ie_descriptor_completed
-  xdma->ctrl_reg_write(XDMA_udrv::XDMA_ADDR_TARGET::C2H_CHANNEL, 0, 0x08,
-                       1 << 2);
-  printf(
-      "channel control readback: 0x%" PRIX32 "\n",
-      xdma->ctrl_reg_read(XDMA_udrv::XDMA_ADDR_TARGET::C2H_CHANNEL, 0, 0x04));
-  // Cycle run bit to start
-  xdma->ctrl_reg_write(XDMA_udrv::XDMA_ADDR_TARGET::C2H_CHANNEL, 0, 0x0C, 1);
+  // Progressive: segment files are written chunk by chunk as the engine
+  // reports them, instead of after the whole transfer
+  bool progressive = vm.count("progressive");
+  vector<int> seg_fds;
+  uint64_t first_chunk_tsc = 0;
+  if (progressive) {
+    if (vm.count("container") || vm.count("stripe") || vm.count("lanes") ||
+        vm.count("timeline")) {
+      cerr << "--progressive writes segment files as chunks complete, not "
+              "with --container, --stripe, --lanes or --timeline"
+           << endl;
+      exit(1);
+    }
+    for (uint32_t i = 0; i < chunks_v.size(); i++) {
+      string fname = insert_tag(vm["fname"].as<string>(), to_string(i));
+      int fd = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                    S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+      if (fd == -1) {
+        perror("open()");
+        exit(1);
+      }
+      seg_fds.push_back(fd);
+    }
+  }
+  // Writeback only exists on AXI-Stream C2H, count on memory-mapped engines
+  XDMA_udrv::XDMA_COMPLETION_MODE completion =
+      c2h.is_stream() ? profile.completion : XDMA_udrv::CPL_COUNT;
+  XDMA_udrv::XChunkReader reader(buffer, c2h, completion);
 
   // record start time
   clock_gettime(CLOCK_MONOTONIC, &tstart);
-  xdma->ctrl_reg_write(XDMA_udrv::XDMA_ADDR_TARGET::C2H_CHANNEL, 0, 0x08, 1);
-  // Poll the descriptor complete
-  while (1) {
-    uint32_t ret =
-        xdma->ctrl_reg_read(XDMA_udrv::XDMA_ADDR_TARGET::C2H_CHANNEL, 0, 0x40);
-    if (ret == 0xFFFFFFFF)
-      continue;
-    else if (ret & (1 << 2))
-      break;
+  timeline.mark_start();
+  c2h.start(buffer.getDescWBPaddr());
+  // Poll completions, stamping each descriptor
+  try {
+    if (progressive) {
+      uint32_t seg = 0, left = chunks_v[0];
+      reader.for_each(
+          [&](const XDMA_udrv::sg_chunk &c) {
+            while (!left)
+              left = chunks_v[++seg];
+            on_chunk(c);
+            XDMA_TRACE_SCOPE("sink_write");
+            if (write(seg_fds[seg], c.data, c.length) < 0) {
+              perror("write()");
+              exit(1);
+            }
+            if (!first_chunk_tsc)
+              first_chunk_tsc = XDMA_udrv::tsc_read();
+            left--;
+          },
+          timeout_ns);
+    } else if (completion == XDMA_udrv::CPL_WRITEBACK)
+      timeline.wait_by_writeback(buffer.getWBVaddr(), &c2h);
     else
-      continue;
+      timeline.wait_by_count(c2h, adaptive ? &poller : nullptr, chunk_size);
+  } catch (const system_error &e) {
+    cerr << "Transfer failed: " << e.what() << endl;
+    // A stuck engine makes reset time out too, report it and still exit
+    try {
+      c2h.reset();
+    } catch (const system_error &re) {
+      cerr << "Reset failed: " << re.what() << endl;
+    }
+    exit(1);
   }
-  printf(
-      "C2H channel 0 status: 0x%08X\n",
-      xdma->ctrl_reg_read(XDMA_udrv::XDMA_ADDR_TARGET::C2H_CHANNEL, 0, 0x40));
   // record end time
   clock_gettime(CLOCK_MONOTONIC, &tend);
+  if (progressive) {
+    for (int fd : seg_fds)
+      close(fd);
+    printf("First chunk written %.3lf ms after the doorbell\n",
+           (first_chunk_tsc - timeline.getT0()) / XDMA_udrv::tsc_per_ns() /
+               1e6);
+  }
+  if (crc_pool) {
+    struct timespec tcrc;
+    crc_pool->wait();
+    clock_gettime(CLOCK_MONOTONIC, &tcrc);
+    tdiff = timediff(tend, tcrc);
+    printf("CRC32C on %u thread(s) finished %.3lf ms after the last chunk\n",
+           crc_pool->getNrThreads(),
+           tdiff.tv_sec * 1e3 + tdiff.tv_nsec / 1e6);
+    if (!vm.count("container"))
+      cerr << "CRC32C is only stored with --container" << endl;
+  }
+  if (unpack_pool) {
+    struct timespec tunpack;
+    try {
+      unpack_pool->wait();
+    } catch (const system_error &e) {
+      cerr << "Deinterleave failed: " << e.what() << endl;
+      exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &tunpack);
+    tdiff = timediff(tend, tunpack);
+    printf("%u lane(s) on %u thread(s) finished %.3lf ms after the last "
+           "chunk\n",
+           unpack_pool->getNrLanes(), unpack_pool->getNrThreads(),
+           tdiff.tv_sec * 1e3 + tdiff.tv_nsec / 1e6);
+    if (unpack_pool->getDroppedBytes()) {
+      cerr << unpack_pool->getDroppedBytes()
+           << " byte(s) of partial frames dropped" << endl;
+    }
+  }
+  printf("descriptor lo readback: 0x%" PRIX32 "\n",
+         xdma->ctrl_reg_read(XDMA_udrv::XDMA_ADDR_TARGET::C2H_SGDMA, 0, 0x80));
+  printf("descriptor hi readback: 0x%" PRIX32 "\n",
+         xdma->ctrl_reg_read(XDMA_udrv::XDMA_ADDR_TARGET::C2H_SGDMA, 0, 0x84));
+  printf(
+      "channel control readback: 0x%" PRIX32 "\n",
+      xdma->ctrl_reg_read(XDMA_udrv::XDMA_ADDR_TARGET::C2H_CHANNEL, 0, 0x04));
+  printf("C2H channel 0 status: 0x%08X\n", c2h.status());
 
   // clear descriptor_completed flag
-  xdma->ctrl_reg_write(XDMA_udrv::XDMA_ADDR_TARGET::C2H_CHANNEL, 0, 0x40,
-                       1 << 2);
+  c2h.clear_status();
+  c2h.stop();
 
   // Show the amount of transfered bytes
   size_t transfer_byte_cnt = buffer.getXferedSize();
   cout << "Transfered " << transfer_byte_cnt << " byte(s)" << endl;
+  uint64_t backlog = transfer_byte_cnt;
+  XDMA_udrv::stat_set(c2h.stats()->sink_backlog, backlog);
 
   // Calculate timediff and average throughput in MiB/s
   tdiff = timediff(tstart, tend);
@@ -152,6 +374,16 @@ int main(int argc, char const *argv[]) {
   printf("Transfer completed in %" PRIu64 " nanoseconds\n", duration_ns);
   printf("Average throughput %.5lf MiB/s\n", avg_tp);
 
+  if (adaptive) {
+    printf("Polling cost %.0lf cycles/GiB, %" PRIu64 " backoff step(s)\n",
+           poller.getCyclesPerGiB(), poller.getPolls());
+  }
+
+  if (vm.count("timeline")) {
+    timeline.load_lengths(buffer.getWBVaddr());
+    timeline.report(cout, vm.count("chunks"));
+  }
+
   // Dump first 8 AXIS word
   hexdump(buffer.getDataBufferVaddr(0), sizeof(axis_word_128) * 8);
   // // Check result
@@ -183,6 +415,62 @@ int main(int argc, char const *argv[]) {
   cout << "Requested " << real_xfer_size << ", Received " << transfer_byte_cnt
        << endl;
 
+  if (vm.count("container")) {
+    XDMA_udrv::XCaptureWriter cap(vm["fname"].as<string>(), buffer.getNrDesc(),
+                                  chunk_size);
+    XDMA_udrv::c2h_wb *pwb = buffer.getWBVaddr();
+
+    cap.set_t0(timeline.getT0());
+    cap.set_crc(crc_pool != nullptr);
+    for (uint32_t i = 0, chunk_idx = 0; i < chunks_v.size(); i++) {
+      for (uint32_t j = 0; j < chunks_v[i]; j++, chunk_idx++) {
+        void *start = buffer.getChunk(chunk_idx).data;
+        cap.write(start, pwb[chunk_idx].length, pwb[chunk_idx].status,
+                  timeline.getTsc(chunk_idx), i,
+                  crc_pool ? crc_pool->get(chunk_idx) : 0);
+        backlog -= pwb[chunk_idx].length;
+        XDMA_udrv::stat_set(c2h.stats()->sink_backlog, backlog);
+      }
+    }
+    cap.close();
+    cout << "Wrote " << cap.getNrWritten() << " chunk(s) to "
+         << vm["fname"].as<string>() << (cap.isDirect() ? " (O_DIRECT)" : "")
+         << endl;
+    // Everything went to the container, no per-segment files
+    chunks_v.clear();
+  } else if (progressive) {
+    // Already written while the transfer ran
+    XDMA_udrv::stat_set(c2h.stats()->sink_backlog, 0);
+    chunks_v.clear();
+  } else if (unpack_pool) {
+    // The lanes are the capture, no per-segment files
+    XDMA_udrv::stat_set(c2h.stats()->sink_backlog, 0);
+    chunks_v.clear();
+  } else if (vm.count("stripe")) {
+    struct timespec wstart, wend;
+    string name = fs::path(vm["fname"].as<string>()).filename();
+    XDMA_udrv::XStripedWriter writer(vm["stripe"].as<vector<string>>(), name);
+    XDMA_udrv::c2h_wb *pwb = buffer.getWBVaddr();
+
+    clock_gettime(CLOCK_MONOTONIC, &wstart);
+    for (uint32_t i = 0, chunk_idx = 0; i < chunks_v.size(); i++) {
+      for (uint32_t j = 0; j < chunks_v[i]; j++, chunk_idx++) {
+        void *start = buffer.getChunk(chunk_idx).data;
+        writer.write(i, start, pwb[chunk_idx].length);
+      }
+    }
+    writer.close();
+    clock_gettime(CLOCK_MONOTONIC, &wend);
+    XDMA_udrv::stat_set(c2h.stats()->sink_backlog, 0);
+    tdiff = timediff(wstart, wend);
+    printf("Striped over %u target(s) at %.2lf MiB/s, manifest %s\n",
+           writer.getNrTargets(),
+           transfer_byte_cnt / (tdiff.tv_sec + tdiff.tv_nsec / 1e9) / (1 << 20),
+           writer.getManifestPath().c_str());
+    // Everything went to the stripes, no per-segment files
+    chunks_v.clear();
+  }
+
   int chunk_idx = 0;
   regex e("(.*)(\\..*)");
   smatch m;
@@ -206,19 +494,22 @@ int main(int argc, char const *argv[]) {
     }
 
     for (int j = 0; j < transaction_chunks; j++, chunk_idx++) {
-      int pg_idx = chunk_idx / 8;
-      int inner_chunk_idx = chunk_idx % 8;
-      XDMA_udrv::c2h_wb *pwb = (XDMA_udrv::c2h_wb *)(buffer.getDescWBVaddr() + (1 << 20));
-      void *start = buffer.getDataBufferVaddr(pg_idx) +
-                    XDMA_udrv::MEM_CHUNK_SIZE * inner_chunk_idx;
+      XDMA_udrv::c2h_wb *pwb = buffer.getWBVaddr();
+      void *start = buffer.getChunk(chunk_idx).data;
+      XDMA_TRACE_SCOPE("sink_write");
       if (write(fd, start, pwb[chunk_idx].length) < 0) {
         perror("write()");
         exit(1);
       }
+      backlog -= pwb[chunk_idx].length;
+      XDMA_udrv::stat_set(c2h.stats()->sink_backlog, backlog);
     }
 
     close(fd);
   }
+  if (vm.count("trace") &&
+      !XDMA_udrv::trace_dump_chrome(vm["trace"].as<string>().c_str()))
+    cerr << "Trace not written, built without TRACE=1?" << endl;
   // Write to file
   // int fd;
   // fd = open(vm["fname"].as<string>().c_str(), O_WRONLY | O_CREAT | O_TRUNC,
@@ -260,6 +551,114 @@ int main(int argc, char const *argv[]) {
   // close(fd);
 }
 
+// Receive packets through XPacketRing, each view is written to the dump file as
+// a 32-bit little endian length followed by the payload. Bit 31 of the length
+// marks a fragment that continues in the next record.
+int packet_capture(const po::variables_map &vm) {
+  uint64_t n_pkt_req = vm["packets"].as<uint64_t>();
+  unique_ptr<XDMA_udrv::XDMA> xdma = XDMA_udrv::XDMA::XDMA_factory();
+  if (vm.count("stats"))
+    xdma->enable_stats();
+  XDMA_udrv::XDMAEngine c2h(*xdma, XDMA_udrv::DIR_C2H, 0);
+  XDMA_udrv::XPacketRing ring(vm["ring"].as<uint32_t>(),
+                              vm["desc-size"].as<uint32_t>());
+  vector<XDMA_udrv::c2h_packet> pkts(256);
+  struct timespec tstart, tend, tdiff;
+  uint64_t n_pkt = 0, n_frag = 0, n_byte = 0, n_recover = 0;
+  uint64_t timeout_tsc =
+      vm["timeout-ms"].as<uint32_t>() * 1000000ULL * XDMA_udrv::tsc_per_ns();
+  // Check the engine for errors once per ms without traffic
+  uint64_t check_tsc = 1000000 * XDMA_udrv::tsc_per_ns();
+  uint64_t t_last = XDMA_udrv::tsc_read(), t_checked = t_last;
+
+  int fd = open(vm["fname"].as<string>().c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+  if (fd == -1) {
+    perror("open()");
+    exit(1);
+  }
+
+  ring.initialize();
+  ring.start(c2h);
+  clock_gettime(CLOCK_MONOTONIC, &tstart);
+  while (n_pkt < n_pkt_req) {
+    size_t n = ring.recv(pkts.data(), pkts.size());
+    if (n == 0) {
+      uint64_t now = XDMA_udrv::tsc_read();
+      if (now - t_checked < check_tsc)
+        continue;
+      t_checked = now;
+      try {
+        c2h.check_status();
+      } catch (const system_error &e) {
+        if (e.code().value() != -EIO)
+          throw;
+        // Restart at the next free buffer, the ring and hugepages stay
+        uint64_t dropped = ring.recover();
+        cerr << e.what() << ", recovered, " << dropped
+             << " descriptor(s) dropped" << endl;
+        n_recover++;
+        t_last = now;
+      }
+      if (timeout_tsc && now - t_last > timeout_tsc) {
+        cerr << "No traffic for " << vm["timeout-ms"].as<uint32_t>()
+             << " ms, stopping" << endl;
+        break;
+      }
+      continue;
+    }
+    t_last = XDMA_udrv::tsc_read();
+    uint64_t backlog = 0;
+    for (size_t i = 0; i < n; i++)
+      backlog += pkts[i].length;
+    for (size_t i = 0; i < n; i++) {
+      XDMA_TRACE_SCOPE("sink_write");
+      uint32_t len = pkts[i].length;
+      if (!pkts[i].eop) {
+        len |= 1U << 31;
+        n_frag++;
+      }
+      len = htole32(len);
+      if (write(fd, &len, sizeof(len)) < 0 ||
+          write(fd, pkts[i].data, pkts[i].length) < 0) {
+        perror("write()");
+        exit(1);
+      }
+      n_byte += pkts[i].length;
+      n_pkt += pkts[i].eop ? 1 : 0;
+      backlog -= pkts[i].length;
+      XDMA_udrv::stat_set(c2h.stats()->sink_backlog, backlog);
+    }
+    ring.release();
+  }
+  clock_gettime(CLOCK_MONOTONIC, &tend);
+  ring.stop();
+  close(fd);
+  if (vm.count("trace") &&
+      !XDMA_udrv::trace_dump_chrome(vm["trace"].as<string>().c_str()))
+    cerr << "Trace not written, built without TRACE=1?" << endl;
+
+  tdiff = timediff(tstart, tend);
+  double duration_s = tdiff.tv_sec + tdiff.tv_nsec / 1e9;
+  printf("Received %" PRIu64 " packet(s), %" PRIu64 " byte(s), %" PRIu64
+         " wrapped fragment(s)\n",
+         n_pkt, n_byte, n_frag);
+  printf("%.0lf packets/s, %.5lf MiB/s\n", n_pkt / duration_s,
+         n_byte / duration_s / (1 << 20));
+  if (n_recover)
+    printf("Recovered from %" PRIu64 " engine error(s)\n", n_recover);
+  return 0;
+}
+
+// dump.bin -> dump.<tag>.bin, how per-segment and per-lane files are named
+string insert_tag(const string &fname, const string &tag) {
+  regex e("(.*)(\\..*)");
+  smatch m;
+  if (regex_search(fname, m, e))
+    return m[1].str() + "." + tag + m[2].str();
+  return fname + "." + tag;
+}
+
 // Software implementation of 128-bit LFSR (bit 127, 125, 100, 98)
 void lfsr128(struct axis_word_128 *target, struct axis_word_128 *result) {
   int zcnt = 0;
@@ -0,0 +1,108 @@
+#include <boost/program_options.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <system_error>
+
+#include <inttypes.h>
+#include <time.h>
+
+#include "XDMA_pattern.hpp"
+#include "XDMA_udrv.hpp"
+
+using namespace std;
+namespace po = boost::program_options;
+
+struct timespec timediff(struct timespec start, struct timespec end);
+
+// Stream a generated test pattern to the card over H2C
+int main(int argc, char const *argv[]) {
+  po::options_description desc("Allowed options");
+  desc.add_options()("help,h", "print usage message");
+  desc.add_options()("size,s", po::value<string>()->default_value("0x40000000"),
+                     "Bytes to send");
+  desc.add_options()("pattern,p", po::value<string>()->default_value("lfsr128"),
+                     "lfsr128, counter or prbs31");
+  desc.add_options()("seed-lo", po::value<string>()->default_value("1"),
+                     "Seed, low 64 bits");
+  desc.add_options()("seed-hi", po::value<string>()->default_value("0"),
+                     "Seed, high 64 bits (lfsr128 only)");
+  desc.add_options()("slot", po::value<uint32_t>()->default_value(64 << 20),
+                     "Bytes generated and sent as one request");
+  desc.add_options()("threads,j", po::value<unsigned>()->default_value(2),
+                     "Generator threads per slot");
+  desc.add_options()("channel,c", po::value<uint32_t>()->default_value(0),
+                     "H2C channel");
+  desc.add_options()("card-addr", po::value<string>()->default_value("0"),
+                     "AXI-MM destination, ignored by stream engines");
+  po::variables_map vm;
+  store(parse_command_line(argc, argv, desc), vm);
+
+  if (vm.count("help")) {
+    cout << desc << "\n";
+    return 0;
+  }
+
+  string name = vm["pattern"].as<string>();
+  XDMA_udrv::XDMA_PATTERN type;
+  if (name == "lfsr128")
+    type = XDMA_udrv::PAT_LFSR128;
+  else if (name == "counter")
+    type = XDMA_udrv::PAT_COUNTER;
+  else if (name == "prbs31")
+    type = XDMA_udrv::PAT_PRBS31;
+  else {
+    cerr << "Unknown pattern " << name << endl;
+    exit(1);
+  }
+  uint64_t size = strtoull(vm["size"].as<string>().c_str(), 0, 0);
+  if (!size || size % 16) {
+    cerr << "Size must be a non-zero multiple of 16" << endl;
+    exit(1);
+  }
+
+  XDMA_udrv::XPattern pattern(
+      type, strtoull(vm["seed-lo"].as<string>().c_str(), 0, 0),
+      strtoull(vm["seed-hi"].as<string>().c_str(), 0, 0));
+  unique_ptr<XDMA_udrv::XDMA> xdma = XDMA_udrv::XDMA::XDMA_factory();
+  XDMA_udrv::XDMAEngine h2c(*xdma, XDMA_udrv::DIR_H2C,
+                            vm["channel"].as<uint32_t>());
+  XDMA_udrv::XPatternStream stream(h2c, pattern, vm["slot"].as<uint32_t>(),
+                                   vm["threads"].as<unsigned>());
+  struct timespec tstart, tend, tdiff;
+
+  clock_gettime(CLOCK_MONOTONIC, &tstart);
+  try {
+    stream.run(size, strtoull(vm["card-addr"].as<string>().c_str(), 0, 0));
+  } catch (const system_error &e) {
+    cerr << "H2C: " << e.what() << endl;
+    cerr << "Status: " << XDMA_udrv::xdma_status_str(h2c.get_last_error())
+         << endl;
+    exit(1);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &tend);
+  tdiff = timediff(tstart, tend);
+  double duration_s = tdiff.tv_sec + tdiff.tv_nsec / 1e9;
+
+  printf("%" PRIu64 " bytes of %s in %.3lf s, %.2lf MiB/s\n", size,
+         name.c_str(), duration_s, size / duration_s / (1 << 20));
+  printf("generate %.2lf MiB/s, engine waited %.3lf ms for the generator, "
+         "generator waited %.3lf ms for a slot\n",
+         size / (stream.getFillNs() / 1e9) / (1 << 20),
+         stream.getGenWaitNs() / 1e6, stream.getSlotWaitNs() / 1e6);
+  return 0;
+}
+
+struct timespec timediff(struct timespec start, struct timespec end) {
+  struct timespec temp;
+  if ((end.tv_nsec - start.tv_nsec) < 0) {
+    temp.tv_sec = end.tv_sec - start.tv_sec - 1;
+    temp.tv_nsec = 1000000000 + end.tv_nsec - start.tv_nsec;
+  } else {
+    temp.tv_sec = end.tv_sec - start.tv_sec;
+    temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  }
+  return temp;
+}
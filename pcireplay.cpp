@@ -0,0 +1,282 @@
+#include <boost/program_options.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "XDMA_capture.hpp"
+#include "XDMA_h2c.hpp"
+#include "XDMA_timing.hpp"
+#include "XDMA_udrv.hpp"
+
+using namespace std;
+namespace po = boost::program_options;
+
+struct timespec timediff(struct timespec start, struct timespec end);
+
+// A recorded file, read with O_DIRECT or through a mapping
+struct replay_file {
+  string path;
+  int fd;
+  uint64_t size;
+  const uint8_t *map;
+};
+
+replay_file open_replay_file(const string &path, bool use_mmap) {
+  replay_file f = {path, -1, 0, nullptr};
+  struct stat st;
+  int flags = O_RDONLY | O_CLOEXEC;
+  f.fd = open(path.c_str(), flags | (use_mmap ? 0 : O_DIRECT));
+  // tmpfs and friends don't do O_DIRECT
+  if (f.fd < 0 && !use_mmap && errno == EINVAL)
+    f.fd = open(path.c_str(), flags);
+  if (f.fd < 0 || fstat(f.fd, &st)) {
+    perror(("open() " + path).c_str());
+    exit(1);
+  }
+  f.size = st.st_size;
+  if (use_mmap && f.size) {
+    void *p = mmap(nullptr, f.size, PROT_READ, MAP_SHARED, f.fd, 0);
+    if (p == MAP_FAILED) {
+      perror(("mmap() " + path).c_str());
+      exit(1);
+    }
+    madvise(p, f.size, MADV_SEQUENTIAL);
+    f.map = (const uint8_t *)p;
+  }
+  return f;
+}
+
+// len bytes at off into the slot, which is 4 KiB aligned and long enough
+// to round len up for O_DIRECT
+void read_into(const replay_file &f, void *slot, uint64_t off, uint32_t len) {
+  if (f.map) {
+    memcpy(slot, f.map + off, len);
+    return;
+  }
+  uint8_t *p = (uint8_t *)slot;
+  uint64_t want = (len + 4095) & ~4095ULL;
+  while (len) {
+    ssize_t rv = pread(f.fd, p, want, off);
+    if (rv < 0 && errno == EINTR)
+      continue;
+    if (rv <= 0) {
+      throw system_error(error_code(rv ? errno : EIO, generic_category()),
+                         "pread() " + f.path);
+    }
+    // Past the end of what we need is fine, short of it is not
+    rv = ((uint64_t)rv > len) ? len : rv;
+    p += rv;
+    off += rv;
+    len -= rv;
+    want -= rv;
+  }
+}
+
+bool is_capture(const string &path) {
+  char magic[sizeof(XCAP_MAGIC)] = {};
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  ssize_t rv = read(fd, magic, sizeof(magic));
+  close(fd);
+  return rv == sizeof(magic) && !memcmp(magic, XCAP_MAGIC, sizeof(magic));
+}
+
+// Stream pcicat recordings back into the card over H2C
+int main(int argc, char const *argv[]) {
+  po::options_description desc("Allowed options");
+  desc.add_options()("help,h", "print usage message");
+  desc.add_options()("file,f", po::value<vector<string>>()->multitoken(),
+                     "Segment files in order, or one capture (see capinfo)");
+  desc.add_options()("rate,r", po::value<double>(),
+                     "Pace to this many MiB/s");
+  desc.add_options()("speed", po::value<double>(),
+                     "Capture only: replay at the recorded timing, scaled "
+                     "(2 is twice as fast)");
+  desc.add_options()("loop,l", po::value<uint64_t>()->default_value(1),
+                     "Play everything this many times, 0 for forever");
+  desc.add_options()("mmap", "Read through mmap() instead of O_DIRECT");
+  desc.add_options()("slot", po::value<uint32_t>()->default_value(64 << 20),
+                     "Segment files: bytes per H2C request");
+  desc.add_options()("channel,c", po::value<uint32_t>()->default_value(0),
+                     "H2C channel");
+  desc.add_options()("card-addr", po::value<string>()->default_value("0"),
+                     "AXI-MM destination, ignored by stream engines");
+  po::positional_options_description pos;
+  pos.add("file", -1);
+  po::variables_map vm;
+  store(po::command_line_parser(argc, argv).options(desc).positional(pos).run(),
+        vm);
+
+  if (vm.count("help") || !vm.count("file")) {
+    cout << desc << "\n";
+    return vm.count("help") ? 0 : 1;
+  }
+
+  vector<string> paths = vm["file"].as<vector<string>>();
+  bool use_mmap = vm.count("mmap");
+  uint64_t loops = vm["loop"].as<uint64_t>();
+  unique_ptr<XDMA_udrv::XCaptureReader> cap;
+  if (paths.size() == 1 && is_capture(paths[0]))
+    cap = make_unique<XDMA_udrv::XCaptureReader>(paths[0]);
+  if (vm.count("speed") && (!cap || vm["speed"].as<double>() <= 0)) {
+    cerr << "--speed needs a capture file and a positive factor" << endl;
+    exit(1);
+  }
+
+  vector<replay_file> files;
+  uint64_t total = 0;
+  for (auto &p : paths) {
+    files.push_back(open_replay_file(p, use_mmap));
+    total += files.back().size;
+  }
+  // Chunks with data, an empty one would end the stream
+  vector<uint64_t> chunks;
+  for (uint64_t i = 0; cap && i < cap->getNrChunks(); i++)
+    if (cap->getIndex(i).length)
+      chunks.push_back(i);
+  if (cap && chunks.empty()) {
+    cerr << "Empty capture" << endl;
+    exit(1);
+  }
+  if (!total) {
+    cerr << "Nothing to replay" << endl;
+    exit(1);
+  }
+
+  // A capture goes chunk by chunk, keeping the recorded packet boundaries
+  uint32_t slot_size = vm["slot"].as<uint32_t>();
+  if (cap)
+    slot_size = cap->getHeader().chunk_size;
+
+  unique_ptr<XDMA_udrv::XDMA> xdma = XDMA_udrv::XDMA::XDMA_factory();
+  XDMA_udrv::XDMAEngine h2c(*xdma, XDMA_udrv::DIR_H2C,
+                            vm["channel"].as<uint32_t>());
+  XDMA_udrv::XH2CStream stream(h2c, slot_size);
+
+  // Where the producer is: loop, file or chunk, offset into the file
+  uint64_t loop = 0, pos_off = 0;
+  size_t pos_idx = 0;
+  XDMA_udrv::XH2CStream::fill_fn fill;
+  if (cap) {
+    fill = [&](uint64_t, void *slot) -> uint32_t {
+      if (pos_idx == chunks.size()) {
+        if (loops && ++loop >= loops)
+          return 0;
+        pos_idx = 0;
+      }
+      const XDMA_udrv::xcap_index &e = cap->getIndex(chunks[pos_idx++]);
+      read_into(files[0], slot, e.offset, e.length);
+      return e.length;
+    };
+  } else {
+    fill = [&](uint64_t, void *slot) -> uint32_t {
+      while (pos_idx == files.size() || pos_off == files[pos_idx].size) {
+        if (pos_idx == files.size()) {
+          if (loops && ++loop >= loops)
+            return 0;
+          pos_idx = 0;
+        } else {
+          pos_idx++;
+        }
+        pos_off = 0;
+      }
+      uint32_t n = min<uint64_t>(slot_size, files[pos_idx].size - pos_off);
+      read_into(files[pos_idx], slot, pos_off, n);
+      pos_off += n;
+      return n;
+    };
+  }
+
+  XDMA_udrv::XH2CStream::pace_fn pace;
+  uint64_t t0 = 0, paced_k = UINT64_MAX, paced_bytes = 0, last_len = 0;
+  if (vm.count("rate")) {
+    double tsc_per_byte =
+        XDMA_udrv::tsc_per_ns() * 1e9 / (vm["rate"].as<double>() * (1 << 20));
+    pace = [&, tsc_per_byte](uint64_t k, uint32_t len) -> uint64_t {
+      if (!t0)
+        t0 = XDMA_udrv::tsc_read();
+      // Asked again for the same message until it is due
+      if (k != paced_k) {
+        paced_bytes += (paced_k == UINT64_MAX) ? 0 : last_len;
+        paced_k = k;
+        last_len = len;
+      }
+      return t0 + paced_bytes * tsc_per_byte;
+    };
+  } else if (vm.count("speed")) {
+    // Recorded completion times, one loop lasts the span plus a mean gap
+    const XDMA_udrv::xcap_header &hdr = cap->getHeader();
+    uint64_t n = chunks.size();
+    uint64_t first = cap->getIndex(chunks[0]).tsc;
+    uint64_t last = cap->getIndex(chunks[n - 1]).tsc;
+    double span_ns = (last - first) / hdr.tsc_per_ns;
+    double period_ns = span_ns + ((n > 1) ? span_ns / (n - 1) : 0);
+    double scale = XDMA_udrv::tsc_per_ns() / vm["speed"].as<double>();
+    if (!first || !last) {
+      cerr << "Capture has no completion timestamps" << endl;
+      exit(1);
+    }
+    pace = [&, first, period_ns, scale, n](uint64_t k, uint32_t) -> uint64_t {
+      if (!t0)
+        t0 = XDMA_udrv::tsc_read();
+      double ns = (k / n) * period_ns +
+                  (cap->getIndex(chunks[k % n]).tsc - first) / hdr.tsc_per_ns;
+      return t0 + (uint64_t)(ns * scale);
+    };
+  }
+
+  struct timespec tstart, tend, tdiff;
+  uint64_t n_byte;
+  clock_gettime(CLOCK_MONOTONIC, &tstart);
+  try {
+    n_byte = stream.run(fill, pace,
+                        strtoull(vm["card-addr"].as<string>().c_str(), 0, 0));
+  } catch (const system_error &e) {
+    cerr << "Replay: " << e.what() << endl;
+    cerr << "Status: " << XDMA_udrv::xdma_status_str(h2c.get_last_error())
+         << endl;
+    exit(1);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &tend);
+  tdiff = timediff(tstart, tend);
+  double duration_s = tdiff.tv_sec + tdiff.tv_nsec / 1e9;
+
+  printf("Replayed %" PRIu64 " byte(s) in %.3lf s, %.2lf MiB/s\n", n_byte,
+         duration_s, n_byte / duration_s / (1 << 20));
+  printf("read %.2lf MiB/s, engine waited %.3lf ms for the reader\n",
+         n_byte / (stream.getFillNs() / 1e9) / (1 << 20),
+         stream.getGenWaitNs() / 1e6);
+
+  for (auto &f : files) {
+    if (f.map)
+      munmap((void *)f.map, f.size);
+    close(f.fd);
+  }
+  return 0;
+}
+
+struct timespec timediff(struct timespec start, struct timespec end) {
+  struct timespec temp;
+  if ((end.tv_nsec - start.tv_nsec) < 0) {
+    temp.tv_sec = end.tv_sec - start.tv_sec - 1;
+    temp.tv_nsec = 1000000000 + end.tv_nsec - start.tv_nsec;
+  } else {
+    temp.tv_sec = end.tv_sec - start.tv_sec;
+    temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  }
+  return temp;
+}
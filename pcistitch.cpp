@@ -0,0 +1,86 @@
+#include <boost/program_options.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "XDMA_sink.hpp"
+
+using namespace std;
+namespace po = boost::program_options;
+
+// Reassemble a striped capture (pcicat --stripe) in chunk order
+int main(int argc, char const *argv[]) {
+  po::options_description desc("Allowed options");
+  desc.add_options()("help,h", "print usage message");
+  desc.add_options()("manifest,m", po::value<string>(), "Stripe manifest");
+  desc.add_options()("output,o", po::value<string>(),
+                     "Output file (default: stdout)");
+  desc.add_options()("segment,g", po::value<uint32_t>(),
+                     "Only this segment (--size index of pcicat)");
+  po::positional_options_description pos;
+  pos.add("manifest", 1);
+  po::variables_map vm;
+  store(po::command_line_parser(argc, argv).options(desc).positional(pos).run(),
+        vm);
+
+  if (vm.count("help") || !vm.count("manifest")) {
+    cout << desc << "\n";
+    return vm.count("help") ? 0 : 1;
+  }
+
+  vector<string> paths;
+  vector<XDMA_udrv::stripe_chunk> chunks;
+  if (!XDMA_udrv::stripe_manifest_load(vm["manifest"].as<string>().c_str(),
+                                       paths, chunks)) {
+    cerr << "Bad manifest " << vm["manifest"].as<string>() << endl;
+    exit(1);
+  }
+  vector<int> fds;
+  for (auto &p : paths) {
+    fds.push_back(open(p.c_str(), O_RDONLY));
+    if (fds.back() < 0) {
+      perror(p.c_str());
+      exit(1);
+    }
+  }
+  int out = STDOUT_FILENO;
+  if (vm.count("output")) {
+    out = open(vm["output"].as<string>().c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+               0664);
+    if (out < 0) {
+      perror("open()");
+      exit(1);
+    }
+  }
+
+  vector<char> buf(1 << 22);
+  uint64_t total = 0, n_chunk = 0;
+  for (auto &c : chunks) {
+    if (vm.count("segment") && c.segment != vm["segment"].as<uint32_t>())
+      continue;
+    for (uint64_t done = 0; done < c.length;) {
+      size_t n = (c.length - done < buf.size()) ? c.length - done : buf.size();
+      ssize_t rv = pread(fds[c.target], buf.data(), n, c.offset + done);
+      if (rv <= 0) {
+        cerr << "Short stripe " << paths[c.target] << endl;
+        exit(1);
+      }
+      if (write(out, buf.data(), rv) != rv) {
+        perror("write()");
+        exit(1);
+      }
+      done += rv;
+    }
+    total += c.length;
+    n_chunk++;
+  }
+  cerr << "Wrote " << total << " byte(s) from " << n_chunk
+       << " chunk(s) over " << paths.size() << " stripe(s)" << endl;
+  return 0;
+}
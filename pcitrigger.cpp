@@ -0,0 +1,128 @@
+#include <boost/program_options.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <inttypes.h>
+
+#include "XDMA_capture.hpp"
+#include "XDMA_timing.hpp"
+#include "XDMA_trigger.hpp"
+#include "XDMA_udrv.hpp"
+
+using namespace std;
+namespace po = boost::program_options;
+
+vector<uint8_t> parse_hex(const string &s) {
+  vector<uint8_t> v;
+  if (s.size() % 2) {
+    cerr << "--match needs an even number of hex digits" << endl;
+    exit(1);
+  }
+  for (size_t i = 0; i < s.size(); i += 2)
+    v.push_back(strtoul(s.substr(i, 2).c_str(), 0, 16));
+  return v;
+}
+
+// C2H into a circular history, keep the window around a trigger
+int main(int argc, char const *argv[]) {
+  po::options_description desc("Allowed options");
+  desc.add_options()("help,h", "print usage message");
+  desc.add_options()("fname,f", po::value<string>()->default_value("trig.xcap"),
+                     "Capture file (see capinfo)");
+  desc.add_options()("history", po::value<string>()->default_value("1G"),
+                     "Bytes of history kept, whole GiB (e.g. 4G)");
+  desc.add_options()("chunk", po::value<uint32_t>()->default_value(1 << 20),
+                     "Bytes per descriptor");
+  desc.add_options()("pre", po::value<uint64_t>()->default_value(256 << 20),
+                     "Bytes to keep before the trigger");
+  desc.add_options()("post", po::value<uint64_t>()->default_value(256 << 20),
+                     "Bytes to keep from the trigger on");
+  desc.add_options()("reg", po::value<string>(),
+                     "Trigger on a register, bar:offset:mask:value");
+  desc.add_options()("user-irq", po::value<string>(),
+                     "Trigger on any of these user interrupts (mask)");
+  desc.add_options()("match", po::value<string>(),
+                     "Trigger on this byte pattern in the data (hex)");
+  desc.add_options()("timeout-ms", po::value<uint32_t>()->default_value(0),
+                     "Give up after this long without a trigger");
+  po::variables_map vm;
+  store(parse_command_line(argc, argv, desc), vm);
+
+  if (vm.count("help")) {
+    cout << desc << "\n";
+    return 0;
+  }
+  if (vm.count("reg") + vm.count("user-irq") + vm.count("match") != 1) {
+    cerr << "Please specify exactly one of --reg, --user-irq, --match" << endl;
+    exit(1);
+  }
+
+  string hist = vm["history"].as<string>();
+  uint64_t history = strtoull(hist.c_str(), 0, 0);
+  if (hist.back() == 'G' || hist.back() == 'g')
+    history <<= 30;
+  uint32_t chunk_size = vm["chunk"].as<uint32_t>();
+  if (!history || history % (1UL << 30)) {
+    cerr << "--history must be a whole number of GiB" << endl;
+    exit(1);
+  }
+
+  unique_ptr<XDMA_udrv::XDMA> xdma = XDMA_udrv::XDMA::XDMA_factory();
+  XDMA_udrv::XDMAEngine c2h(*xdma, XDMA_udrv::DIR_C2H, 0);
+  XDMA_udrv::XTriggerRing ring(history, chunk_size);
+
+  XDMA_udrv::trigger_fn fn;
+  if (vm.count("reg")) {
+    int bar;
+    size_t offset;
+    uint32_t mask, value;
+    if (sscanf(vm["reg"].as<string>().c_str(), "%i:%zi:%i:%i", &bar, &offset,
+               &mask, &value) != 4) {
+      cerr << "--reg wants bar:offset:mask:value" << endl;
+      exit(1);
+    }
+    fn = XDMA_udrv::trigger_on_register(*xdma, bar, offset, mask, value);
+  } else if (vm.count("user-irq")) {
+    fn = XDMA_udrv::trigger_on_user_irq(
+        *xdma, strtoul(vm["user-irq"].as<string>().c_str(), 0, 0));
+  } else {
+    fn = XDMA_udrv::trigger_on_match(parse_hex(vm["match"].as<string>()));
+  }
+
+  printf("%" PRIu64 " MiB history in %u chunk(s), %u kept back in flight\n",
+         history >> 20, ring.getNrDesc(),
+         ring.getNrDesc() - ring.getHistoryChunks());
+
+  XDMA_udrv::trigger_window w;
+  try {
+    w = XDMA_udrv::trigger_capture(ring, c2h, fn, vm["pre"].as<uint64_t>(),
+                                   vm["post"].as<uint64_t>(),
+                                   vm["timeout-ms"].as<uint32_t>() * 1000000ULL);
+  } catch (const system_error &e) {
+    cerr << "Capture: " << e.what() << endl;
+    cerr << "Status: " << XDMA_udrv::xdma_status_str(c2h.get_last_error())
+         << endl;
+    exit(1);
+  }
+
+  // Segment 0 is the history before the trigger, 1 what came after
+  XDMA_udrv::XCaptureWriter cap(vm["fname"].as<string>(), w.end - w.first,
+                                chunk_size);
+  cap.set_t0(ring.getTsc(w.first));
+  for (uint64_t seq = w.first; seq < w.end; seq++) {
+    cap.write(ring.getChunk(seq), ring.getLength(seq), ring.getStatus(seq),
+              ring.getTsc(seq), seq >= w.trigger);
+  }
+  cap.close();
+
+  printf("Triggered at chunk %" PRIu64 ", saved %" PRIu64 " before and %" PRIu64
+         " from it to %s\n",
+         w.trigger, w.trigger - w.first, w.end - w.trigger,
+         vm["fname"].as<string>().c_str());
+  return 0;
+}
@@ -63,7 +63,7 @@ int main(int argc, char const *argv[]) {
 
   // Start a 1 GiB transfer
   uint32_t xfer_size = (1 << 30);
-  buffer.initialize(xfer_size);
+  buffer.initialize(xfer_size, xdma->get_profile().chunk_size);
 
   // dump descriptors for check
   cout << "Descriptor dump" << endl;
@@ -91,16 +91,33 @@ int main(int argc, char const *argv[]) {
   // record start time
   clock_gettime(CLOCK_MONOTONIC, &tstart);
   xdma->ctrl_reg_write(XDMA_udrv::XDMA_ADDR_TARGET::C2H_CHANNEL, 0, 0x08, 1);
-  // Poll the descriptor complete
+  // Poll the descriptor complete, bail out on error bits or a stall
+  uint32_t last_cnt = 0;
+  struct timespec tprogress = tstart;
   while (1) {
     uint32_t ret =
         xdma->ctrl_reg_read(XDMA_udrv::XDMA_ADDR_TARGET::C2H_CHANNEL, 0, 0x40);
-    if (ret == 0xFFFFFFFF)
-      continue;
-    else if (ret & (1 << 2))
+    if (ret != 0xFFFFFFFF && (ret & XDMA_CH_ERROR_MASK)) {
+      cerr << "C2H channel 0 error: " << XDMA_udrv::xdma_status_str(ret)
+           << endl;
+      exit(1);
+    } else if (ret != 0xFFFFFFFF && (ret & (1 << 2))) {
       break;
-    else
-      continue;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &tend);
+    uint32_t cnt =
+        xdma->ctrl_reg_read(XDMA_udrv::XDMA_ADDR_TARGET::C2H_CHANNEL, 0, 0x48);
+    if (cnt != 0xFFFFFFFF && cnt != last_cnt) {
+      last_cnt = cnt;
+      tprogress = tend;
+    }
+    tdiff = timediff(tprogress, tend);
+    if (tdiff.tv_sec * 1000000000ULL + tdiff.tv_nsec >
+        XDMA_COMPLETION_TIMEOUT_NS) {
+      cerr << "C2H channel 0 timed out, status: "
+           << XDMA_udrv::xdma_status_str(ret) << endl;
+      exit(1);
+    }
   }
   printf(
       "C2H channel 0 status: 0x%08X\n",
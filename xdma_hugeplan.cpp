@@ -0,0 +1,90 @@
+#include <boost/program_options.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "XDMA_hugeplan.hpp"
+#include "XDMA_udrv.hpp"
+
+using namespace std;
+namespace po = boost::program_options;
+
+// Bytes with an optional K, M or G suffix
+uint64_t parse_size(const string &s) {
+  char *end;
+  uint64_t v = strtoull(s.c_str(), &end, 0);
+  switch (*end) {
+  case 'G':
+  case 'g':
+    return v << 30;
+  case 'M':
+  case 'm':
+    return v << 20;
+  case 'K':
+  case 'k':
+    return v << 10;
+  }
+  return v;
+}
+
+// Check, and optionally reserve, hugepages for a capture before it starts
+int main(int argc, char const *argv[]) {
+  po::options_description desc("Allowed options");
+  desc.add_options()("help,h", "print usage message");
+  desc.add_options()("size,s", po::value<string>()->default_value("0"),
+                     "Buffer bytes (e.g. 3G), 0 for the largest possible");
+  desc.add_options()("min-size", po::value<string>()->default_value("0"),
+                     "Accept a smaller buffer down to this");
+  desc.add_options()("chunk", po::value<uint32_t>(),
+                     "Bytes per descriptor, tuned profile if not given");
+  desc.add_options()("uio", po::value<int32_t>(),
+                     "Take pages from the NUMA node of /dev/uioN");
+  desc.add_options()("node", po::value<int32_t>(),
+                     "Take pages from this NUMA node");
+  desc.add_options()("reserve", "Grow the pools if the size doesn't fit");
+  po::variables_map vm;
+  store(parse_command_line(argc, argv, desc), vm);
+
+  if (vm.count("help")) {
+    cout << desc << "\n";
+    return 0;
+  }
+
+  XDMA_udrv::hugeplan_opt opt;
+  opt.size = parse_size(vm["size"].as<string>());
+  opt.min_size = parse_size(vm["min-size"].as<string>());
+  opt.reserve = vm.count("reserve");
+  int32_t uio = -1;
+  if (vm.count("uio")) {
+    uio = vm["uio"].as<int32_t>();
+  } else {
+    vector<int32_t> devs = XDMA_udrv::XDMA::enumerate();
+    if (!devs.empty())
+      uio = devs[0];
+  }
+  if (vm.count("node"))
+    opt.node = vm["node"].as<int32_t>();
+  else
+    opt.node = XDMA_udrv::uio_numa_node(uio);
+  if (vm.count("chunk")) {
+    opt.chunk_size = vm["chunk"].as<uint32_t>();
+  } else if (uio >= 0) {
+    opt.chunk_size = XDMA_udrv::XDMA::XDMA_factory(uio)->get_profile().chunk_size;
+  }
+
+  try {
+    XDMA_udrv::hugepage_plan plan = XDMA_udrv::plan_hugepages(opt);
+    cout << plan.report;
+  } catch (const system_error &e) {
+    cerr << e.what() << endl;
+    return 1;
+  } catch (const range_error &e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
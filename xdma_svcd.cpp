@@ -0,0 +1,82 @@
+#include <atomic>
+#include <boost/program_options.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <system_error>
+
+#include <signal.h>
+
+#include "XDMA_svc.hpp"
+#include "XDMA_udrv.hpp"
+
+using namespace std;
+namespace po = boost::program_options;
+
+static atomic<bool> stop(false);
+
+static void on_signal(int) { stop = true; }
+
+// Owns one card and shares it with local clients, see XDMA_svc.hpp
+int main(int argc, char const *argv[]) {
+  po::options_description desc("Allowed options");
+  desc.add_options()("help,h", "print usage message");
+  desc.add_options()("uio,u", po::value<int32_t>()->default_value(-1),
+                     "uio index of the card (default: first one found)");
+  desc.add_options()("pool,p", po::value<uint32_t>()->default_value(4),
+                     "1 GiB buffer pages shared out to clients");
+  desc.add_options()("channels,c", po::value<uint32_t>()->default_value(1),
+                     "H2C/C2H channel pairs to drive");
+  desc.add_options()("sock,s", po::value<string>(),
+                     "Socket path (default: " XDMA_SVC_SOCK_PREFIX
+                     "N.sock or $" XDMA_SVC_SOCK_ENV ")");
+  desc.add_options()("soft", po::value<string>(),
+                     "No card: software device with this much card memory");
+  desc.add_options()("soft-mibps", po::value<double>()->default_value(0),
+                     "Software device bandwidth, 0 for memcpy speed");
+  po::variables_map vm;
+  store(parse_command_line(argc, argv, desc), vm);
+
+  if (vm.count("help")) {
+    cout << desc << "\n";
+    return 0;
+  }
+
+  unique_ptr<XDMA_udrv::XDMA> xdma;
+  unique_ptr<XDMA_udrv::XSvcBackend> backend;
+  int uio_index = vm["uio"].as<int32_t>();
+  if (vm.count("soft")) {
+    string len = vm["soft"].as<string>();
+    uint64_t card_len = strtoull(len.c_str(), 0, 0);
+    if (len.back() == 'M' || len.back() == 'm')
+      card_len <<= 20;
+    else if (len.back() == 'G' || len.back() == 'g')
+      card_len <<= 30;
+    backend = make_unique<XDMA_udrv::XSoftDevice>(
+        card_len, vm["soft-mibps"].as<double>());
+  } else {
+    xdma = XDMA_udrv::XDMA::XDMA_factory(uio_index);
+    uio_index = xdma->get_uio_index();
+    backend = make_unique<XDMA_udrv::XSchedBackend>(
+        *xdma, vm["channels"].as<uint32_t>());
+  }
+  string sock = vm.count("sock") ? vm["sock"].as<string>()
+                                 : XDMA_udrv::svc_sock_path(uio_index);
+
+  try {
+    XDMA_udrv::XSvcDaemon daemon(*backend, sock, vm["pool"].as<uint32_t>(),
+                                 vm.count("soft"));
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    cout << "Serving " << (vm.count("soft") ? "software device" : "card")
+         << " on " << sock << ", " << daemon.getNrFreePages()
+         << " GiB buffer pool" << endl;
+    daemon.run(stop);
+  } catch (const system_error &e) {
+    cerr << "xdma_svcd: " << e.what() << endl;
+    exit(1);
+  }
+  return 0;
+}
@@ -0,0 +1,100 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "XDMA_stats.hpp"
+
+using namespace std;
+
+struct chan_snapshot {
+  uint64_t bytes, desc_completed, polls, errors;
+};
+
+// Every /dev/shm/xdma_udrv.stats.uioN, or just the one asked for
+vector<int> find_segments(int uio_index) {
+  vector<int> ret;
+  if (uio_index != -1) {
+    ret.push_back(uio_index);
+    return ret;
+  }
+  string prefix = string(XDMA_STATS_SHM_PREFIX).substr(1);
+  DIR *dir = opendir("/dev/shm");
+  if (!dir)
+    return ret;
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != nullptr) {
+    if (strncmp(ent->d_name, prefix.c_str(), prefix.size()) == 0)
+      ret.push_back(atoi(ent->d_name + prefix.size()));
+  }
+  closedir(dir);
+  return ret;
+}
+
+// Read-only viewer, never touches the device or the writer's hot path
+int main(int argc, char const *argv[]) {
+  int uio_index = (argc > 1) ? atoi(argv[1]) : -1;
+  vector<unique_ptr<XDMA_udrv::XStats>> segs;
+  const char *dir_name[2] = {"H2C", "C2H"};
+
+  for (auto idx : find_segments(uio_index)) {
+    try {
+      segs.push_back(make_unique<XDMA_udrv::XStats>(idx, false));
+    } catch (exception &e) {
+      cerr << "uio" << idx << ": " << e.what() << endl;
+    }
+  }
+  if (segs.empty()) {
+    cerr << "No xdma_udrv stats segment, run the capture with stats enabled"
+         << endl;
+    exit(1);
+  }
+
+  vector<chan_snapshot> prev(segs.size() * 2 * XDMA_STATS_MAX_CH);
+  struct timespec interval = {1, 0};
+  while (1) {
+    printf("\033[H\033[2J");
+    printf("%-6s %-7s %-4s %12s %10s %10s %8s %10s %12s %8s\n", "dev", "pid",
+           "ch", "MiB/s", "desc/s", "polls/cpl", "ring", "backlog MiB",
+           "total GiB", "errors");
+    for (size_t s = 0; s < segs.size(); s++) {
+      XDMA_udrv::xdma_stats_shm *shm = segs[s]->get();
+      bool alive = kill(shm->pid, 0) == 0 || errno == EPERM;
+      for (int d = 0; d < 2; d++) {
+        for (int c = 0; c < XDMA_STATS_MAX_CH; c++) {
+          XDMA_udrv::xdma_chan_stats &st = shm->ch[d][c];
+          chan_snapshot &p = prev[(s * 2 + d) * XDMA_STATS_MAX_CH + c];
+          chan_snapshot now = {st.bytes.load(), st.desc_completed.load(),
+                               st.polls.load(), st.errors.load()};
+          if (!now.bytes && !now.desc_completed && !st.active.load())
+            continue;
+          uint64_t d_desc = now.desc_completed - p.desc_completed;
+          uint64_t d_poll = now.polls - p.polls;
+          printf("uio%-3d %-7d %s%d %12.2lf %10" PRIu64 " %10.1lf %8" PRIu64
+                 " %10.2lf %12.3lf %8" PRIu64 "%s\n",
+                 shm->uio_index, shm->pid, dir_name[d], c,
+                 (now.bytes - p.bytes) / (double)(1 << 20), d_desc,
+                 d_desc ? (double)d_poll / d_desc : 0.0,
+                 st.ring_occupancy.load(),
+                 st.sink_backlog.load() / (double)(1 << 20),
+                 now.bytes / (double)(1 << 30), now.errors,
+                 alive ? "" : " (exited)");
+          p = now;
+        }
+      }
+    }
+    fflush(stdout);
+    nanosleep(&interval, nullptr);
+  }
+  return 0;
+}
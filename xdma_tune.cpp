@@ -0,0 +1,125 @@
+#include <boost/program_options.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <inttypes.h>
+
+#include "XDMA_poll.hpp"
+#include "XDMA_timing.hpp"
+#include "XDMA_udrv.hpp"
+
+using namespace std;
+namespace po = boost::program_options;
+
+// One C2H transfer of the whole buffer, best MiB/s over n_iter runs
+double measure(XDMA_udrv::XDMAEngine &c2h, XDMA_udrv::XSGBuffer &buffer,
+               uint64_t size, XDMA_udrv::XDMA_COMPLETION_MODE completion,
+               XDMA_udrv::XPoller *poller, int n_iter) {
+  double best = 0;
+  for (int i = 0; i < n_iter; i++) {
+    XDMA_udrv::XCompletionTimeline timeline(buffer.getNrDesc());
+    // Clears the writeback area from the previous run
+    buffer.initialize();
+    timeline.mark_start();
+    c2h.start(buffer.getDescWBPaddr());
+    if (completion == XDMA_udrv::CPL_WRITEBACK)
+      timeline.wait_by_writeback(buffer.getWBVaddr());
+    else
+      timeline.wait_by_count(c2h, poller, buffer.getChunkSize());
+    c2h.clear_status();
+    c2h.stop();
+    double mibps = size / timeline.getDurationNs() * 1e9 / (1 << 20);
+    best = (mibps > best) ? mibps : best;
+  }
+  return best;
+}
+
+int main(int argc, char const *argv[]) {
+  po::options_description desc("Allowed options");
+  desc.add_options()("help,h", "print usage message");
+  desc.add_options()("size,s", po::value<string>()->default_value("0x40000000"),
+                     "Bytes per calibration transfer");
+  desc.add_options()("iter,n", po::value<int>()->default_value(3),
+                     "Transfers per configuration, best one counts");
+  desc.add_options()("channel,c", po::value<uint32_t>()->default_value(0),
+                     "C2H channel to calibrate on");
+  desc.add_options()("cpu", po::value<int>(),
+                     "Pin the polling thread to this core");
+  desc.add_options()("dry-run", "Report only, keep the saved profile");
+  po::variables_map vm;
+  store(parse_command_line(argc, argv, desc), vm);
+
+  if (vm.count("help")) {
+    cout << desc << "\n";
+    return 0;
+  }
+
+  unique_ptr<XDMA_udrv::XDMA> xdma = XDMA_udrv::XDMA::XDMA_factory();
+  uint64_t size = strtoull(vm["size"].as<string>().c_str(), 0, 0);
+  int n_iter = vm["iter"].as<int>();
+  XDMA_udrv::XDMAEngine c2h(*xdma, XDMA_udrv::DIR_C2H,
+                            vm["channel"].as<uint32_t>());
+  XDMA_udrv::poll_config poll_cfg;
+  if (vm.count("cpu")) {
+    poll_cfg.cpu = vm["cpu"].as<int>();
+    XDMA_udrv::pin_current_thread(poll_cfg.cpu);
+  }
+
+  cout << "Device " << xdma->device_key() << ", profile "
+       << xdma->profile_path() << endl;
+  if (size % XDMA_udrv::MEM_CHUNK_SIZE) {
+    cerr << "Size should be a multiple of " << XDMA_udrv::MEM_CHUNK_SIZE
+         << endl;
+    exit(1);
+  }
+
+  // Writeback only exists on AXI-Stream C2H
+  int n_completion = c2h.is_stream() ? 2 : 1;
+  XDMA_udrv::xdma_profile best;
+  printf("%10s %4s %10s %12s\n", "chunk", "adj", "completion", "MiB/s");
+  for (uint32_t chunk : {1 << 20, 4 << 20, 16 << 20, 64 << 20, 128 << 20}) {
+    for (uint32_t adj : {1, 4, 8, 16}) {
+      XDMA_udrv::XSGBuffer buffer(size, chunk, adj);
+      for (int m = 0; m < n_completion; m++) {
+        auto completion = (XDMA_udrv::XDMA_COMPLETION_MODE)m;
+        double mibps = measure(c2h, buffer, size, completion, nullptr, n_iter);
+        printf("%10u %4u %10s %12.1lf\n", chunk, adj,
+               m ? "writeback" : "count", mibps);
+        if (mibps > best.mibps) {
+          best.chunk_size = chunk;
+          best.adj_block = adj;
+          best.completion = completion;
+          best.mibps = mibps;
+        }
+      }
+    }
+  }
+
+  // Backing off frees the core, worth it unless it costs more than 2%
+  if (best.completion == XDMA_udrv::CPL_COUNT) {
+    XDMA_udrv::XSGBuffer buffer(size, best.chunk_size, best.adj_block);
+    XDMA_udrv::XPoller poller(poll_cfg);
+    double mibps = measure(c2h, buffer, size, XDMA_udrv::CPL_COUNT, &poller,
+                           n_iter);
+    printf("adaptive polling %.1lf MiB/s (%.0lf cycles/GiB)\n", mibps,
+           poller.getCyclesPerGiB());
+    best.adaptive = mibps >= best.mibps * 0.98;
+  }
+
+  printf("Best: chunk %u, adj %u, %s%s, %.1lf MiB/s\n", best.chunk_size,
+         best.adj_block,
+         (best.completion == XDMA_udrv::CPL_WRITEBACK) ? "writeback" : "count",
+         best.adaptive ? " (adaptive)" : "", best.mibps);
+  if (vm.count("dry-run"))
+    return 0;
+  xdma->set_profile(best);
+  if (!xdma->save_profile()) {
+    perror("save_profile()");
+    exit(1);
+  }
+  cout << "Saved to " << xdma->profile_path() << endl;
+  return 0;
+}
@@ -0,0 +1,155 @@
+#ifndef _XDMA_UDRV_H_
+#define _XDMA_UDRV_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+C interface of libxdma_udrv.so, for consumers linking through a C FFI
+(ctypes, cffi, Rust, Julia, ...).
+Functions returning int give 0 (or a count) on success and -errno on
+failure, xdma_last_error() then describes it. Handles are not thread safe,
+except that views may be released from any thread.
+
+Data is never copied on the way out: a view is a pointer and a length into
+a DMA buffer, ring or capture file plus a lifetime handle. The memory stays
+mapped until the view is released, even if the object it came from has been
+closed, so e.g. numpy can wrap it in place:
+
+  v = xdma_view(); lib.xdma_cap_chunk(cap, i, byref(v))
+  a = np.ctypeslib.as_array(cast(v.data, POINTER(c_uint8)), (v.len,))
+  ... lib.xdma_view_release(byref(v)) once a is no longer used
+*/
+
+#define XDMA_UDRV_ABI_VERSION 1
+
+#if defined(__GNUC__)
+#define XDMA_API __attribute__((visibility("default")))
+#else
+#define XDMA_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct xdma_dev xdma_dev;
+typedef struct xdma_buf xdma_buf;
+typedef struct xdma_queue xdma_queue;
+typedef struct xdma_ring xdma_ring;
+typedef struct xdma_cap xdma_cap;
+typedef struct xdma_ref xdma_ref;
+
+// Transfer directions, as XDMA_DIR
+#define XDMA_H2C 0
+#define XDMA_C2H 1
+
+// xdma_view.flags: last view of a packet (ring views only, others always)
+#define XDMA_VIEW_EOP (1 << 0)
+
+typedef struct xdma_dev_info {
+  int32_t uio_index;
+  int32_t n_bars;
+  int32_t xdma_bar;
+  uint32_t n_h2c;
+  uint32_t n_c2h;
+  // Channel bitmaps, bit n set for a stream (AXI-ST) channel n
+  uint32_t h2c_stream;
+  uint32_t c2h_stream;
+  uint32_t reserved;
+} xdma_dev_info;
+
+typedef struct xdma_view {
+  const void *data;
+  uint64_t len;
+  uint32_t flags;
+  // Writeback or capture status of the chunk, 0 for buffer views
+  uint32_t status;
+  xdma_ref *ref;
+} xdma_view;
+
+// One transfer between buf at offset and the card
+typedef struct xdma_xfer {
+  uint64_t id;
+  int32_t dir;
+  // -1 picks the least loaded channel of that direction
+  int32_t channel;
+  xdma_buf *buf;
+  uint64_t offset;
+  // AXI-MM address on the card, ignored by stream channels
+  uint64_t card_addr;
+  uint64_t len;
+  // Higher goes first, deadline breaks ties
+  int32_t priority;
+  uint32_t reserved;
+  // CLOCK_MONOTONIC ns, 0 for none
+  uint64_t deadline_ns;
+} xdma_xfer;
+
+typedef struct xdma_cpl {
+  uint64_t id;
+  uint64_t len;
+  int32_t status;
+  // Completed after its deadline
+  uint32_t late;
+} xdma_cpl;
+
+// XDMA_UDRV_ABI_VERSION the library was built with
+XDMA_API int xdma_abi_version(void);
+// What the last failing call on this thread ran into
+XDMA_API const char *xdma_last_error(void);
+
+// Fill up to max uio indices of XDMA devices, returns how many exist
+XDMA_API int xdma_enumerate(int32_t *uio_index, int max);
+// uio_index -1 opens the lowest numbered device
+XDMA_API int xdma_open(int32_t uio_index, xdma_dev **dev);
+// Queues and rings of the device keep it open until they are closed too
+XDMA_API void xdma_close(xdma_dev *dev);
+XDMA_API int xdma_get_info(xdma_dev *dev, xdma_dev_info *info);
+
+// One physically contiguous hugepage: 2 MiB up to that length, 1 GiB up to
+// that, longer is -EINVAL
+XDMA_API int xdma_buf_alloc(uint64_t len, xdma_buf **buf);
+// The memory lives on while views of it or transfers into it remain
+XDMA_API void xdma_buf_free(xdma_buf *buf);
+XDMA_API void *xdma_buf_addr(xdma_buf *buf);
+XDMA_API uint64_t xdma_buf_len(xdma_buf *buf);
+XDMA_API int xdma_buf_view(xdma_buf *buf, uint64_t offset, uint64_t len,
+                           xdma_view *view);
+
+// Scheduled transfers over H2C and C2H channels 0 .. n_channels - 1
+XDMA_API int xdma_queue_open(xdma_dev *dev, uint32_t n_channels,
+                             xdma_queue **queue);
+// Stops the channels, transfers still in flight are abandoned
+XDMA_API void xdma_queue_close(xdma_queue *queue);
+// -EINVAL for a channel the queue wasn't opened with
+XDMA_API int xdma_submit(xdma_queue *queue, const xdma_xfer *xfer);
+// Dispatch queued transfers and fill up to max completions, returns # filled
+XDMA_API int xdma_poll(xdma_queue *queue, xdma_cpl *cpl, int max);
+
+/*
+C2H stream receive ring of n_desc descriptors of desc_size bytes on one
+channel. Views point into the ring. Descriptors go back to the engine on
+the first recv after every view handed out before has been released, so
+holding views back throttles the stream rather than losing data.
+*/
+XDMA_API int xdma_ring_open(xdma_dev *dev, uint32_t channel, uint32_t n_desc,
+                            uint32_t desc_size, xdma_ring **ring);
+XDMA_API void xdma_ring_close(xdma_ring *ring);
+// Fill up to max views of received packets, returns # filled
+XDMA_API int xdma_ring_recv(xdma_ring *ring, xdma_view *views, int max);
+
+// Capture container written by pcicat --container, mapped read only
+XDMA_API int xdma_cap_open(const char *path, xdma_cap **cap);
+XDMA_API void xdma_cap_close(xdma_cap *cap);
+XDMA_API uint64_t xdma_cap_nr_chunks(xdma_cap *cap);
+XDMA_API int xdma_cap_chunk(xdma_cap *cap, uint64_t idx, xdma_view *view);
+
+// Drop the view's hold on its memory, view->data is invalid afterwards
+XDMA_API void xdma_view_release(xdma_view *view);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif